@@ -16,6 +16,25 @@
 #undef INPUT_SERIAL
 // FAKE TEMP SENSOR means that the temperature routine always returns 42C
 #define MOCK_TEMP_SENSOR 1
+// send the process state as binary telemetry frames instead of dumping the LCD as text
+#define TELEMETRY_BINARY
+// halt the CPU (SLEEP_MODE_IDLE) while no task is due, it still wakes with every 1 ms timer tick
+#define IDLE_SLEEP
+// latency histograms for the hot paths (perf.h), dumped with the task statistics (SCHED_STATS_PERIOD)
+#undef PERF_PROBES
+// line based command interface on Serial (serialcmd.h)
+#define SERIAL_COMMANDS
+// heat the sparge water in a second vessel with its own sensor and outlet, in parallel to mashing
+#define SPARGE_VESSEL
+// record everything the process and the UI read (recorder.h) for tools/bwreplay
+#undef RECORDER
+
+#if defined(SERIAL_COMMANDS) && defined(INPUT_SERIAL)
+#error "SERIAL_COMMANDS and INPUT_SERIAL both read from Serial, enable only one of them"
+#endif
+#if defined(RECORDER) && !defined(TELEMETRY_BINARY)
+#error "RECORDER sends its records as telemetry frames, it needs TELEMETRY_BINARY"
+#endif
 
 #ifdef __WIFI
 #include <ESP8266wifi.h>
@@ -29,11 +48,15 @@
 #define LCD_ADDRESS 0x27
 #define LCD_LINES 4
 #define LCD_COLS 20
+#define LCD_I2C_FREQ 100000UL
+#define LCD_QUEUE_SIZE 128 // output queue entries (2 per character), must be a power of 2
 
 // 2. Temperature Sensor
 #define TEMP_SENSOR_PIN 5
 #define TEMP_SENSOR_RESOLUTION 12
 #define TEMP_SENSOR_CONVERSION_TIME 750
+#define TEMP_SENSOR_MASH 0 // sensor index on the 1-Wire bus
+#define TEMP_SENSOR_SPARGE 1 // only with SPARGE_VESSEL
 
 // 3. RF Transmitter (to switch heater)
 #define RF_TRANSMITTER_PIN 8
@@ -41,32 +64,117 @@
 #define RF_TRANSMITTER_PULSE_LENGTH_US 260
 #define RF_TRANSMITTER_REPEATS 2 // actual repeats are 2^REPEATS
 #define RC_OUTLET_HEATER 1 // Remote Control Outlet ID of heater outlet
+#define RC_OUTLET_SPARGE 2 // Remote Control Outlet ID of the sparge vessel heater (SPARGE_VESSEL)
+// heaters that may be on at the same time, they share one circuit
+// when the limit is reached the mash heater takes the power from the sparge heater
+#define RC_MAX_HEATERS_ON 1
 
 // 4. SD Card
 // SD_CS_PIN is defined in pff library, no need to set here
 //#define SD_CS_PIN 10
 
 // 5. Encoder
+// all encoder pins must be on port D (0-7), they are decoded in the PCINT2 interrupt
 #define ENC_A_PIN 2
 #define ENC_B_PIN 4
 #define ENC_SW_PIN 3
+// define for encoders with a detent at every half quadrature cycle, KY-040 is full-step
+#undef ENC_HALF_STEP
+#define ENC_DEBOUNCE_US 10000 // button must be released for this long before the next click counts
+#define ENC_HOLD_US 2000000 // button press longer than this is a hold
+#define ENC_EVENT_QUEUE_SIZE 16 // input events between interrupt and UI, must be a power of 2
+// acceleration curve for numeric entry: { max ms between detents, step multiplier }
+// sorted from fast to slow, slower turns than the last entry count single steps
+#define ENC_ACCEL_CURVE { { 15, 10 }, { 30, 5 }, { 60, 2 } }
 
 // 6. WIFI
 #define WIFI_BAUD_RATE 115200
 #define WIFI_RESET_PIN A0
 
 // 7. EEPROM
+#define EEPROM_LANGUAGE_OFFSET 0
+#define EEPROM_BOIL_POINT_OFFSET 4 // float, boiling point calibrated by the boil detection
 #define EEPROM_PROC_STAT_OFFSET 32
+// the host builds in tools/ have wider types and a larger checkpoint, they move the receipe up
+#ifndef EEPROM_RECEIPE_OFFSET
 #define EEPROM_RECEIPE_OFFSET 80
+#endif
 #define EEPROM_UPDATE_INTERVAL 120
-#define PROC_STAT_VERSION 0xBEEA0002UL
+#define PROC_STAT_VERSION 0xBEEA0006UL
+
+// 8. Task scheduler, periods in ms
+#define SCHED_MAX_TASKS 7
+// the UI task is also started right away on input, so its period only drives the timers
+#define TASK_SENSOR_PERIOD 250
+#define TASK_CONTROL_PERIOD 250
+#define TASK_UI_PERIOD 100
+#define TASK_PERSIST_PERIOD 1000
+#define TASK_LOG_PERIOD 5000
+#define TELEMETRY_PERIOD 1000
+#define TASK_SERIAL_PERIOD 20 // also started right away when input arrives during the idle wait
+// print task statistics to Serial every SCHED_STATS_PERIOD ms, e.g. 60000UL
+// diagnostics only: blocking text output in between the telemetry frames
+#undef SCHED_STATS_PERIOD
+#define PERF_BUCKETS 20 // log2 latency buckets, the last one counts everything >262ms
+
+// 9. Serial command interface
+#define SERIAL_CMD_LINE_LEN 48 // longer lines are rejected
+#define SERIAL_CMD_BYTES_PER_RUN 32 // RX bytes consumed per task run
+
+// 10. Logging (log.h) and recording (recorder.h)
+#define LOG_BUFFER_SIZE 64 // ring buffer for log records, must be a power of 2 <= 128
+// per module: 0 off, 1 error, 2 warning, 3 info, 4 debug
+#define LOG_LEVEL_MAIN 3
+#define LOG_LEVEL_PROC 3
+#define LOG_LEVEL_UI 2
+#define LOG_LEVEL_ENCODER 2
+#define REC_BUFFER_SIZE 64 // ring buffer for the recorder (recorder.h), must be a power of 2 <= 128
+
+// 11. UI language
+#define UI_LANGUAGE 0 // 0 German, 1 English
+// compile in all language packs, the language can be switched with the serial "lang" command
+// and is stored in EEPROM. Undefine to only compile the UI_LANGUAGE pack
+#define UI_LANGUAGE_EEPROM
+
+// 12. Heater control
+// the heating rate for the look-ahead preheating is measured over windows of this length,
+// in which the mash heater is on all the time, and smoothed over HEAT_RATE_SMOOTHING windows
+#define HEAT_RATE_WINDOW_MS 60000UL
+#define HEAT_RATE_SMOOTHING 4
+// boil detection: while heating for the boil the temperature is sampled every
+// BOIL_DETECT_INTERVAL_MS, the boil has started when the last BOIL_DETECT_SAMPLES are flat
+#define BOIL_DETECT_SAMPLES 12
+#define BOIL_DETECT_INTERVAL_MS 5000UL
+// cooling: the temperature is sampled every COOL_FIT_INTERVAL_MS for the fit of the cooling curve,
+// the time to the pitching temperature is predicted from COOL_FIT_MIN_SAMPLES samples on
+#define COOL_FIT_INTERVAL_MS 10000UL
+#define COOL_FIT_MIN_SAMPLES 6
+// ramps: the mash heater is switched by time proportioning, on for a share of each window
+#define RAMP_DUTY_WINDOW_MS 30000UL
+
+// 13. Planner (planner.h)
+#define PLAN_PROMPT_SECONDS 600 // expected time until a prompt is confirmed (dough-in, mash-out)
+#define PLAN_LAUTER_SECONDS 3600 // expected time from mash-out to the start of heating for the boil
+#define PLAN_COOL_SECONDS 1800 // expected time to cool down to the pitching temperature, until predicted
+#define PLAN_SEND_PERIOD 60 // seconds between TELEMETRY_MSG_PLAN updates while the timeline holds
+
+// 14. Memory (memstat.h)
+#define MEM_SCAN_BYTES 32 // painted bytes checked per idle call for the stack high water mark
+#define MEM_HEADROOM_WARN 128 // log a warning when less is left between heap and stack
+// static RAM budget per global object in bytes, checked at compile time in brauwerkstatt.ino
+#define RAM_BUDGET_PROCESS 380
+#define RAM_BUDGET_UI 128
+#define RAM_BUDGET_ENCODER 144 // allocated on the heap by BrewUi
+#define RAM_BUDGET_LCD 160
+#define RAM_BUDGET_SCHEDULER 192
+#define RAM_BUDGET_SERIAL_CMD 64
+#define RAM_BUDGET_PLANNER 128
+#define RAM_BUDGET_TOTAL 1196 // sum of the objects above
 
-// set to 5000us for serial
-// set to 1000us for real encoder
+// polling interval for serial input
+// the real encoder is interrupt driven and needs no timer
 #ifdef INPUT_SERIAL
   #define INPUT_ISR_DELAY 5000
-#else
-  #define INPUT_ISR_DELAY 1000
 #endif
 
-#endif /* BRAUWERKSTATT_H_ */
+#endif /* BRAUWERKSTATT_H_ */
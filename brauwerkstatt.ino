@@ -84,20 +84,27 @@
 // header file contains:
 // - feature toggles
 // - pin definitions
-#define __DEBUG
-
 #include "brauwerkstatt.h"
 
 #include <TimerOne.h>
 #include <OneWire.h>
 #include <DallasTemperature.h>
-#include <LiquidCrystal_I2C.h>
 #include <NewRemoteTransmitter.h>
 #include <EEPROM.h>
 
+#include "lcdqueue.h"
 #include "brewproc.h"
 #include "brewui.h"
-#include "debug.h"
+#include "scheduler.h"
+#include "telemetry.h"
+#include "serialcmd.h"
+#include "perf.h"
+#include "memstat.h"
+#include "planner.h"
+#include "recorder.h"
+
+#define LOG_LEVEL LOG_LEVEL_MAIN
+#include "log.h"
 
 #ifdef __WIFI
 ESP8266wifi wifi(Serial, Serial, WIFI_RESET_PIN);
@@ -106,57 +113,189 @@ ESP8266wifi wifi(Serial, Serial, WIFI_RESET_PIN);
 // init all peripherals
 OneWire one_wire(TEMP_SENSOR_PIN);
 DallasTemperature temp_sensor(&one_wire);
-LiquidCrystal_I2C lcd(LCD_ADDRESS, LCD_COLS, LCD_LINES);
+LcdQueue lcd(LCD_ADDRESS);
 NewRemoteTransmitter rf_sender(RF_TRANSMITTER_ID, RF_TRANSMITTER_PIN, RF_TRANSMITTER_PULSE_LENGTH_US, RF_TRANSMITTER_REPEATS);
 
 // init main classes
 BrewProcess brewProc(&temp_sensor, &rf_sender);
-BrewUi brewUi(&brewProc, &lcd, ENC_A_PIN, ENC_B_PIN, ENC_SW_PIN);
+Planner planner(&brewProc);
+BrewUi brewUi(&brewProc, &planner, &lcd, ENC_A_PIN, ENC_B_PIN, ENC_SW_PIN);
+Scheduler scheduler;
+#ifdef TELEMETRY_BINARY
+Telemetry telemetry(&brewProc);
+#endif
+#ifdef SERIAL_COMMANDS
+SerialCommand serialCmd(&brewProc, &planner, &scheduler);
+int8_t serial_task_id;
+#endif
+int8_t ui_task_id;
+
+// static RAM of the big objects: { name, type, budget }
+#define MEM_OBJECT_LIST(X) \
+  X(BrewProcess, BrewProcess, RAM_BUDGET_PROCESS) \
+  X(BrewUi, BrewUi, RAM_BUDGET_UI) \
+  X(Encoder, Encoder, RAM_BUDGET_ENCODER) \
+  X(LcdQueue, LcdQueue, RAM_BUDGET_LCD) \
+  X(Scheduler, Scheduler, RAM_BUDGET_SCHEDULER) \
+  X(SerialCommand, SerialCommand, RAM_BUDGET_SERIAL_CMD) \
+  X(Planner, Planner, RAM_BUDGET_PLANNER)
+
+#define MEM_OBJECT_ENTRY(name, type, budget) { #name, sizeof(type), budget },
+#define MEM_OBJECT_CHECK(name, type, budget) \
+  static_assert(sizeof(type) <= budget, #type " exceeds its RAM budget, see brauwerkstatt.h");
+#define MEM_OBJECT_SUM(name, type, budget) + sizeof(type)
+
+const mem_object_t MEM_OBJECTS[] PROGMEM = { MEM_OBJECT_LIST(MEM_OBJECT_ENTRY) };
+const byte MEM_OBJECT_COUNT = sizeof(MEM_OBJECTS) / sizeof(MEM_OBJECTS[0]);
+#ifdef __AVR_ATmega328P__
+// the budgets are for the Nano, other targets have other type sizes
+MEM_OBJECT_LIST(MEM_OBJECT_CHECK)
+static_assert(0 MEM_OBJECT_LIST(MEM_OBJECT_SUM) <= RAM_BUDGET_TOTAL, "global objects exceed RAM_BUDGET_TOTAL");
+#endif
 
 
 void setup() {
-  // Init Timer Interrupt (for encoder)
+#ifdef INPUT_SERIAL
+  // Init Timer Interrupt (for serial input), the encoder itself uses pin change interrupts
   Timer1.initialize(INPUT_ISR_DELAY);
   Timer1.attachInterrupt(&timer_isr);
+#endif
 
   // init Serial
   while (!Serial); // wait for Serial to become available
   Serial.begin(9600);
 
+  rec_task(RecTaskSetup);
   brewProc.init();
   brewUi.init();
 
-  debug(F("Debug logging on HW Serial, ver 0002"));
+  // control runs before everything else, it decides about the heater
+  // sensor and control are phase shifted so a new reading is used right away
+  scheduler.addTask(PSTR("control"), &control_task, TASK_CONTROL_PERIOD, TASK_CONTROL_PERIOD / 2, 4);
+  scheduler.addTask(PSTR("sensor"), &sensor_task, TASK_SENSOR_PERIOD, 0, 3);
+  ui_task_id = scheduler.addTask(PSTR("ui"), &ui_task, TASK_UI_PERIOD, 0, 2);
+  scheduler.addTask(PSTR("persist"), &persistence_task, TASK_PERSIST_PERIOD, 0, 1);
+#ifdef SERIAL_COMMANDS
+  serial_task_id = scheduler.addTask(PSTR("serial"), &serial_task, TASK_SERIAL_PERIOD, 0, 2);
+#endif
+#ifdef TELEMETRY_BINARY
+  scheduler.addTask(PSTR("telemetry"), &telemetry_task, TELEMETRY_PERIOD, 0, 0);
+#else
+  scheduler.addTask(PSTR("log"), &log_task, TASK_LOG_PERIOD, 0, 0);
+#endif
+#ifdef SCHED_STATS_PERIOD
+  scheduler.addTask(PSTR("stats"), &stats_task, SCHED_STATS_PERIOD, SCHED_STATS_PERIOD, 0);
+#endif
+
+  log_info(LogStartup, 2);
 }
 
-int count = 0;
-unsigned long start = 0;
-unsigned long ui_duration = 0;
-unsigned long proc_duration = 0;
 void loop()
 {
-  start = micros();
+  bool ran;
+  {
+    PERF_SCOPE(PerfLoop);
+    ran = scheduler.run();
+  }
+  if (!ran)
+  {
+    // idle time: stack high water mark, send buffered log and input records
+    mem_scan();
+    log_flush();
+    rec_flush();
+#ifdef IDLE_SLEEP
+    scheduler.idle(&input_pending);
+#endif
+  }
+}
+
+/*
+ * wake-up check for the idle wait: handle input right away instead of waiting for the UI
+ * or serial task
+ */
+bool input_pending()
+{
+  bool pending = false;
+  if (brewUi.inputPending())
+  {
+    scheduler.trigger(ui_task_id);
+    pending = true;
+  }
+#ifdef SERIAL_COMMANDS
+  if (serialCmd.pending())
+  {
+    scheduler.trigger(serial_task_id);
+    pending = true;
+  }
+#endif
+  return pending;
+}
+
+// ==============================================
+// scheduler tasks
+// ==============================================
+void sensor_task()
+{
+  rec_task(RecTaskSensor);
+  brewProc.update_sensor();
+}
+
+void control_task()
+{
+  rec_task(RecTaskControl);
+  brewProc.update_control();
+  planner.update();
+}
+
+void ui_task()
+{
+  rec_task(RecTaskUi);
   brewUi.update_ui();
-  ui_duration += (micros() - start);
+}
 
-  start = micros();  
-  brewProc.update_process();
-  proc_duration += (micros() - start);
+void persistence_task()
+{
+  rec_task(RecTaskPersist);
+  brewProc.update_persistence();
+}
+
+#ifdef SERIAL_COMMANDS
+void serial_task()
+{
+  rec_task(RecTaskSerial);
+  serialCmd.service();
+}
+#endif
 
-  ++count;
+#ifdef TELEMETRY_BINARY
+void telemetry_task()
+{
+  telemetry.send_state();
+  planner.send();
+}
+#else
+void log_task()
+{
+  brewUi.log_state();
+}
+#endif
 
-  if (count == 200)
-  {
-    // debugnnl(F("Avg ui update ")); debugnnl(ui_duration / 200); debug(F("us"));
-    // debugnnl(F("Avg proc update ")); debugnnl(proc_duration / 200); debug(F("us"));
-    ui_duration = 0;
-    proc_duration = 0;
-    count = 0;
-  }
+#ifdef SCHED_STATS_PERIOD
+void stats_task()
+{
+  scheduler.printStats();
+  mem_report();
+#ifdef PERF_PROBES
+  perf_dump();
+  perf_reset();
+#endif
 }
+#endif
 
+#ifdef INPUT_SERIAL
 void timer_isr()
 {
   brewUi.encoder_isr();
 }
-
+#endif
+
@@ -1,6 +1,12 @@
 #include "brewproc.h"
+#include <stddef.h>
 #include <Time.h>
 #include <EEPROM.h>
+#include "perf.h"
+#include "recorder.h"
+
+#define LOG_LEVEL LOG_LEVEL_PROC
+#include "log.h"
 
 /**
  * Constructor
@@ -9,6 +15,13 @@ BrewProcess::BrewProcess(DallasTemperature* temp_sens, NewRemoteTransmitter* rf_
 {  
   _temp_stat.temp_sensor = temp_sens;
   _rf_sender = rf_sender;
+
+  _channels[ChannelMash].sensor = TEMP_SENSOR_MASH;
+  _channels[ChannelMash].outlet = RC_OUTLET_HEATER;
+#ifdef SPARGE_VESSEL
+  _channels[ChannelSparge].sensor = TEMP_SENSOR_SPARGE;
+  _channels[ChannelSparge].outlet = RC_OUTLET_SPARGE;
+#endif
 }
 
 //====================================================================================================
@@ -20,9 +33,16 @@ BrewProcess::BrewProcess(DallasTemperature* temp_sens, NewRemoteTransmitter* rf_
 void BrewProcess::init()
 {
     // Init SD Card
-  if (pf_mount(&_sd_fs) != FR_OK)
+  if (rec_result(pf_mount(&_sd_fs)) != FR_OK)
+  {
+    setError(ErrSdCard);
+  }
+
+  // calibrated boiling point, erased EEPROM reads as NaN
+  read_eeprom((byte*)(void*)&_config.boil_point, sizeof(_config.boil_point), EEPROM_BOIL_POINT_OFFSET);
+  if (!(_config.boil_point >= _config.boil_min_temp && _config.boil_point <= 105.0F))
   {
-    setError(PSTR("SD-Karten-Fehler"));
+    _config.boil_point = 0.0F;
   }
 
   // state recovery from eeprom
@@ -32,7 +52,7 @@ void BrewProcess::init()
   setup_temp_sensor();
 
   // Init Heater
-  turn_off_heater();
+  turn_off_heaters();
 }
 
 /** 
@@ -40,6 +60,13 @@ void BrewProcess::init()
  * Just calls state updates in the right order
  */
 void BrewProcess::update_process()
+{
+  update_sensor();
+  update_control();
+  update_persistence();
+}
+
+void BrewProcess::update_sensor()
 {
   // if we have an error, we do nothing until it has been reset.
   if (_transient_proc_stat.has_error)
@@ -49,64 +76,175 @@ void BrewProcess::update_process()
   
   // temp reading is done even if process is not running
   read_temp_sensor();
+}
 
-  if (_proc_stat.running)
+void BrewProcess::update_control()
+{
+  if (_transient_proc_stat.has_error)
   {
-    update_target_temp();
-    update_state_machine();
-    update_heater();
-    update_display_name();
-    update_eeprom(false);
+    return;
   }
-  return;
+
+  // mash first, it has priority when both heaters want power
+  // nothing is compared with the temperature before the first reading, e.g. right after a
+  // restart, the heaters stay off until then
+  if (_proc_stat.running && _channels[ChannelMash].temp_valid)
+  {
+    update_program();
+    update_heat_rate();
+    update_heater(ChannelMash, _proc_stat.current_step, control_target_temp());
+  }
+#ifdef SPARGE_VESSEL
+  if (_proc_stat.sparge.running && _channels[ChannelSparge].temp_valid)
+  {
+    handle_sparge_vessel();
+    update_heater(ChannelSparge, _proc_stat.sparge.step, _receipe.second_wash_temp);
+  }
+#endif
+}
+
+void BrewProcess::update_persistence()
+{
+  if (_transient_proc_stat.has_error || !isRunning())
+  {
+    return;
+  }
+
+  update_eeprom(false);
+}
+
+void BrewProcess::setWarning(byte code)
+{
+  _transient_proc_stat.has_warning = true;
+  _transient_proc_stat.message_code = code;
+  _changes |= ChangedError;
+  log_warn(LogWarning, code);
+}
+
+void BrewProcess::setError(byte code)
+{
+  _transient_proc_stat.has_error = true;
+  _transient_proc_stat.message_code = code;
+  _changes |= ChangedError;
+  log_error(LogError, code);
 }
 
 void BrewProcess::stop_process()
 {
   _proc_stat.running = false;
-  turn_off_heater();
+  _proc_stat.sparge.running = false;
+  _changes |= ChangedPhase;
+  turn_off_heaters();
   update_eeprom(true);
 }
 
-void BrewProcess::start_boil_process()
+void BrewProcess::stop_sparge()
 {
-  //TODO
+  if (!_proc_stat.sparge.running)
+  {
+    return;
+  }
+  _proc_stat.sparge.running = false;
+  _changes |= ChangedPhase;
+#ifdef SPARGE_VESSEL
+  turn_off_heater(ChannelSparge);
+#endif
+  update_eeprom(true);
 }
 
-void BrewProcess::start_second_wash_process()
+bool BrewProcess::start_boil_process()
 {
   if (!_receipe.loaded)
   {
-    setWarning(PSTR("Kein Rezept"));
+    log_warn(LogNoReceipe);
+    return false;
   }
-  else
+  if (_proc_stat.running)
   {
-    if(!_proc_stat.running)
-    {
-      _proc_stat.current_phase = Phase::SecondWash;
-      _proc_stat.current_step = Step::Start;
-      
-      _proc_stat.process_start = now();
-      _proc_stat.phase_start = now();
-      _proc_stat.current_rest = -1;
-      _proc_stat.running = true;
-      _proc_stat.phase_char = 'N';
-      update_process();
+    log_warn(LogAlreadyRunning);
+    return false;
+  }
+  _proc_stat.current_phase = Phase::Boil;
+  _proc_stat.current_step = Step::Start;
+  _proc_stat.pc = _receipe.boil_pc;
+  _proc_stat.need_confirmation = false;
 
-      debug(F("Nachguss initialisiert"));
-    }
-    else
-    {
-      debug(F("Process already running"));
-    }
+  // a running sparge vessel has already started the brew
+  if (!_proc_stat.sparge.running)
+  {
+    _proc_stat.process_start = rec_now();
+  }
+  _proc_stat.phase_start = rec_now();
+  _proc_stat.current_rest = -1;
+  _proc_stat.target_temp = -1;
+  _proc_stat.running = true;
+  _proc_stat.phase_char = 'K';
+  _changes |= ChangedPhase;
+  update_process();
+
+  log_info(LogBoilStarted);
+  return true;
+}
+
+bool BrewProcess::start_second_wash_process()
+{
+  if (!_receipe.loaded)
+  {
+    setWarning(WarnNoReceipe);
+    return false;
+  }
+#ifdef SPARGE_VESSEL
+  // own vessel: runs next to the mash process
+  if (_proc_stat.sparge.running)
+  {
+    log_warn(LogAlreadyRunning);
+    return false;
+  }
+  if (!_proc_stat.running)
+  {
+    _proc_stat.process_start = rec_now();
+  }
+  // its sensor is only read while the vessel runs, wait for a fresh reading
+  _channels[ChannelSparge].temp_valid = false;
+  _proc_stat.sparge.running = true;
+  _proc_stat.sparge.step = Step::Start;
+  _proc_stat.sparge.start = rec_now();
+  _changes |= ChangedPhase;
+  update_process();
+
+  log_info(LogSpargeStarted);
+  return true;
+#else
+  // single vessel: the sparge water is heated after mashing
+  if(!_proc_stat.running)
+  {
+    _proc_stat.current_phase = Phase::SecondWash;
+    _proc_stat.current_step = Step::Start;
+    _proc_stat.pc = _receipe.sparge_pc;
+    _proc_stat.need_confirmation = false;
+    
+    _proc_stat.process_start = rec_now();
+    _proc_stat.phase_start = rec_now();
+    _proc_stat.current_rest = -1;
+    _proc_stat.target_temp = -1;
+    _proc_stat.running = true;
+    _proc_stat.phase_char = 'N';
+    _changes |= ChangedPhase;
+    update_process();
+
+    log_info(LogSpargeStarted);
+    return true;
   }
+  log_warn(LogAlreadyRunning);
+  return false;
+#endif
 }
 
-void BrewProcess::start_mash_process()
+bool BrewProcess::start_mash_process()
 {
   if (!_receipe.loaded)
   {
-    debug(F("Rezept nicht geladen!"));
+    log_warn(LogNoReceipe);
   }
   else
   {
@@ -114,28 +252,44 @@ void BrewProcess::start_mash_process()
     {
       _proc_stat.current_phase = Phase::MashIn;
       _proc_stat.current_step = Step::Start;
+      _proc_stat.pc = 0;
+      _proc_stat.need_confirmation = false;
       
-      _proc_stat.process_start = now();
-      _proc_stat.phase_start = now();
+      // a running sparge vessel has already started the brew
+      if (!_proc_stat.sparge.running)
+      {
+        _proc_stat.process_start = rec_now();
+      }
+      _proc_stat.phase_start = rec_now();
       _proc_stat.current_rest = -1;
+      _proc_stat.target_temp = -1;
       _proc_stat.running = true;
       _proc_stat.phase_char = 'M';
+      _changes |= ChangedPhase;
       update_process();
 
-      debug(F("Maischen initialisiert"));
+      log_info(LogMashStarted);
+      return true;
     }
     else
     {
-      debug(F("Process already running!"));
+      log_warn(LogAlreadyRunning);
     }
   }
+  return false;
 }
 
 void BrewProcess::load_receipe()
 {
-  if(pf_open("REZEPT.TXT"))
+  // the running process executes the program of the receipe
+  if (_proc_stat.running)
+  {
+    return;
+  }
+  _receipe = receipe_t();
+  if(rec_result(pf_open("REZEPT.TXT")))
   {
-    setError(PSTR("REZEPT.TXT fehlt"));
+    setError(ErrReceipeMissing);
     return;
   }
 
@@ -146,12 +300,12 @@ void BrewProcess::load_receipe()
   {
     unsigned int cnt;
     pf_read(buf, sizeof(buf), &cnt);
+    cnt = rec_file(buf, cnt);
     if (cnt == 0)
     {
       break;
     }
-    int i = 0;
-    for (; i < cnt; i++)
+    for (unsigned int i = 0; i < cnt; i++)
     {
       if(buf[i] == '\r' || buf[i] == '\n')
       {
@@ -161,7 +315,7 @@ void BrewProcess::load_receipe()
         {
           if(!parse_receipe_line(line))
           {
-            setError("Parse-Fehler");
+            setError(ErrReceipeParse);
             return;
           }
         }
@@ -169,9 +323,9 @@ void BrewProcess::load_receipe()
       }
       else
       {
-        if (b >= sizeof(line))
+        if (b >= (int)sizeof(line))
         {
-          setError(PSTR("Zeile zu lange"));
+          setError(ErrLineTooLong);
           return;
         }
         line[b] = buf[i];
@@ -179,45 +333,113 @@ void BrewProcess::load_receipe()
       }
     }
   }
-  /*
-  _receipe.num_rests = 2;
+  end_receipe();
+}
+
+bool BrewProcess::begin_receipe()
+{
+  if (isRunning())
+  {
+    return false;
+  }
+  _receipe = receipe_t();
+  return true;
+}
 
-  _receipe.mash_in_temp = 30;
-  _receipe.second_wash_temp = 41;
+void BrewProcess::end_receipe()
+{
+  finish_program();
+  _receipe.loaded = true;
+}
 
-  _receipe.rest_temp[0] = 37;
-  _receipe.rest_temp[1] = 41;
-  //_receipe.rast_temp[2] = 72;
-  //_receipe.rast_temp[3] = 78;
+/*
+ * append a step to the mash schedule, false if there is no room left for it and the tail
+ */
+bool BrewProcess::append_step(byte op, byte arg1, byte arg2)
+{
+  byte len = program_op_length(op);
+  if (_receipe.program_len + len > PROGRAM_SIZE - PROGRAM_TAIL)
+  {
+    log_warn(LogReceipeTooLong, _receipe.program_len);
+    return false;
+  }
+  byte* p = &_receipe.program[_receipe.program_len];
+  p[0] = op;
+  if (len > 1) p[1] = arg1;
+  if (len > 2) p[2] = arg2;
+  _receipe.program_len += len;
+  return true;
+}
 
-  _receipe.rest_duration[0] = 1;
-  _receipe.rest_duration[1] = 1;
-  //_receipe.rast_dauer[2] = 2;
-  //_receipe.rast_dauer[3] = 2;
+/*
+ * mash-out after the steps of the receipe, then the single vessel sparge program and the boil
+ * append_step() has kept the room for them
+ */
+void BrewProcess::finish_program()
+{
+  byte* p = &_receipe.program[_receipe.program_len];
+  *p++ = OpPhase;
+  *p++ = MashOut;
+  *p++ = OpPrompt;
+  *p++ = StrOk;
+  *p++ = OpEnd;
+  _receipe.sparge_pc = p - _receipe.program;
+  *p++ = OpPhase;
+  *p++ = SecondWash;
+  *p++ = OpHeatTo;
+  *p++ = _receipe.second_wash_temp;
+  *p++ = OpPrompt;
+  *p++ = StrOk;
+  *p++ = OpEnd;
 
-  _receipe.wort_boil_duration = 90;
-  _receipe.num_hops_add = 4;
-  _receipe.hops_boil_times[0] = HOP_ADD_FIRST_WORT;
-  _receipe.hops_boil_times[1] = 60;
-  _receipe.hops_boil_times[2] = 15;
-  _receipe.hops_boil_times[3] = HOP_ADD_WHIRLPOOL;
-  */
-  _receipe.loaded = true;
+  // first wort hops go in while lautering, before the boil starts, whirlpool hops after it
+  // the other additions are timed by the hop timer of the boil step
+  bool first_wort = false;
+  bool whirlpool = false;
+  for (byte i = 0; i < _receipe.num_hops_add; i++)
+  {
+    first_wort |= _receipe.hops_boil_times[i] == HOP_ADD_FIRST_WORT;
+    whirlpool |= _receipe.hops_boil_times[i] == HOP_ADD_WHIRLPOOL;
+  }
+  _receipe.boil_pc = p - _receipe.program;
+  *p++ = OpPhase;
+  *p++ = Boil;
+  if (first_wort)
+  {
+    *p++ = OpPrompt;
+    *p++ = StrHopsFirstWort;
+  }
+  *p++ = OpBoil;
+  *p++ = _receipe.wort_boil_duration;
+  if (whirlpool)
+  {
+    *p++ = OpPrompt;
+    *p++ = StrHopsWhirlpool;
+  }
+  if (_receipe.pitch_temp > 0)
+  {
+    *p++ = OpPhase;
+    *p++ = Cool;
+    *p++ = OpCool;
+    *p++ = _receipe.pitch_temp;
+    *p++ = OpPrompt;
+    *p++ = StrPitch;
+  }
+  *p++ = OpEnd;
 }
 
 bool BrewProcess::parse_receipe_line(char* line)
 {
-  debugnnl(F("rcpt_line: ")); debug(line);
   if (line[0] == '#') return true; // skip comments
   char key[12];
   char val[9];
   byte idx = 0; // rests and hops additions
   bool after_eq = false;
   bool val_is_number = true;
-  int num_val;
+  long num_val = 0;
   key[0] = '\0';
   val[0] = '\0';
-  for (int k = 0; k < strlen(line); k++)
+  for (size_t k = 0; line[k] != '\0'; k++)
   {
     if (isspace(line[k])) continue;
     if (isdigit(line[k]) && !after_eq)
@@ -231,10 +453,10 @@ bool BrewProcess::parse_receipe_line(char* line)
     }
     if (after_eq)
     {
-      int len = strlen(val);
-      if (len >= sizeof(val))
+      size_t len = strlen(val);
+      if (len + 1 >= sizeof(val))
       {
-        debug(F("Value too long"));
+        log_warn(LogReceipeValueTooLong);
         return false;
       }
       val[len] = line[k];
@@ -243,10 +465,10 @@ bool BrewProcess::parse_receipe_line(char* line)
     }
     else
     {
-      int len = strlen(key);
-      if (len >= sizeof(key))
+      size_t len = strlen(key);
+      if (len + 1 >= sizeof(key))
       {
-        debug(F("Key too long"));
+        log_warn(LogReceipeKeyTooLong);
         return false;
       }
       key[len] = line[k];
@@ -255,15 +477,16 @@ bool BrewProcess::parse_receipe_line(char* line)
   }
   if (!after_eq)
   {
-    debug(F("= missing"));
+    log_warn(LogReceipeNoEquals);
     return false;
   }
   if (val_is_number)
   {
-    num_val = atoi(val);
+    num_val = atol(val);
   }
 
-  // enum ReceipeKey { Name, MashInTemp, Rests, RestTemp, RestDuration, SpargeTemp, BoilDuration, HopAdditions, HopBoilDuration };
+  // enum ReceipeKey { Name, MashInTemp, Rests, RestTemp, RestDuration, SpargeTemp, BoilDuration, HopAdditions, HopBoilDuration,
+  //   StepHeat, StepHold, StepRamp, StepPrompt, StepAlarm, StepBranch, PitchTemp };
   ReceipeKey rcp_key;
   if(strcmp_P(key, PSTR("name")) == 0) rcp_key = ReceipeKey::Name;
   else if (strcmp_P(key, PSTR("einmaisch_t")) == 0) rcp_key = ReceipeKey::MashInTemp;
@@ -271,6 +494,14 @@ bool BrewProcess::parse_receipe_line(char* line)
   else if (strcmp_P(key, PSTR("nachguss_t")) == 0) rcp_key = ReceipeKey::SpargeTemp;
   else if (strcmp_P(key, PSTR("koch_d")) == 0) rcp_key = ReceipeKey::BoilDuration;
   else if (strcmp_P(key, PSTR("hopfengaben")) == 0) rcp_key = ReceipeKey::HopAdditions;
+  else if (strcmp_P(key, PSTR("anstell_t")) == 0) rcp_key = ReceipeKey::PitchTemp;
+  // single steps of the mash schedule, in the order they appear
+  else if (strcmp_P(key, PSTR("heizen")) == 0) rcp_key = ReceipeKey::StepHeat; // heizen = 63
+  else if (strcmp_P(key, PSTR("halten")) == 0) rcp_key = ReceipeKey::StepHold; // halten = 30
+  else if (strcmp_P(key, PSTR("rampe")) == 0) rcp_key = ReceipeKey::StepRamp; // rampe = 72/20
+  else if (strcmp_P(key, PSTR("pause")) == 0) rcp_key = ReceipeKey::StepPrompt; // pause = 1
+  else if (strcmp_P(key, PSTR("alarm")) == 0) rcp_key = ReceipeKey::StepAlarm; // alarm = 1
+  else if (strcmp_P(key, PSTR("wenn_unter")) == 0) rcp_key = ReceipeKey::StepBranch; // wenn_unter = 60/2
   else
   {
     // parse the dynamic entries
@@ -292,18 +523,36 @@ bool BrewProcess::parse_receipe_line(char* line)
         return false;
       }
     }
-    else if (strncmp_P(key, PSTR("hopfengabe"), 10) &&
+    else if (strncmp_P(key, PSTR("hopfengabe"), 10) == 0 &&
       strlen(key) == 11 &&
       key[10] - '0' == idx)
     {
-      rcp_key == ReceipeKey::HopBoilDuration;
+      rcp_key = ReceipeKey::HopBoilDuration;
     }
     else
     {
       return false;
     }
   }
-  if (rcp_key != ReceipeKey:: HopBoilDuration && rcp_key != ReceipeKey::Name && !val_is_number)
+  // two numbers: "a/b"
+  char* second = strchr(val, '/');
+  bool val_is_pair = second != NULL && isdigit(val[0]) && isdigit(second[1]);
+  long second_val = 0;
+  if (val_is_pair)
+  {
+    num_val = atol(val);
+    second_val = atol(second + 1);
+  }
+  // the operands of the program are bytes, larger values would wrap, e.g. a rest of 300 minutes
+  if (num_val > 255 || second_val > 255)
+  {
+    return false;
+  }
+  if ((rcp_key == ReceipeKey::StepRamp || rcp_key == ReceipeKey::StepBranch) != val_is_pair)
+  {
+    return false;
+  }
+  if (rcp_key != ReceipeKey::HopBoilDuration && rcp_key != ReceipeKey::Name && !val_is_number && !val_is_pair)
   {
     return false;
   }
@@ -313,26 +562,51 @@ bool BrewProcess::parse_receipe_line(char* line)
     strcpy(_receipe.name, val);
     break;
   case ReceipeKey::MashInTemp:
-    _receipe.mash_in_temp = num_val;
+    _receipe.program[PROGRAM_MASH_IN_TEMP] = num_val;
     break;
   case ReceipeKey::Rests:
+    // heat-up and hold of each rest, filled in by the rastN_ lines
+    if (_receipe.num_rests > 0) return false;
+    _receipe.rests_pc = _receipe.program_len;
+    for (byte r = 0; r < num_val; r++)
+    {
+      if (!append_step(OpHeatTo, 0, 0) || !append_step(OpHoldFor, 0, 0)) return false;
+    }
     _receipe.num_rests = num_val;
     break;
   case ReceipeKey::RestTemp:
     if(idx < 1 || idx > _receipe.num_rests) return false;
-    _receipe.rest_temp[idx - 1] = num_val;
+    _receipe.program[_receipe.rests_pc + 4 * (idx - 1) + 1] = num_val;
     break;
   case ReceipeKey::RestDuration:
     if(idx < 1 || idx > _receipe.num_rests) return false;
-    _receipe.rest_duration[idx - 1] = num_val;
+    _receipe.program[_receipe.rests_pc + 4 * (idx - 1) + 3] = num_val;
     break;
+  case ReceipeKey::StepHeat:
+    return append_step(OpHeatTo, num_val, 0);
+  case ReceipeKey::StepHold:
+    return append_step(OpHoldFor, num_val, 0);
+  case ReceipeKey::StepRamp:
+    return append_step(OpRamp, num_val, second_val);
+  case ReceipeKey::StepPrompt:
+    return append_step(OpPrompt, StrOk, 0);
+  case ReceipeKey::StepAlarm:
+    return append_step(OpAlarm, StrAlarm, 0);
+  case ReceipeKey::StepBranch:
+    return append_step(OpBranchBelow, num_val, second_val);
   case ReceipeKey::SpargeTemp:
     _receipe.second_wash_temp = num_val;
     break;
   case ReceipeKey::BoilDuration:
+    // the boil step of the program counts in one byte
+    if (num_val > 255) return false;
     _receipe.wort_boil_duration = num_val;
     break;
+  case ReceipeKey::PitchTemp:
+    _receipe.pitch_temp = num_val;
+    break;
   case ReceipeKey::HopAdditions:
+    if (num_val > MAX_HOP_ADDITIONS) return false;
     _receipe.num_hops_add = num_val;
     break;
   case ReceipeKey::HopBoilDuration:
@@ -359,193 +633,568 @@ bool BrewProcess::parse_receipe_line(char* line)
   return true;
 }
 
+// ====================================================
+// config access by name
+// ====================================================
+struct BrewProcess::config_param_t {
+  char name[14];
+  byte offset;
+  byte decimals; // 0: unsigned int, else float
+  float max;
+  unsigned int step; // one detent on the settings screen, in units of 10^-decimals
+};
+
+#define CONFIG_PARAM(name, field, decimals, max, step) { name, offsetof(config_t, field), decimals, max, step }
+
+const BrewProcess::config_param_t BrewProcess::CONFIG_PARAMS[] PROGMEM = {
+  CONFIG_PARAM("hysteresis", heater_hysteresis, 2, 10.0F, 5),
+  CONFIG_PARAM("throttle_diff", heater_throttle_diff, 2, 10.0F, 5),
+  CONFIG_PARAM("off_diff", heater_off_diff, 2, 10.0F, 5),
+  CONFIG_PARAM("cook_temp", heater_cook_temp, 2, 105.0F, 10),
+  CONFIG_PARAM("throttle_on", throttled_on_ms, 0, 65535.0F, 500),
+  CONFIG_PARAM("throttle_off", throttled_off_ms, 0, 65535.0F, 500),
+  CONFIG_PARAM("read_interval", temp_read_interval, 0, 65535.0F, 100),
+  CONFIG_PARAM("lookahead", lookahead, 0, 1.0F, 1),
+  CONFIG_PARAM("lookahead_max", lookahead_max, 2, 10.0F, 10),
+  CONFIG_PARAM("heat_rate", heat_rate, 2, 10.0F, 5),
+  CONFIG_PARAM("boil_slope", boil_slope, 2, 10.0F, 1),
+  CONFIG_PARAM("boil_ci", boil_confidence, 2, 10.0F, 10),
+  CONFIG_PARAM("boil_min_temp", boil_min_temp, 2, 105.0F, 10),
+  CONFIG_PARAM("boil_point", boil_point, 2, 105.0F, 10),
+  CONFIG_PARAM("coolant_temp", coolant_temp, 2, 40.0F, 10),
+  CONFIG_PARAM("ramp_gain", ramp_gain, 2, 10.0F, 5)
+};
+
+#define NUM_CONFIG_PARAMS (sizeof(CONFIG_PARAMS) / sizeof(CONFIG_PARAMS[0]))
+
+int8_t BrewProcess::findConfig(const char* name)
+{
+  for (byte i = 0; i < NUM_CONFIG_PARAMS; i++)
+  {
+    if (strcmp_P(name, CONFIG_PARAMS[i].name) == 0)
+    {
+      return i;
+    }
+  }
+  return -1;
+}
+
+byte BrewProcess::numConfig()
+{
+  return NUM_CONFIG_PARAMS;
+}
+
+const char* BrewProcess::configName(byte idx)
+{
+  return CONFIG_PARAMS[idx].name;
+}
+
+byte BrewProcess::configDecimals(byte idx)
+{
+  return pgm_read_byte(&CONFIG_PARAMS[idx].decimals);
+}
+
+float BrewProcess::configMax(byte idx)
+{
+  return pgm_read_float(&CONFIG_PARAMS[idx].max);
+}
+
+unsigned int BrewProcess::configStep(byte idx)
+{
+  return pgm_read_word(&CONFIG_PARAMS[idx].step);
+}
+
+float BrewProcess::getConfig(byte idx)
+{
+  byte* p = (byte*)(void*)&_config + pgm_read_byte(&CONFIG_PARAMS[idx].offset);
+  if (configDecimals(idx) == 0)
+  {
+    return *(unsigned int*)(void*)p;
+  }
+  return *(float*)(void*)p;
+}
+
+bool BrewProcess::setConfig(byte idx, float value)
+{
+  // written so that NaN fails as well
+  if (!(value >= 0 && value <= configMax(idx)))
+  {
+    return false;
+  }
+  // a boiling point is only taken in the range init() accepts from the EEPROM, up to the
+  // maximum of 105, 0 clears it
+  bool boil_point = pgm_read_byte(&CONFIG_PARAMS[idx].offset) == offsetof(config_t, boil_point);
+  if (boil_point && value != 0 && value < _config.boil_min_temp)
+  {
+    return false;
+  }
+  byte* p = (byte*)(void*)&_config + pgm_read_byte(&CONFIG_PARAMS[idx].offset);
+  if (configDecimals(idx) == 0)
+  {
+    *(unsigned int*)(void*)p = (unsigned int)value;
+  }
+  else
+  {
+    *(float*)(void*)p = value;
+  }
+  if (boil_point)
+  {
+    save_boil_point();
+  }
+  return true;
+}
+
 /*====================================================================================================
- * Implementation of state machine / process control
- * There are one to several methods for each supported process.
+ * Implementation of the process control
+ * The mash and the single vessel sparge process run the program of the receipe (program.h), the
+ * sparge vessel has its own small state machine.
  * Supported Processes are:
  * - Mashing (done)
  * - Second wash heating (done)
- * - Boiling (planned)
- * - Cooling (planned)
+ * - Boiling (done)
+ * - Cooling (done)
  * ==================================================================================================== */
-void BrewProcess::update_state_machine()
+
+// in the order of Opcode
+const BrewProcess::op_handler_t BrewProcess::OP_HANDLERS[] PROGMEM = {
+  &BrewProcess::op_end,
+  &BrewProcess::op_phase,
+  &BrewProcess::op_heat_to,
+  &BrewProcess::op_hold_for,
+  &BrewProcess::op_ramp,
+  &BrewProcess::op_prompt,
+  &BrewProcess::op_alarm,
+  &BrewProcess::op_boil,
+  &BrewProcess::op_branch_below,
+  &BrewProcess::op_cool
+};
+
+/*
+ * run the step at the program counter, when it has finished the next one right away, so steps
+ * without a duration (phase, alarm, branch) take no tick of their own
+ * a step is entered with current_step == Step::Start
+ */
+void BrewProcess::update_program()
 {
-  switch(_proc_stat.current_phase)
+  static_assert(sizeof(OP_HANDLERS) / sizeof(OP_HANDLERS[0]) == OpCount, "one handler per opcode");
+
+  // an alarm is shown until it is confirmed, while the program goes on
+  if (_proc_stat.need_confirmation && _proc_stat.current_step != Step::UserPrompt && _transient_proc_stat.user_confirmed)
   {
-  case Phase::MashIn:
-    handle_mash_in();
-    break;
-  case Phase::Rest:
-    handle_rests();
-    break;
-  case Phase::MashOut:
-    handle_mash_out();
-    break;
-  case Phase::SecondWash:
-    handle_second_wash();
-    break;
-  case Phase::Boil:
-    // TODO
-    break;
-  default:
-    debugnnl(F("Ungueltige Phase "));
-    debug(_proc_stat.current_phase);
+    _proc_stat.need_confirmation = false;
+    _transient_proc_stat.user_confirmed = false;
+    _changes |= ChangedPrompt;
   }
-}
 
-void BrewProcess::handle_second_wash()
-{
-  switch(_proc_stat.current_step)
+  for (byte n = 0; n < PROGRAM_SIZE && _proc_stat.running; n++)
   {
-  case Step::Start:
-    // nothing to do
-    step_transition(Step::Heat);
-    break;
-  case Step::Heat:
-    if(_temp_stat.current_temp >= _proc_stat.target_temp)
+    const byte* op = &_receipe.program[_proc_stat.pc];
+    if (_proc_stat.pc >= PROGRAM_SIZE || *op >= OpCount)
     {
-      debug(F("Nachguss-Temperatur erreicht"));
-      step_transition(Step::UserPrompt);
+      log_error(LogProgramError, _proc_stat.pc, *op);
+      step_transition(Step::Terminated);
+      return;
     }
-    break;
-  case Step::UserPrompt:
-    if(_transient_proc_stat.user_confirmed)
+    op_handler_t handler;
+    memcpy_P(&handler, &OP_HANDLERS[*op], sizeof(handler));
+    byte next = (this->*handler)(op + 1);
+    if (next == 0)
     {
-      debug(F("User hat bestaetigt"));
-      step_transition(Step::Terminated);
+      return;
     }
-    break;
-  case Step::Terminated:
-    break;
-  default:
-    debug(F("Invalid step"));
+    _proc_stat.pc += next;
+    _proc_stat.current_step = Step::Start;
+  }
+}
+
+byte BrewProcess::op_end(const byte* /* args */)
+{
+  step_transition(Step::Terminated);
+  return 0;
+}
+
+byte BrewProcess::op_phase(const byte* args)
+{
+  phase_transition((Phase)args[0]);
+  _proc_stat.current_rest = -1;
+  set_target_temp(-1);
+  return 2;
+}
+
+byte BrewProcess::op_heat_to(const byte* args)
+{
+  if (_proc_stat.current_step == Step::Start)
+  {
+    ++_proc_stat.current_rest;
+    set_target_temp(args[0]);
+    _proc_stat.phase_start = rec_now();
+    step_transition(Step::Heat);
+  }
+  if (_channels[ChannelMash].current_temp >= _proc_stat.target_temp)
+  {
+    log_info(LogTempReached, (long)(_proc_stat.target_temp * 100), _proc_stat.pc);
+    return 2;
   }
+  return 0;
 }
 
-void BrewProcess::handle_mash_out()
+byte BrewProcess::op_hold_for(const byte* args)
 {
-  switch(_proc_stat.current_step)
+  if (_proc_stat.current_step == Step::Start)
+  {
+    // expectation is to see current rest duration in display
+    _proc_stat.phase_start = rec_now();
+    start_step_timer();
+    step_transition(Step::Hold);
+  }
+  if (is_step_timer_over(args[0] * 60UL))
+  {
+    log_info(LogRestEnd, _proc_stat.current_rest + 1);
+    return 2;
+  }
+  return 0;
+}
+
+byte BrewProcess::op_ramp(const byte* args)
+{
+  if (_proc_stat.current_step == Step::Start)
+  {
+    ++_proc_stat.current_rest;
+    _proc_stat.ramp_from = _proc_stat.target_temp > 0 ? _proc_stat.target_temp : _channels[ChannelMash].current_temp;
+    _proc_stat.phase_start = rec_now();
+    start_step_timer();
+    _ramp = ramp_stat_t();
+    step_transition(Step::Ramp);
+  }
+  unsigned long duration = args[1] * 60UL;
+  unsigned long elapsed = rec_now() - _proc_stat.step_start;
+  if (elapsed < duration)
+  {
+    // in steps of 0.1K, the display shows no more
+    float target = _proc_stat.ramp_from + (args[0] - _proc_stat.ramp_from) * elapsed / duration;
+    set_target_temp((long)(target * 10) / 10.0F);
+    // heater duty for the rate alone, the full power rate is the heater power over the heat
+    // capacity of the kettle, none without a rate (heat_rate can be set to 0)
+    float rate = heatRate();
+    float duty = rate > 0 ? (args[0] - _proc_stat.ramp_from) / duration / rate : 0;
+    _ramp.feed_forward = constrain(duty, 0.0F, 1.0F);
+    _ramp.max_dev = max(_ramp.max_dev, fabs(target - _channels[ChannelMash].current_temp));
+    return 0;
+  }
+  set_target_temp(args[0]);
+  if (_proc_stat.current_step == Step::Ramp)
+  {
+    // rate adherence, then heat up as usual if the ramp has fallen behind
+    float rate = (_channels[ChannelMash].current_temp - _proc_stat.ramp_from) * 60000.0F / duration;
+    log_info(LogRampEnd, (long)rate, (long)((args[0] - _proc_stat.ramp_from) * 60000.0F / duration), (long)(_ramp.max_dev * 100));
+    step_transition(Step::Heat);
+  }
+  if (_channels[ChannelMash].current_temp >= _proc_stat.target_temp)
+  {
+    log_info(LogTempReached, (long)(_proc_stat.target_temp * 100), _proc_stat.pc);
+    return 3;
+  }
+  return 0;
+}
+
+byte BrewProcess::op_prompt(const byte* args)
+{
+  // also after a restart, the text is not saved
+  _transient_proc_stat.user_prompt = args[0];
+  if (_proc_stat.current_step == Step::Start)
   {
-  case Step::Start:
-    // nothing to initialize, move to Heat immediately
     step_transition(Step::UserPrompt);
-    break;
-  case Step::UserPrompt:
-    if(_transient_proc_stat.user_confirmed)
+  }
+  if (_transient_proc_stat.user_confirmed)
+  {
+    log_info(LogUserConfirmed);
+    _proc_stat.need_confirmation = false;
+    _transient_proc_stat.user_confirmed = false;
+    _changes |= ChangedPrompt;
+    return 2;
+  }
+  return 0;
+}
+
+byte BrewProcess::op_alarm(const byte* args)
+{
+  log_warn(LogAlarm, _proc_stat.pc);
+  show_alarm(args[0]);
+  return 2;
+}
+
+/*
+ * show a text until it is confirmed, the process goes on meanwhile
+ */
+void BrewProcess::show_alarm(byte text)
+{
+  _transient_proc_stat.user_prompt = text;
+  _proc_stat.need_confirmation = true;
+  _transient_proc_stat.user_confirmed = false;
+  _changes |= ChangedPrompt;
+}
+
+byte BrewProcess::op_boil(const byte* args)
+{
+  if (_proc_stat.current_step == Step::Start)
+  {
+    set_target_temp(cookTemp());
+    _proc_stat.phase_start = rec_now();
+    _boil_detect.count = 0;
+    step_transition(Step::Heat);
+  }
+  if (_proc_stat.current_step == Step::Heat)
+  {
+    // the boiling point, or a plateau of the temperature below it
+    if (_channels[ChannelMash].current_temp >= _proc_stat.target_temp)
     {
-      debug(F("User hat bestaetigt"));
-      step_transition(Step::Terminated);
+      log_info(LogTempReached, (long)(_proc_stat.target_temp * 100), _proc_stat.pc);
     }
-    break;
-  case Step::Terminated:
-    break;
-  default:
-    debugnnl(F("Ungueltiger Step fuer Abmaischen: "));
-    debug(_proc_stat.current_step);
+    else if (!detect_boil())
+    {
+      return 0;
+    }
+    start_step_timer();
+    _proc_stat.hops_done = 0;
+    start_hop_timer();
+    step_transition(Step::Boiling);
+    return 0;
+  }
+  // after a restart the timer is set up again, from the saved boil start and additions
+  if (_hop_timer.count == HOP_TIMER_OFF)
+  {
+    start_hop_timer();
+  }
+  if (rec_now() >= _hop_timer.deadline)
+  {
+    fire_hop_additions();
+  }
+  if (is_step_timer_over(args[0] * 60UL))
+  {
+    // the heater stays off for the whirlpool
+    set_target_temp(-1);
+    return 2;
   }
+  return 0;
 }
 
-void BrewProcess::handle_rests()
+// ====================================================
+// hop timer
+// ====================================================
+/*
+ * sort the timed hop additions by their deadline, the earliest first, and set the deadline of
+ * the next one that has not been added yet
+ * deadlines count from the boil start (step_start), so they do not drift, also not across a restart
+ */
+void BrewProcess::start_hop_timer()
 {
-  /*
-   * Rast-Phase:
-   * - Wenn Temp_ist < Temp_soll[rast_num]: Step "Aufheizen"
-   * - Wenn Temp erreicht: Zähler starten, Step "Halten"
-   * - Wenn Rastdauer erreicht: nächste Rast oder Abmaischen
-   * - Fall Temp_ist deutlich höher als Temp_soll wird nicht gehandelt
-   */
-  switch(_proc_stat.current_step)
+  _hop_timer.count = 0;
+  for (byte i = 0; i < _receipe.num_hops_add; i++)
   {
-  case Step::Start:
-    _proc_stat.current_rest_duration = _receipe.rest_duration[_proc_stat.current_rest] * 60;
-    _proc_stat.phase_start = now();
-    step_transition(Step::Heat);
-    break;
-  case Step::Heat:
-    if(_temp_stat.current_temp >= _proc_stat.target_temp)
+    unsigned int t = _receipe.hops_boil_times[i];
+    if (t == HOP_ADD_FIRST_WORT || t == HOP_ADD_WHIRLPOOL)
     {
-      debug(F("Rasttemperatur erreicht"));
-      step_transition(Step::Hold);
-      // expectation is to see current rest duration in display
-      _proc_stat.phase_start = now();
-      start_rest_timer();
+      continue;
     }
-    break;
-  case Step::Hold:
-    if(is_rest_timer_over())
+    // insertion sort, longest boil time first, equal times keep their receipe order
+    byte k = _hop_timer.count++;
+    for (; k > 0 && _receipe.hops_boil_times[_hop_timer.order[k - 1]] < t; k--)
     {
-      debugnnl(F("Ende Rast "));
-      debug(_proc_stat.current_rest);
-      if(_proc_stat.current_rest + 1 < _receipe.num_rests)
-      {
-        // Last rest not reached, move to next rest
-        ++_proc_stat.current_rest;
-        step_transition(Step::Start);
-      }
-      else
-      {
-        // Last rest reached, move on to mash-out
-        phase_transition(Phase::MashOut);
-      }
+      _hop_timer.order[k] = _hop_timer.order[k - 1];
     }
-    break;
-  default:
-    debugnnl(F("Ungueltiger Step fuer Rasten: "));
-    debug(_proc_stat.current_step);
+    _hop_timer.order[k] = i;
+  }
+  set_hop_deadline();
+}
+
+void BrewProcess::set_hop_deadline()
+{
+  if (_proc_stat.hops_done >= _hop_timer.count)
+  {
+    _hop_timer.deadline = 0xFFFFFFFFUL;
+    return;
+  }
+  // more than the boil duration: right at the start
+  unsigned int boil = _receipe.wort_boil_duration;
+  unsigned int t = min(_receipe.hops_boil_times[_hop_timer.order[_proc_stat.hops_done]], boil);
+  _hop_timer.deadline = _proc_stat.step_start + (boil - t) * 60UL;
+}
+
+/*
+ * all additions that are due, with one prompt
+ */
+void BrewProcess::fire_hop_additions()
+{
+  while (_proc_stat.hops_done < _hop_timer.count && rec_now() >= _hop_timer.deadline)
+  {
+    byte i = _hop_timer.order[_proc_stat.hops_done];
+    log_info(LogHopAddition, i + 1, _receipe.hops_boil_times[i]);
+    _proc_stat.hops_done++;
+    set_hop_deadline();
   }
+  show_alarm(StrHopsAdd);
+  update_eeprom(true);
+}
+
+byte BrewProcess::op_branch_below(const byte* args)
+{
+  if (_channels[ChannelMash].current_temp < args[0])
+  {
+    return program_skip(_receipe.program, _proc_stat.pc + 3, args[1]) - _proc_stat.pc;
+  }
+  return 3;
 }
 
-void BrewProcess::handle_mash_in()
+byte BrewProcess::op_cool(const byte* args)
 {
-  /*
-   * Mash-In Phase:
-   * - if current_temp < target_temp: step "Heat"
-   * - if target_temp reached: "User Prompt"
-   */
-  switch(_proc_stat.current_step)
+  if (_proc_stat.current_step == Step::Start)
+  {
+    set_target_temp(args[0]);
+    _proc_stat.phase_start = rec_now();
+    start_step_timer();
+    _cool_fit = cool_fit_t();
+    step_transition(Step::Cooling);
+  }
+  // after a restart the fit starts over, from the saved start of the cooling
+  update_cool_fit();
+  if (_channels[ChannelMash].current_temp <= _proc_stat.target_temp)
+  {
+    log_info(LogCooled, (long)(_proc_stat.target_temp * 100), (rec_now() - _proc_stat.step_start) / 60);
+    set_target_temp(-1);
+    return 2;
+  }
+  return 0;
+}
+
+// ====================================================
+// cooling
+// ====================================================
+/*
+ * add a sample to the fit of ln(temp - coolant_temp) over the time since the start of the
+ * cooling, every COOL_FIT_INTERVAL_MS
+ */
+void BrewProcess::update_cool_fit()
+{
+  cool_fit_t* f = &_cool_fit;
+  float delta = _channels[ChannelMash].current_temp - _config.coolant_temp;
+  if ((f->n > 0 && rec_millis() - f->last_sample < COOL_FIT_INTERVAL_MS) || delta <= 0)
+  {
+    return;
+  }
+  f->last_sample = rec_millis();
+  float t = rec_now() - _proc_stat.step_start;
+  float y = log(delta);
+  f->n++;
+  float dt = t - f->t_mean;
+  f->t_mean += dt / f->n;
+  f->y_mean += (y - f->y_mean) / f->n;
+  f->stt += dt * (t - f->t_mean);
+  f->sty += dt * (y - f->y_mean);
+}
+
+/*
+ * seconds until the wort is down to the target temp as predicted by the fit, 0 while there
+ * are less than COOL_FIT_MIN_SAMPLES samples or it does not cool down towards the target
+ */
+unsigned long BrewProcess::cool_rest()
+{
+  cool_fit_t* f = &_cool_fit;
+  float delta = _proc_stat.target_temp - _config.coolant_temp;
+  if (f->n < COOL_FIT_MIN_SAMPLES || f->stt <= 0 || delta <= 0)
+  {
+    return 0;
+  }
+  float k = -f->sty / f->stt; // 1/s
+  if (k <= 0)
+  {
+    return 0;
+  }
+  float t = f->t_mean + (f->y_mean - log(delta)) / k;
+  unsigned long elapsed = rec_now() - _proc_stat.step_start;
+  return t > elapsed ? (unsigned long)t - elapsed : 0;
+}
+
+void BrewProcess::set_target_temp(float temp)
+{
+  if (_proc_stat.target_temp != temp)
+  {
+    _proc_stat.target_temp = temp;
+    _changes |= ChangedPhase;
+  }
+}
+
+byte BrewProcess::programStart()
+{
+  if (_proc_stat.pc >= _receipe.boil_pc)
+  {
+    return _receipe.boil_pc;
+  }
+  return _proc_stat.pc >= _receipe.sparge_pc ? _receipe.sparge_pc : 0;
+}
+
+unsigned long BrewProcess::phaseRest()
+{
+  if (!_proc_stat.running || _proc_stat.current_step == Step::Start)
+  {
+    return 0;
+  }
+  const byte* op = &_receipe.program[_proc_stat.pc];
+  // the boil timer only runs once it boils
+  if (*op == OpBoil && _proc_stat.current_step != Step::Boiling)
+  {
+    return 0;
+  }
+  if (*op == OpCool)
+  {
+    return cool_rest();
+  }
+  unsigned long duration = program_op_seconds(op);
+  unsigned long d = rec_now() - _proc_stat.step_start;
+  return d < duration ? duration - d : 0;
+}
+
+/*
+ * sparge vessel: heat up to the sparge temperature, then hold it until the vessel is stopped
+ */
+void BrewProcess::handle_sparge_vessel()
+{
+  switch(_proc_stat.sparge.step)
   {
   case Step::Start:
-    // nothing to initialize, go to Step::Heat immediatly
-    step_transition(Step::Heat);
+    _proc_stat.sparge.step = Step::Heat;
+    _changes |= ChangedPhase;
+    update_eeprom(true);
     break;
   case Step::Heat:
-    // check if target temp reached, then move on to UserPrompt
-    if(_temp_stat.current_temp >= _proc_stat.target_temp)
+    if(_channels[ChannelSparge].current_temp >= _receipe.second_wash_temp)
     {
-      // reached target temp
-      debug(F("Einmaischtemperatur erreicht"));
-      step_transition(Step::UserPrompt);
+      log_info(LogSpargeTempReached);
+      _proc_stat.sparge.step = Step::Hold;
+      _changes |= ChangedPhase;
+      update_eeprom(true);
     }
     break;
-  case Step::UserPrompt:
-    // wait for confirmation, then transition to Phase::Rest
-    if(_transient_proc_stat.user_confirmed)
-    {
-      debug(F("User hat bestaetigt"));
-      phase_transition(Phase::Rest);
-      _proc_stat.current_rest = 0;
-    }
+  case Step::Hold:
     break;
   default:
-    debugnnl(F("Ungueltiger Step "));
-    debug(_proc_stat.current_step);
+    log_error(LogInvalidStep, _proc_stat.sparge.step, Phase::SecondWash);
   }
 }
 
 void BrewProcess::phase_transition(Phase next_phase)
 {
   _proc_stat.current_phase = next_phase;
-  _proc_stat.phase_start = now();
+  _proc_stat.phase_start = rec_now();
   _proc_stat.current_step = Step::Start;
-  _proc_stat.need_confirmation = false;
-  _transient_proc_stat.user_confirmed = false;
-  // no need to call update_eeprom() here because every phase transition also comes with
+  _changes |= ChangedPhase;
+  // no need to call update_eeprom() here because every phase is followed by a step with
   // a step transition which then calls update_eeprom();
 }
 
 void BrewProcess::step_transition(Step next_step)
 {
   _proc_stat.current_step = next_step;
+  _changes |= ChangedPhase | ChangedPrompt;
   if(next_step == Step::UserPrompt)
   {
     _proc_stat.need_confirmation = true;
@@ -554,75 +1203,165 @@ void BrewProcess::step_transition(Step next_step)
   else if(next_step == Step::Terminated)
   {
     _proc_stat.running = false;
+    _proc_stat.need_confirmation = false;
     _proc_stat.phase_char = '-';
   }
-  else
+  rec_step((byte)_proc_stat.current_phase, (byte)next_step, _proc_stat.pc);
+  update_eeprom(true);
+}
+
+/*
+ * target temp of the step that comes after the current one, -1 if there is none
+ */
+float BrewProcess::next_target_temp()
+{
+  return program_next_temp(_receipe.program, _proc_stat.pc);
+}
+
+/*
+ * target temp for the mash heater, with look-ahead preheating
+ * while holding a rest, heating towards the next rest starts as late as possible to arrive at its
+ * end: the target ramps up with the measured heating rate. While waiting for a prompt (dough-in),
+ * the end is unknown, so the next rest is the target right away.
+ * Never more than lookahead_max above the current target, and never below it.
+ */
+float BrewProcess::control_target_temp()
+{
+  float target = _proc_stat.target_temp;
+  float next = next_target_temp();
+  float control = target;
+  if (_config.lookahead && _heat_rate.rate > 0 && next > target)
   {
-    _proc_stat.need_confirmation = false;
-    _transient_proc_stat.user_confirmed = false;    
+    if (_proc_stat.current_step == Step::Hold)
+    {
+      control = next - _heat_rate.rate * phaseRest();
+    }
+    else if (_proc_stat.current_step == Step::UserPrompt)
+    {
+      control = next;
+    }
+    control = constrain(control, target, target + _config.lookahead_max);
   }
-  update_eeprom(true);
+
+  bool preheating = control > target;
+  if (preheating && !_heat_rate.preheating)
+  {
+    log_info(LogPreheat, (long)(next * 100));
+  }
+  _heat_rate.preheating = preheating;
+  return control;
 }
 
-void BrewProcess::update_target_temp()
+/*
+ * measure the heating rate over windows in which the mash heater is on all the time
+ */
+void BrewProcess::update_heat_rate()
 {
-  switch(_proc_stat.current_phase)
+  heater_stat_t* h = &_channels[ChannelMash].heater;
+  float temp = _channels[ChannelMash].current_temp;
+  if (!h->on)
   {
-  case Phase::MashIn:
-    _proc_stat.target_temp = _receipe.mash_in_temp;
-    break;
-  case Phase::Rest:
-    _proc_stat.target_temp = _receipe.rest_temp[_proc_stat.current_rest];
-    break;
-  case Phase::MashOut:
-    _proc_stat.target_temp = -1;
-    break;
-  case Phase::SecondWash:
-    _proc_stat.target_temp = _receipe.second_wash_temp;
-    break;
-  case Phase::Boil:
-    _proc_stat.target_temp = _config.heater_cook_temp;
-    break;
-  default:
-    _proc_stat.target_temp = -1;
+    _heat_rate.window_start = 0;
+    return;
+  }
+  if (_heat_rate.window_start == 0 || (long)(h->last_on - _heat_rate.window_start) > 0)
+  {
+    // heater (re-)started after the window began: new window
+    _heat_rate.window_start = rec_millis();
+    _heat_rate.window_temp = temp;
+    return;
+  }
+  unsigned long elapsed = rec_millis() - _heat_rate.window_start;
+  if (elapsed < HEAT_RATE_WINDOW_MS)
+  {
+    return;
+  }
+  float sample = (temp - _heat_rate.window_temp) * 1000.0F / elapsed;
+  if (sample > 0)
+  {
+    if (_heat_rate.rate > 0)
+    {
+      _heat_rate.rate += (sample - _heat_rate.rate) / HEAT_RATE_SMOOTHING;
+    }
+    else
+    {
+      _heat_rate.rate = sample;
+    }
+    log_debug(LogHeatRate, (long)(_heat_rate.rate * 60000.0F));
   }
-} 
+  _heat_rate.window_start = rec_millis();
+  _heat_rate.window_temp = temp;
+}
 
-void BrewProcess::update_display_name()
+/*
+ * boil onset from the plateau of the temperature, at any elevation: least squares slope over the
+ * last BOIL_DETECT_SAMPLES samples, taken while the heater is on, and its standard error from the
+ * scatter around the line. The boil has started when the slope stays below boil_slope with
+ * boil_confidence standard errors added. The mean of the window is stored as the calibrated
+ * boiling point.
+ */
+bool BrewProcess::detect_boil()
 {
-  switch(_proc_stat.current_phase)
+  boil_detect_t* d = &_boil_detect;
+  if (!_channels[ChannelMash].heater.on)
   {
-  case Phase::MashIn:
-    strcpy_P(_transient_proc_stat.display_name, PSTR("Einmaischen"));
-    break;
-  case Phase::Rest:
-    sprintf_P(_transient_proc_stat.display_name, PSTR("Rast #%d"), _proc_stat.current_rest + 1);
-    break;
-  case Phase::MashOut:
-    strcpy_P(_transient_proc_stat.display_name, PSTR("Abmaischen"));
-    break;
-  case Phase::Boil:
-    strcpy_P(_transient_proc_stat.display_name, PSTR("Kochen"));
-    break;
-  case Phase::SecondWash:
-    strcpy_P(_transient_proc_stat.display_name, PSTR("Nachguss"));
-    break;
-  default:
-   strcpy_P(_transient_proc_stat.display_name, PSTR("undef"));
-   break;
+    d->count = 0;
+    return false;
   }
-  
-  switch(_proc_stat.current_step)
+  if (d->count > 0 && rec_millis() - d->last_sample < BOIL_DETECT_INTERVAL_MS)
   {
-  case Step::Heat:
-    strcat_P(_transient_proc_stat.display_name, PSTR("/Heizen"));
-    break;
-  case Step::Hold:
-    strcat_P(_transient_proc_stat.display_name, PSTR("/Halten"));
-    break;
-  default:
-    break;
+    return false;
+  }
+  d->last_sample = rec_millis();
+  d->temps[d->pos] = _channels[ChannelMash].current_temp * 100;
+  d->pos = (d->pos + 1) % BOIL_DETECT_SAMPLES;
+  if (d->count < BOIL_DETECT_SAMPLES)
+  {
+    d->count++;
+    return false;
   }
+
+  // x: sample number from the oldest one, centered
+  const float x_mean = (BOIL_DETECT_SAMPLES - 1) / 2.0F;
+  float y_mean = 0;
+  for (byte i = 0; i < BOIL_DETECT_SAMPLES; i++)
+  {
+    y_mean += d->temps[i];
+  }
+  y_mean /= BOIL_DETECT_SAMPLES;
+  float sxx = 0;
+  float sxy = 0;
+  for (byte i = 0; i < BOIL_DETECT_SAMPLES; i++)
+  {
+    float x = i - x_mean;
+    sxx += x * x;
+    sxy += x * (d->temps[(d->pos + i) % BOIL_DETECT_SAMPLES] - y_mean);
+  }
+  float slope = sxy / sxx;
+  float sse = 0;
+  for (byte i = 0; i < BOIL_DETECT_SAMPLES; i++)
+  {
+    float r = d->temps[(d->pos + i) % BOIL_DETECT_SAMPLES] - y_mean - slope * (i - x_mean);
+    sse += r * r;
+  }
+  float se = sqrt(sse / (BOIL_DETECT_SAMPLES - 2) / sxx);
+
+  // from 1/100 K per sample to K per minute
+  const float scale = 60000.0F / BOIL_DETECT_INTERVAL_MS / 100;
+  if (y_mean / 100 < _config.boil_min_temp ||
+      (fabs(slope) + _config.boil_confidence * se) * scale >= _config.boil_slope)
+  {
+    return false;
+  }
+  log_info(LogBoilDetected, (long)y_mean, (long)(slope * scale * 1000));
+  _config.boil_point = y_mean / 100;
+  save_boil_point();
+  return true;
+}
+
+void BrewProcess::save_boil_point()
+{
+  write_eeprom((byte*)(void*)&_config.boil_point, sizeof(_config.boil_point), EEPROM_BOIL_POINT_OFFSET);
 }
 
 // ====================================================
@@ -640,85 +1379,167 @@ void BrewProcess::update_display_name()
  * if STEP_HOLD
  *   if temp_diff < 0.5K: heater off
  *   if temp_diff > 1K: heater throttled on
+ * if STEP_BOILING
+ *   heater on
  */
-void BrewProcess::update_heater()
+void BrewProcess::update_heater(byte ch, Step step, float target_temp)
 {
-  float temp_diff = _proc_stat.target_temp - _temp_stat.current_temp;
-  switch(_proc_stat.current_step)
+  PERF_SCOPE(PerfHeater);
+
+  float temp_diff = target_temp - _channels[ch].current_temp;
+  switch(step)
   {
   case Step::Heat:
+    // heating for the boil: full power, the boil is detected by op_boil()
+    if (ch == ChannelMash && _proc_stat.current_phase == Phase::Boil)
+    {
+      turn_on_heater(ch);
+    }
     // still away from target -> heater on
-    if(temp_diff >= _config.heater_throttle_diff)
+    else if(temp_diff >= _config.heater_throttle_diff)
     {
-      turn_on_heater();
+      turn_on_heater(ch);
     }
     // approaching in throttled mode
     else if (temp_diff < _config.heater_throttle_diff && temp_diff > _config.heater_off_diff)
     {
-      turn_on_heater_throttled();
+      turn_on_heater_throttled(ch);
     }
     // close enough or above --> heater off
     else
     {
-      turn_off_heater();
+      turn_off_heater(ch);
     }
     break;
   case Step::Hold:
   case Step::UserPrompt:
     if(temp_diff > _config.heater_hysteresis)
     {
-      turn_on_heater_throttled();
+      turn_on_heater_throttled(ch);
     }
     else if (temp_diff <= _config.heater_off_diff)
     {
-      turn_off_heater();
+      turn_off_heater(ch);
     }
     break;
+  case Step::Boiling:
+    turn_on_heater(ch);
+    break;
+  case Step::Ramp:
+    turn_on_heater_ramp(ch, temp_diff);
+    break;
   default:
-    _heater_stat.on = false;
-    turn_off_heater();
+    turn_off_heater(ch);
+  }
+}
+
+/*
+ * time proportioning over RAMP_DUTY_WINDOW_MS: the heater is on for a share of each window,
+ * the feed-forward duty of the ramp plus ramp_gain per K below the moving target
+ */
+void BrewProcess::turn_on_heater_ramp(byte ch, float temp_diff)
+{
+  float duty = constrain(_ramp.feed_forward + _config.ramp_gain * temp_diff, 0.0F, 1.0F);
+  if (rec_millis() - _ramp.window_start >= RAMP_DUTY_WINDOW_MS)
+  {
+    _ramp.window_start = rec_millis();
+  }
+  if (rec_millis() - _ramp.window_start < duty * RAMP_DUTY_WINDOW_MS)
+  {
+    turn_on_heater(ch);
+  }
+  else
+  {
+    turn_off_heater(ch);
   }
 }
 
-void BrewProcess::turn_on_heater_throttled()
+void BrewProcess::turn_on_heater_throttled(byte ch)
 {
-  if(_heater_stat.on && millis() - _heater_stat.last_on > _config.throttled_on_ms)
+  heater_stat_t* h = &_channels[ch].heater;
+  if(h->on && rec_millis() - h->last_on > _config.throttled_on_ms)
   {
-    turn_off_heater();
+    turn_off_heater(ch);
   }
-  if(!_heater_stat.on && millis() - _heater_stat.last_off > _config.throttled_off_ms)
+  if(!h->on && rec_millis() - h->last_off > _config.throttled_off_ms)
   {
-    turn_on_heater();
+    turn_on_heater(ch);
   }
 }
 
-void BrewProcess::turn_off_heater()
+void BrewProcess::turn_off_heater(byte ch)
 {
-  if (_heater_stat.on)
+  heater_stat_t* h = &_channels[ch].heater;
+  if (h->on)
   {
-    _heater_stat.on = false;
-    _heater_stat.last_off = millis();
-    _rf_sender->sendUnit(RC_OUTLET_HEATER, false);
+    h->on = false;
+    h->last_off = rec_millis();
+    _changes |= ChangedHeater;
+    rec_heater(_channels[ch].outlet, false);
+    _rf_sender->sendUnit(_channels[ch].outlet, false);
   }
 }
 
-void BrewProcess::turn_on_heater()
+void BrewProcess::turn_off_heaters()
 {
-  if (!_heater_stat.on)
+  for (byte ch = 0; ch < NUM_CHANNELS; ch++)
   {
-    _heater_stat.on = true;
-    _heater_stat.last_on = millis();
-    _rf_sender->sendUnit(RC_OUTLET_HEATER, true);
+    turn_off_heater(ch);
   }
 }
 
+void BrewProcess::turn_on_heater(byte ch)
+{
+  heater_stat_t* h = &_channels[ch].heater;
+  if (h->on)
+  {
+    return;
+  }
+
+  // the heaters share one circuit: take the power from channels with lower priority,
+  // or stay off until a channel with higher priority releases it
+  byte heaters_on = 0;
+  for (byte c = 0; c < NUM_CHANNELS; c++)
+  {
+    if (_channels[c].heater.on) heaters_on++;
+  }
+  for (byte c = NUM_CHANNELS - 1; c > ch && heaters_on >= RC_MAX_HEATERS_ON; c--)
+  {
+    if (_channels[c].heater.on)
+    {
+      turn_off_heater(c);
+      heaters_on--;
+    }
+  }
+  if (heaters_on >= RC_MAX_HEATERS_ON)
+  {
+    return;
+  }
+
+  h->on = true;
+  h->last_on = rec_millis();
+  _changes |= ChangedHeater;
+  rec_heater(_channels[ch].outlet, true);
+  _rf_sender->sendUnit(_channels[ch].outlet, true);
+}
+
 // ====================================================
 // temperature sensor management
 // ====================================================
 void BrewProcess::read_temp_sensor ()
 {
+  PERF_SCOPE(PerfReadTemp);
+
 #ifdef MOCK_TEMP_SENSOR
-  _temp_stat.current_temp = 42.0F;
+  for (byte ch = 0; ch < NUM_CHANNELS; ch++)
+  {
+    if (_channels[ch].current_temp != 42.0F || !_channels[ch].temp_valid)
+    {
+      _channels[ch].current_temp = 42.0F;
+      _channels[ch].temp_valid = true;
+      _changes |= ChangedTemp;
+    }
+  }
   return;
 #endif
   if(_temp_stat.error_count > 3 && _temp_stat.error_count < 5)
@@ -727,44 +1548,65 @@ void BrewProcess::read_temp_sensor ()
   }
   else if (_temp_stat.error_count >= 5)
   {
-    setError(PSTR("Temp Sensor Error"));
+    setError(ErrTempSensor);
   }
-  if (millis() - _temp_stat.last_read_ms > _config.temp_read_interval)
+  if (rec_millis() - _temp_stat.last_read_ms > _config.temp_read_interval)
   {
     if (_temp_stat.currently_reading)
     {
       // we are in a conversion cycle
-      if (millis() - _temp_stat.last_conversion_trigger > TEMP_SENSOR_CONVERSION_TIME)
+      if (rec_millis() - _temp_stat.last_conversion_trigger > TEMP_SENSOR_CONVERSION_TIME)
       {
-        // we're done
-        DeviceAddress tempDeviceAddress;
-        if(_temp_stat.temp_sensor->getAddress(tempDeviceAddress, 0))
+        // we're done, one conversion covers all sensors on the bus
+        bool ok = true;
+        for (byte ch = 0; ch < NUM_CHANNELS; ch++)
         {
-          float t = _temp_stat.temp_sensor->getTempC(tempDeviceAddress);
-          if(t == 85.0F || t == -127.0F)
+          // the sparge sensor is only required while the sparge vessel is in use
+          if (ch == ChannelSparge && !_proc_stat.sparge.running)
+          {
+            continue;
+          }
+          // NaN if the sensor was not found
+          DeviceAddress tempDeviceAddress;
+          float t = NAN;
+          if(_temp_stat.temp_sensor->getAddress(tempDeviceAddress, _channels[ch].sensor))
           {
-            debug(F("Got bogus reading"));
-            _temp_stat.error_count++;
+            t = _temp_stat.temp_sensor->getTempC(tempDeviceAddress);
           }
-          else
+          t = rec_temp(ch, t);
+          if (isnan(t))
           {
-            _temp_stat.current_temp = t;
-            _temp_stat.error_count = 0;
+            ok = false;
+          }
+          else if(t == 85.0F || t == -127.0F)
+          {
+            log_warn(LogBogusReading, (long)(t * 100));
+            ok = false;
+          }
+          else if (t != _channels[ch].current_temp || !_channels[ch].temp_valid)
+          {
+            _channels[ch].current_temp = t;
+            _channels[ch].temp_valid = true;
+            _changes |= ChangedTemp;
           }
         }
+        if (ok)
+        {
+          _temp_stat.error_count = 0;
+        }
         else
         {
           _temp_stat.error_count++;
         }
         _temp_stat.currently_reading = false;
-        _temp_stat.last_read_ms = millis();
+        _temp_stat.last_read_ms = rec_millis();
       }
     }
     else
     {
       _temp_stat.temp_sensor->requestTemperatures();
       _temp_stat.currently_reading = true;
-      _temp_stat.last_conversion_trigger = millis();
+      _temp_stat.last_conversion_trigger = rec_millis();
     }    
   }
 }
@@ -774,29 +1616,32 @@ void BrewProcess::setup_temp_sensor()
   _temp_stat.temp_sensor->setWaitForConversion(false);
   _temp_stat.temp_sensor->begin();
 
-  DeviceAddress tempDeviceAddress;
-  if(_temp_stat.temp_sensor->getAddress(tempDeviceAddress, 0))
+  for (byte ch = 0; ch < NUM_CHANNELS; ch++)
   {
-    _temp_stat.temp_sensor->setResolution(tempDeviceAddress, 11);
-  }
-  else
-  {
-    debug(F("No temperature sensor found"));
+    DeviceAddress tempDeviceAddress;
+    if(_temp_stat.temp_sensor->getAddress(tempDeviceAddress, _channels[ch].sensor))
+    {
+      _temp_stat.temp_sensor->setResolution(tempDeviceAddress, 11);
+    }
+    else if (ch == ChannelMash)
+    {
+      log_error(LogNoTempSensor);
+    }
   }
 }
 
 // ====================================================
-// timer for timing mashing rests
+// timer for timing rests, ramps and the boil
 // ====================================================
 
-void BrewProcess::start_rest_timer()
+void BrewProcess::start_step_timer()
 {
-  _proc_stat.rest_start = now();
+  _proc_stat.step_start = rec_now();
 }
 
-bool BrewProcess::is_rest_timer_over()
+bool BrewProcess::is_step_timer_over(unsigned long duration)
 {
-  return now() - _proc_stat.rest_start > _proc_stat.current_rest_duration;
+  return rec_now() - _proc_stat.step_start > duration;
 }
 
 // ====================================================
@@ -812,14 +1657,14 @@ void BrewProcess::recover_eeprom_state()
   
   if (mgx == _proc_stat.VERSION)
   {
-    debug(F("Reading EEPROM"));
+    log_info(LogEepromRead);
     p = (byte*)(void*)&_proc_stat;
     read_eeprom(p, sizeof(_proc_stat), EEPROM_PROC_STAT_OFFSET);
-    if(_proc_stat.running) // load previous receipe only if process was interrupted
+    if(isRunning()) // load previous receipe only if process was interrupted
     {
       p = (byte*)(void*)&_receipe;
       read_eeprom(p, sizeof(_receipe), EEPROM_RECEIPE_OFFSET);
-      setTime(_proc_stat.eeprom_saved_timestamp);
+      rec_set_time(_proc_stat.eeprom_saved_timestamp);
       update_process();
     }
 
@@ -829,11 +1674,15 @@ void BrewProcess::recover_eeprom_state()
 
 void BrewProcess::update_eeprom(bool force)
 {
-  if(now() - _proc_stat.eeprom_saved_timestamp > EEPROM_UPDATE_INTERVAL || force)
+  static_assert(EEPROM_PROC_STAT_OFFSET + sizeof(proc_status_t) <= EEPROM_RECEIPE_OFFSET, "proc_status_t overlaps the receipe in the EEPROM");
+  static_assert(EEPROM_RECEIPE_OFFSET + sizeof(receipe_t) <= E2END + 1, "receipe_t does not fit into the EEPROM");
+  PERF_SCOPE(PerfEeprom);
+
+  if(rec_now() - _proc_stat.eeprom_saved_timestamp > EEPROM_UPDATE_INTERVAL || force)
   {
-    debug(F("Updating EEPROM"));
+    log_debug(LogEepromUpdate);
     debug_state();
-    _proc_stat.eeprom_saved_timestamp = now();
+    _proc_stat.eeprom_saved_timestamp = rec_now();
 
     write_eeprom((byte *)(void *)&_proc_stat, sizeof(_proc_stat), EEPROM_PROC_STAT_OFFSET);
     write_eeprom((byte *)(void *)&_receipe, sizeof(_receipe), EEPROM_RECEIPE_OFFSET);
@@ -849,6 +1698,7 @@ void BrewProcess::read_eeprom(byte* data, int size, int offset)
     *p = EEPROM.read(offset + i);
     p++;
   }
+  rec_eeprom(offset, data, size);
 }
 
 void BrewProcess::write_eeprom(byte* data, int size, int offset)
@@ -857,53 +1707,26 @@ void BrewProcess::write_eeprom(byte* data, int size, int offset)
   int i = 0;
   byte* p = data;
   byte b;
-  int unchanged = 0;
   int changed = 0;
   for(; i < size; i++)
   {
-    if ((b = EEPROM.read(offset + i)) == *p)
-    {
-      unchanged++;
-    }
-    else
+    if ((b = EEPROM.read(offset + i)) != *p)
     {
       changed++;
       EEPROM.write(offset + i, *p);
       if ((b = EEPROM.read(offset + i)) != *p)
       {
-        char buffer[20];
-        sprintf_P(buffer, PSTR("ERR: Exp %02x Was %02x"), *p, b);
-        debug(buffer);
+        log_error(LogEepromVerify, offset + i, *p, b);
       }
     }
     p++;
   }
-  debugnnl(F("Wrote ")); debugnnl(i); debugnnl(F(" bytes in ")); debugnnl(millis() - start); debugnnl(F(" ms, "));
-  debugnnl(unchanged); debugnnl(F(" unchanged and ")); debugnnl(changed); debug(F(" changed"));
+  log_debug(LogEepromWrite, i, millis() - start, changed);
 }
 
 void BrewProcess::debug_state()
 {
-  /*
-  debugnnl(F("  running ")); debug(_proc_stat.running);
-  debugnnl(F("  phase_char ")); debug(_proc_stat.phase_char);
-
-  debugnnl(F("  process_start ")); debug(_proc_stat.process_start);
-  debugnnl(F("  phase_start ")); debug(_proc_stat.phase_start);
-  debugnnl(F("  rest_start ")); debug(_proc_stat.rest_start);
-
-  debugnnl(F("  current_phase ")); debug(_proc_stat.current_phase);
-  debugnnl(F("  current_step ")); debug(_proc_stat.current_step);
-  debugnnl(F("  current_rest ")); debug(_proc_stat.current_rest);
-  debugnnl(F("  current_rest_duration ")); debug(_proc_stat.current_rest_duration);
-
-  debugnnl(F("  need_confirmation ")); debug(_proc_stat.need_confirmation);
-
-  debugnnl(F("  target_temp ")); debug(_proc_stat.target_temp);
-
-  debugnnl(F("  eeprom_saved_timestamp ")); debug(_proc_stat.eeprom_saved_timestamp);
-
-  debugnnl(F("  VERSION ")); debug(_proc_stat.VERSION);
-  */
+  log_debug(LogStatePhase, _proc_stat.current_phase, _proc_stat.current_step, _proc_stat.current_rest);
+  log_debug(LogStateTimes, _proc_stat.process_start, _proc_stat.phase_start, _proc_stat.step_start);
+  log_debug(LogStateTarget, (long)(_proc_stat.target_temp * 100), _proc_stat.need_confirmation, _proc_stat.running);
 }
-
@@ -17,17 +17,15 @@
 #include <Time.h>
 #include <PetitFS.h>
 
-#define __DEBUG
-#include "debug.h"
-
 #include "brauwerkstatt.h"
+#include "program.h"
+#include "uistrings.h"
 
 // ==============================================
 // Central data structures
 // - receipe
 // - proc_status
 // ==============================================
-#define MAX_RESTS 5
 #define MAX_HOP_ADDITIONS 6
 #define HOP_ADD_FIRST_WORT 10000 // MAGIC value for first-wort hopping
 #define HOP_ADD_WHIRLPOOL 10001 // MAGIC value for whirlpool hopping
@@ -35,59 +33,139 @@
 class BrewProcess {
 public:
 
+  // bits returned by fetchChanges(), tell the UI which parts of the state have changed
+  enum Change {
+    ChangedTemp = 0x01,
+    ChangedPhase = 0x02, // phase, step, rest number or target temp
+    ChangedHeater = 0x04,
+    ChangedPrompt = 0x08,
+    ChangedError = 0x10,
+    ChangedAll = 0x1F
+  };
+
+  enum Phase { MashIn, Rest, MashOut, SecondWash, Boil, Cool };
+  // Start: a step of the program has just been entered, see update_program()
+  enum Step { Start, Heat, Hold, UserPrompt, Terminated, Boiling, Cooling, Ramp };
+
+  // control channels, each with its own temperature sensor and heater outlet
+  // the mash channel runs the phases above, the sparge channel (SPARGE_VESSEL) heats the
+  // sparge water and holds its temperature, independently of the mash
+  // a lower number has priority when the heaters compete for power, see RC_MAX_HEATERS_ON
+  enum Channel { ChannelMash, ChannelSparge };
+
+  // error and warning codes, reported along with the message text
+  enum MessageCode { NoMessage, ErrSdCard, ErrReceipeMissing, ErrReceipeParse, ErrLineTooLong, ErrTempSensor, WarnNoReceipe };
+
   BrewProcess(DallasTemperature* temp_sens, NewRemoteTransmitter* rf_sender);
 
   void init();
 
   void load_receipe();
 
-  void start_mash_process();
-  void start_second_wash_process();
-  void start_boil_process();
-  void stop_process();
+  /*
+   * receipe upload line by line, in the format of REZEPT.TXT
+   * begin_receipe() clears the current receipe, it is refused while a process is running
+   * end_receipe() marks the receipe as loaded
+   */
+  bool begin_receipe();
+  bool add_receipe_line(char* line) { return parse_receipe_line(line); };
+  void end_receipe();
+
+  /*
+   * config_t values by name, for the serial command interface and the settings screen
+   * returns -1 for unknown names
+   */
+  int8_t findConfig(const char* name);
+  byte numConfig();
+  const char* configName(byte idx); // PROGMEM string
+  byte configDecimals(byte idx); // number of decimals to print
+  float configMax(byte idx); // values range from 0 to this
+  unsigned int configStep(byte idx); // change per detent on the settings screen, in units of 10^-decimals
+  float getConfig(byte idx);
+  bool setConfig(byte idx, float value); // false if out of range
+
+  /*
+   * return false if the process was not started
+   * with SPARGE_VESSEL, the sparge water is heated in its own vessel, also while mashing
+   */
+  bool start_mash_process();
+  bool start_second_wash_process();
+  bool start_boil_process();
+  void stop_process(); // stops all channels
+  void stop_sparge(); // stops the sparge vessel only
+
+  /*
+   * run all of the update steps below in order
+   */
   void update_process();
 
-  bool isRunning() { return _proc_stat.running; };
+  /*
+   * the update steps, run as separate scheduler tasks
+   * - sensor: temperature reading, also while no process is running
+   * - control: target temperature, state machine and heater
+   * - persistence: periodic EEPROM checkpoint
+   */
+  void update_sensor();
+  void update_control();
+  void update_persistence();
+
+  bool isRunning() { return _proc_stat.running || _proc_stat.sparge.running; };
+  bool isMashRunning() { return _proc_stat.running; };
   char getPhaseChar() { return _proc_stat.phase_char; };
+  Phase getPhase() { return _proc_stat.current_phase; };
+  Step getStep() { return _proc_stat.current_step; };
+  byte getCurrentRest() { return _proc_stat.current_rest; };
   bool needConfirmation() { return _proc_stat.need_confirmation; };
   void confirm() { _transient_proc_stat.user_confirmed = true; };
-  float getCurrentTemp() { return _temp_stat.current_temp; };
+  float getCurrentTemp(byte ch = ChannelMash) { return _channels[ch].current_temp; };
   float getTargetTemp() { return _proc_stat.target_temp; };
-  char* getDisplayName() { return _transient_proc_stat.display_name; };
-  const char* getPrompt() { return _transient_proc_stat.user_prompt; };
+  byte getPrompt() { return _transient_proc_stat.user_prompt; }; // StringId
   unsigned long phaseStart() { return _proc_stat.phase_start; };
   unsigned long procStart() { return _proc_stat.process_start; };
-  unsigned long phaseRest()
-  {
-    if (_proc_stat.current_phase == Phase::Rest && _proc_stat.current_step == Step::Hold)
-    {
-      unsigned long d = now() - _proc_stat.rest_start;
-      if (d < _proc_stat.current_rest_duration)
-      {
-        return _proc_stat.current_rest_duration - d;
-      }
-      else
-      {
-        return 0;
-      }
-    }
-    else
-    {
-      return 0;
-    }
-  };
-  bool heaterOn() { return _heater_stat.on; };
+  // seconds left on the timer of the current step (rest, ramp, boil), or until the wort has cooled
+  // down as predicted, 0 while there is no prediction yet
+  unsigned long phaseRest();
+  bool heaterOn(byte ch = ChannelMash) { return _channels[ch].heater.on; };
+
+  // sparge vessel (SPARGE_VESSEL)
+  bool isSpargeRunning() { return _proc_stat.sparge.running; };
+  Step getSpargeStep() { return _proc_stat.sparge.step; };
+  float getSpargeTarget() { return _receipe.second_wash_temp; };
+  unsigned long spargeStart() { return _proc_stat.sparge.start; };
 
   bool hasError() { return _transient_proc_stat.has_error; };
   bool hasWarning() { return _transient_proc_stat.has_warning; };
-  char* getMessage() { return _transient_proc_stat.message; };
-  void resetError() { _transient_proc_stat.has_error = false; };
-  void resetWarning() { _transient_proc_stat.has_warning = false; };
+  byte getMessageCode() { return _transient_proc_stat.message_code; };
+  void resetError() { _transient_proc_stat.has_error = false; _changes |= ChangedError; };
+  void resetWarning() { _transient_proc_stat.has_warning = false; _changes |= ChangedError; };
+
+  /*
+   * return the Change bits accumulated since the last call and reset them
+   */
+  byte fetchChanges() { byte c = _changes; _changes = 0; return c; };
+
+  // program, receipe and heating rate, for the planner
+  const byte* program() { return _receipe.program; };
+  byte programCounter() { return _proc_stat.pc; };
+  byte programStart(); // of the running process
+  unsigned int boilDuration() { return _receipe.wort_boil_duration; }; // minutes
+  byte numHopAdditions() { return _receipe.num_hops_add; };
+  unsigned int hopTime(byte i) { return _receipe.hops_boil_times[i]; }; // minutes before end of boil
+  byte hopsDone() { return _proc_stat.hops_done; }; // timed hop additions made in the current boil
+  byte pitchTemp() { return _receipe.pitch_temp; }; // 0: no cooling after the boil
+  // boiling point as calibrated by the boil detection, heater_cook_temp until then
+  float cookTemp() { return _config.boil_point > 0 ? _config.boil_point : _config.heater_cook_temp; };
+  // K per second, as measured, or heat_rate from the config until there is a measurement
+  float heatRate() { return _heat_rate.rate > 0 ? _heat_rate.rate : _config.heat_rate / 60.0F; };
 
 private:
-  enum Phase { MashIn, Rest, MashOut, SecondWash, Boil };
-  enum Step { Start, Heat, Hold, UserPrompt, Terminated};
-  enum ReceipeKey { Name, MashInTemp, Rests, RestTemp, RestDuration, SpargeTemp, BoilDuration, HopAdditions, HopBoilDuration };
+  enum ReceipeKey { Name, MashInTemp, Rests, RestTemp, RestDuration, SpargeTemp, BoilDuration, HopAdditions, HopBoilDuration,
+    StepHeat, StepHold, StepRamp, StepPrompt, StepAlarm, StepBranch, PitchTemp };
+
+  // handler of an opcode, returns the number of bytes the program counter moves on,
+  // 0 while the step has not finished
+  typedef byte (BrewProcess::*op_handler_t)(const byte* args);
+  static const op_handler_t OP_HANDLERS[];
 
   // ==========================================================
   // Heater status
@@ -112,22 +190,30 @@ private:
     unsigned long process_start;
     // start of current phase in seconds as returned by now()
     unsigned long phase_start;
-    // start of current rest in seconds, as returned by now()
-    // this value is only valid if current phase is Phase::Rest 
-    unsigned long rest_start;
+    // start of the timer of the current step (rest, ramp, boil) in seconds, as returned by now()
+    unsigned long step_start;
 
     Phase current_phase;
     Step current_step;
-    byte current_rest;
-    unsigned int current_rest_duration; // duration for rest phase in seconds
+    byte current_rest; // counts the heating steps since the start of the phase, 0-based
+    byte pc; // program counter, offset of the current step in receipe_t::program
+    byte hops_done; // timed hop additions made since the boil started
 
     bool need_confirmation = false; // for UI interaction: signal that user confirmation is required
 
     float target_temp; // target temperature for current phase
+    float ramp_from; // target temperature at the start of a ramp
 
     // this value is also re-used as current system time after restore
     unsigned long eeprom_saved_timestamp = 0;
 
+    // sparge vessel, runs independently of the phases above
+    struct {
+      bool running = false;
+      Step step = Step::Start;
+      unsigned long start; // in seconds, as returned by now()
+    } sparge;
+
     // defined in brauwerkstatt.h
     unsigned long VERSION = PROC_STAT_VERSION;
   };
@@ -139,17 +225,15 @@ private:
   // Errors and warnings are reset after restart.
   // ==========================================================
   struct transient_proc_stat_t {
-    char display_name[21];
-
     bool user_confirmed = false; // for UI interaction: user has confirmed a user prompt
     bool user_cancelled = false; // for UI interaction: user has cancelled brewing process
     
-    const char user_prompt[4] = "Ok?";
+    byte user_prompt = StrOk;
 
     // error handling
     bool has_error = false;
     bool has_warning = false;
-    char message[21];
+    byte message_code = NoMessage; // the text is StrMsgNone + message_code
   };
 
   // ==========================================================
@@ -159,14 +243,20 @@ private:
     bool loaded = false;
 
     char name[9];
-    byte mash_in_temp;
 
     byte second_wash_temp;
-  
-    byte num_rests; // number of rests
-    byte rest_temp[MAX_RESTS]; // rest temperature in C
-    byte rest_duration[MAX_RESTS]; // rest duration in min
-  
+    byte pitch_temp = 0; // the wort is cooled down to it after the boil, 0: no cooling
+
+    // the mash schedule, compiled while parsing, see program.h
+    // the steps of the receipe are appended in their order, rasten=N reserves the heat-up and
+    // hold steps of N rests at its place, rastN_t and rastN_d fill them in
+    byte program[PROGRAM_SIZE] = { OpPhase, MashIn, OpHeatTo, 0, OpPrompt, StrOk, OpPhase, Rest };
+    byte program_len = PROGRAM_HEADER;
+    byte sparge_pc = PROGRAM_SIZE; // start of the single vessel sparge program
+    byte boil_pc = PROGRAM_SIZE; // start of the boil program
+    byte num_rests = 0; // number of rests
+    byte rests_pc; // the first of them
+
     unsigned int wort_boil_duration; // in minutes
     byte num_hops_add; // number of hops additions
     unsigned int hops_boil_times[MAX_HOP_ADDITIONS]; // Kochzeiten für Hopfen, wobei HOPFENGABE_VWH (10000) und HOPFENGABE_WHIRLPOOL (10001) gesondert behandelt werden
@@ -176,46 +266,113 @@ private:
     float heater_hysteresis = 1.0F; // if in temp hold mode, switch on heater when 1.0K below target temp
     float heater_throttle_diff = 2.0F; // throttle heater when approaching target temp by this amount
     float heater_off_diff = 0.5F; // turn off heater when arriving within this range of target temp
-    float heater_cook_temp = 99.25F; // when reaching this temp, boiling timer is started
+    float heater_cook_temp = 99.25F; // when reaching this temp, boiling timer is started, if not detected before
     unsigned int throttled_on_ms = 15000; // amount of time heater is "on" when in throttle mode
     unsigned int throttled_off_ms = 15000; // amount of time heater is "off" when in throttle mode
     unsigned int temp_read_interval = 5000; // read temperature every x ms
+    // look-ahead preheating: start heating towards the next rest before the current one ends,
+    // so the kettle arrives at the end of the rest, also while waiting for the dough-in prompt
+    unsigned int lookahead = 0; // 1: on
+    float lookahead_max = 2.0F; // never more than this above the current target temp
+    float heat_rate = 1.0F; // K per minute, for the planner until the rate has been measured
+    // boil detection: the boil has started when the temperature stays above boil_min_temp and its
+    // slope, with boil_confidence standard errors added, is below boil_slope
+    float boil_slope = 0.15F; // K per minute
+    float boil_confidence = 2.0F; // standard errors, 0: the slope only
+    float boil_min_temp = 90.0F;
+    float boil_point = 0.0F; // calibrated boiling point, stored in EEPROM, 0: none
+    float coolant_temp = 12.0F; // of the cooling water, the wort cools down towards it
+    float ramp_gain = 1.0F; // heater duty per K below the moving target of a ramp, added to the feed-forward
+  };
+
+  // timed hop additions of the boil, in the order they are due
+  // set up again from the receipe after a restart, only hops_done is saved
+  static const byte HOP_TIMER_OFF = 0xFF;
+  struct hop_timer_t {
+    byte order[MAX_HOP_ADDITIONS]; // indices into receipe_t::hops_boil_times
+    byte count = HOP_TIMER_OFF; // number of timed additions
+    unsigned long deadline; // of the next addition, in seconds as returned by now()
+  };
+
+  // temperature samples while heating for the boil, see detect_boil()
+  struct boil_detect_t {
+    int temps[BOIL_DETECT_SAMPLES]; // 1/100 K, ring buffer
+    byte count = 0; // samples in the window
+    byte pos = 0; // of the next sample
+    unsigned long last_sample; // millis
+  };
+
+  // the moving part of a ramp step: heater duty and rate adherence
+  struct ramp_stat_t {
+    float feed_forward = 0; // heater duty the rate of the ramp takes, 0..1
+    float max_dev = 0; // largest deviation from the moving target in K
+    unsigned long window_start = 0; // millis, of the time proportioning window
+  };
+
+  // Newton's law of cooling, fitted while cooling: ln(temp - coolant_temp) = a - k * t
+  // least squares over all samples, updated with each one (Welford), see update_cool_fit()
+  struct cool_fit_t {
+    unsigned int n = 0; // samples
+    float t_mean = 0; // seconds since the start of the cooling
+    float y_mean = 0; // ln(temp - coolant_temp)
+    float stt = 0; // sum of the squared deviations of t
+    float sty = 0; // sum of the products of the deviations of t and y
+    unsigned long last_sample; // millis
   };
 
+  // measured heating rate of the mash vessel with the heater on full power
+  struct heat_rate_t {
+    float rate = 0.0F; // K per second, 0 until measured
+    float window_temp; // temperature at the start of the window
+    unsigned long window_start = 0; // millis, 0: no window
+    bool preheating = false;
+  };
+
+  // name, offset and range of the config_t members, see findConfig()
+  struct config_param_t;
+  static const config_param_t CONFIG_PARAMS[];
+
   struct temp_sensor_t {
     bool currently_reading;
     unsigned long last_read_ms = 0;
     unsigned long last_conversion_trigger = 0;
-    float current_temp; // Aktuelle Temperatur am Sensor
     DallasTemperature* temp_sensor;
     byte error_count = 0;
   };
 
-  struct heater_stat_t _heater_stat;
+  struct channel_t {
+    byte sensor; // index on the 1-Wire bus
+    byte outlet; // Remote Control Outlet ID
+    float current_temp = 0; // Aktuelle Temperatur am Sensor
+    bool temp_valid = false; // current_temp has been read, it is 0 until the first reading
+    heater_stat_t heater;
+  };
+
+#ifdef SPARGE_VESSEL
+  static const byte NUM_CHANNELS = 2;
+#else
+  static const byte NUM_CHANNELS = 1;
+#endif
+  struct channel_t _channels[NUM_CHANNELS];
   struct proc_status_t _proc_stat;
   struct transient_proc_stat_t _transient_proc_stat;
   struct temp_sensor_t _temp_stat;
   struct receipe_t _receipe;
   struct config_t _config;
+  struct heat_rate_t _heat_rate;
+  struct hop_timer_t _hop_timer;
+  struct boil_detect_t _boil_detect;
+  struct cool_fit_t _cool_fit;
+  struct ramp_stat_t _ramp;
 
   NewRemoteTransmitter* _rf_sender;
 
   FATFS _sd_fs;
+
+  byte _changes = ChangedAll;
   
-  void setWarning(const char* warnMsg) {
-    _transient_proc_stat.has_warning = true;
-    strcpy_P(_transient_proc_stat.message, warnMsg);
-    debugnnl(F("WARN: ")); debug(_transient_proc_stat.message);
-  }
-
-  void setError(const char* errMsg) {
-    _transient_proc_stat.has_error = true;
-    strcpy_P(_transient_proc_stat.message, errMsg);
-    debug(F("********************"));
-    debug(F("Error"));
-    debug(_transient_proc_stat.message);
-    debug(F("********************"));
-  };
+  void setWarning(byte code);
+  void setError(byte code);
 
   void recover_eeprom_state();
   bool parse_receipe_line(char* line);
@@ -223,25 +380,52 @@ private:
   void read_temp_sensor();
   void setup_temp_sensor();
   
-  void update_target_temp();
-  void update_state_machine();
-  void update_display_name();
-  void update_heater();
+  bool append_step(byte op, byte arg1, byte arg2);
+  void finish_program();
+
+  void update_heat_rate();
+  bool detect_boil();
+  void save_boil_point();
+  float next_target_temp();
+  float control_target_temp();
+  void update_program();
+  void set_target_temp(float temp);
+  void update_heater(byte ch, Step step, float target_temp);
   void update_eeprom(bool force);
 
-  void turn_on_heater();
-  void turn_off_heater();
-  void turn_on_heater_throttled();
+  void turn_on_heater(byte ch);
+  void turn_off_heater(byte ch);
+  void turn_off_heaters();
+  void turn_on_heater_throttled(byte ch);
+  void turn_on_heater_ramp(byte ch, float temp_diff);
   void phase_transition(Phase next_phase);
   void step_transition(Step next_step);
 
-  void handle_mash_in();
-  void handle_rests();
-  void handle_mash_out();
-  void handle_second_wash();
+  // step handlers, see program.h
+  byte op_end(const byte* args);
+  byte op_phase(const byte* args);
+  byte op_heat_to(const byte* args);
+  byte op_hold_for(const byte* args);
+  byte op_ramp(const byte* args);
+  byte op_prompt(const byte* args);
+  byte op_alarm(const byte* args);
+  byte op_boil(const byte* args);
+  byte op_branch_below(const byte* args);
+  byte op_cool(const byte* args);
+
+  void show_alarm(byte text);
 
-  void start_rest_timer();
-  bool is_rest_timer_over();
+  void start_hop_timer();
+  void set_hop_deadline();
+  void fire_hop_additions();
+
+  void update_cool_fit();
+  unsigned long cool_rest();
+
+  void handle_sparge_vessel();
+
+  void start_step_timer();
+  bool is_step_timer_over(unsigned long duration);
 
   void write_eeprom(byte* data, int size, int offset);
   void read_eeprom(byte* data, int size, int offset);
@@ -249,4 +433,4 @@ private:
 };
 
 #endif /* BREWPROC_H_ */
-
+
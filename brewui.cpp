@@ -1,14 +1,35 @@
-#include <LiquidCrystal_I2C.h>
+#include "lcdqueue.h"
 #include <Time.h>
 #include "encoder.h"
 #include "brewproc.h"
 #include "encoder.h"
 #include "brewui.h"
+#include "planner.h"
 #include "brauwerkstatt.h"
+#include "fmt.h"
+#include "perf.h"
+#include "recorder.h"
+#include "uistrings.h"
 
-BrewUi::BrewUi(BrewProcess* brew_proc, LiquidCrystal_I2C* lcd, byte enc_pin_a, byte enc_pin_b, byte enc_pin_switch)
+#define LOG_LEVEL LOG_LEVEL_UI
+#include "log.h"
+
+// changes that affect the status line in the first row
+#define STATUS_LINE_CHANGES (BrewProcess::ChangedTemp | BrewProcess::ChangedHeater | BrewProcess::ChangedPhase)
+
+// screen definitions
+// main menu, _menu_ptr is 1-based
+// opened over a running process, it has "back" as one more item after these
+static const byte MENU_ITEMS[] PROGMEM = { StrMash, StrSparge, StrBoil, StrSettings };
+#define MENU_ITEM_COUNT sizeof(MENU_ITEMS)
+
+// phase names, indexed by BrewProcess::Phase
+static const byte PHASE_NAMES[] PROGMEM = { StrMashIn, StrRest, StrMashOut, StrSparge, StrBoil, StrCool };
+
+BrewUi::BrewUi(BrewProcess* brew_proc, Planner* planner, LcdQueue* lcd, byte enc_pin_a, byte enc_pin_b, byte enc_pin_switch)
 {
   _brew_process = brew_proc;
+  _planner = planner;
   _encoder = new Encoder(enc_pin_a, enc_pin_b, enc_pin_switch);
 
   _lcd = lcd;
@@ -16,89 +37,234 @@ BrewUi::BrewUi(BrewProcess* brew_proc, LiquidCrystal_I2C* lcd, byte enc_pin_a, b
 
 void BrewUi::init()
 {
+  strings_init();
+  _language = ui_language();
+
   _lcd->init();
   _lcd->backlight();
   clear_screen();
-  update_line_P(PSTR(" Brauwerkstatt v1.0"), 1, false, false, false);
+  update_line_P(str_P(StrSplash), 1, false, false, false);
   delay(1500);
 }
 
 void BrewUi::update_ui()
 {
-  int clicks = _encoder->readClicks();
-  int steps = _encoder->readSteps();
-  int holds = _encoder->readHolds();
+  PERF_SCOPE(PerfUi);
+
+  // handle input in the order it happened
+  input_event_t event;
+  while (rec_input(_encoder->read(event), event))
+  {
+    handle_input(event);
+  }
+
+  // collect what has changed since the last frame, timers are re-rendered once per second
+  _changes |= _brew_process->fetchChanges();
+  if (_language != ui_language())
+  {
+    // language switched (serial command): render everything again
+    _language = ui_language();
+    _changes = BrewProcess::ChangedAll | ChangedMenu;
+  }
+  // the menu over a running process gives way to a prompt, and is no longer needed when the
+  // process has ended
+  if (_menu && _brew_process->needConfirmation())
+  {
+    _menu = false;
+    _settings = false;
+  }
+  else if (_menu && !_brew_process->isRunning())
+  {
+    _menu = false;
+  }
+  unsigned long second = now();
+  if (second != _last_second)
+  {
+    _last_second = second;
+    _tick = true;
+  }
+
+  // only start a new frame when the previous one has been sent to the display completely
+  if (!_lcd->idle())
+  {
+    return;
+  }
+  _frame_incomplete = false;
+  if (_lcd->errors() != _lcd_errors)
+  {
+    // the queue was dropped on a bus error, the backing buffer no longer matches the display
+    _lcd_errors = _lcd->errors();
+    clear_screen();
+    _changes = BrewProcess::ChangedAll | ChangedMenu;
+    _tick = true;
+  }
 
   if (_brew_process->hasError())
   {
-    if(_current_screen == Screen::Error)
-    {
-      // only process events if error screen is already showing
-      if (clicks > 0)
-      {
-        _brew_process->resetError();
-      }
-    }
-    set_screen(Screen::Error);          
+    set_screen(Screen::Error);
     display_error();
   }
   else if(_brew_process->hasWarning())
   {
     
   }
-  else if (_brew_process->isRunning())
+  else if (_brew_process->isRunning() && !_menu)
   {
     set_screen(Screen::Process);
+    display_process_state();
+  }
+  else if (_settings)
+  {
+    set_screen(Screen::Settings);
+    display_settings();
+  }
+  else // menu mode
+  {
+    set_screen(Screen::Menu);
+    display_menu();
+  }
+
+  // keep the changes if a line did not fit into the output queue, it gets completed with the next frame
+  if (!_frame_incomplete)
+  {
+    _changes = 0;
+    _tick = false;
+  }
+}
+
+void BrewUi::handle_input(const input_event_t& event)
+{
+  if (_brew_process->hasError())
+  {
+    // only process events if error screen is already showing
+    if (_current_screen == Screen::Error && event.type == Encoder::Click)
+    {
+      _brew_process->resetError();
+    }
+  }
+  else if(_brew_process->hasWarning())
+  {
 
-    if(holds > 0)
+  }
+  else if (_brew_process->isRunning() && !_menu)
+  {
+    if (event.type == Encoder::HoldStart)
     {
       _brew_process->stop_process();
     }
-    else if (_brew_process->needConfirmation())
+    else if (event.type == Encoder::Click && _brew_process->needConfirmation())
     {
-      if (clicks > 0)
-      {
-          _brew_process->confirm();
-      }
+      _brew_process->confirm();
     }
-    display_process_state();
+    // without a prompt, a click opens the menu, e.g. to start the sparge vessel or the boil
+    else if (event.type == Encoder::Click)
+    {
+      _menu = true;
+      _menu_ptr = 1;
+      _changes |= ChangedMenu;
+    }
+  }
+  else if (_settings)
+  {
+    handle_settings_input(event);
   }
   else // menu mode
   {
-    set_screen(Screen::Menu);
-
-    if(steps != 0)
+    int items = MENU_ITEM_COUNT + (_menu ? 1 : 0);
+    if (event.type == Encoder::Step)
     {
-      _menu_ptr += steps;
+      _menu_ptr += event.steps;
       if (_menu_ptr < 1) _menu_ptr = 1;
-      if (_menu_ptr > 3) _menu_ptr = 3;
+      if (_menu_ptr > items) _menu_ptr = items;
+      _changes |= ChangedMenu;
     }
-    else if(clicks > 0)
+    else if (event.type == Encoder::Click)
     {
-      debugnnl(F("Menu item selected at index "));
-      debug(_menu_ptr);
+      log_debug(LogMenuSelect, _menu_ptr);
+      // a running process keeps the receipe it was started with, the other one starts with it
+      if (_menu_ptr <= 3 && !_brew_process->isRunning())
+      {
+        _brew_process->load_receipe();
+      }
       switch(_menu_ptr)
       {
       case 1:
-        _brew_process->load_receipe();
         _brew_process->start_mash_process();
         break;
       case 2:
-        _brew_process->load_receipe();
         _brew_process->start_second_wash_process();
         break;
       case 3:
-        _brew_process->load_receipe();
         _brew_process->start_boil_process();
         break;
+      case 4:
+        _settings = true;
+        _config_ptr = 0;
+        _config_edit = false;
+        break;
       default:
         break;
       }
+      // back to the process, the settings return to the menu
+      if (_menu_ptr != 4)
+      {
+        _menu = false;
+      }
+      _changes |= ChangedMenu;
     }
-    display_menu();
   }
 }
 
+// the settings screen edits config values as integers in units of 10^-decimals
+static unsigned long config_scale(byte decimals)
+{
+  unsigned long scale = 1;
+  while (decimals-- > 0)
+  {
+    scale *= 10;
+  }
+  return scale;
+}
+
+/*
+ * settings screen: turning selects a config value, a click edits it, turning changes it by the
+ * step of the value with acceleration and another click sets it. The entry after the last value
+ * leaves the screen.
+ */
+void BrewUi::handle_settings_input(const input_event_t& event)
+{
+  byte idx = _config_ptr;
+  if (_config_edit && event.type == Encoder::Step)
+  {
+    long max = lround(_brew_process->configMax(idx) * config_scale(_brew_process->configDecimals(idx)));
+    long value = _config_value + (long)_encoder->accelerate(event) * _brew_process->configStep(idx);
+    _config_value = constrain(value, 0L, max);
+  }
+  else if (event.type == Encoder::Step)
+  {
+    _config_ptr = constrain(_config_ptr + event.steps, 0, _brew_process->numConfig());
+  }
+  else if (event.type != Encoder::Click)
+  {
+    return;
+  }
+  else if (_config_edit)
+  {
+    _brew_process->setConfig(idx, _config_value / (float)config_scale(_brew_process->configDecimals(idx)));
+    _config_edit = false;
+  }
+  else if (idx == _brew_process->numConfig())
+  {
+    _settings = false;
+  }
+  else
+  {
+    _config_value = lround(_brew_process->getConfig(idx) * config_scale(_brew_process->configDecimals(idx)));
+    _config_edit = true;
+  }
+  _changes |= ChangedMenu;
+}
+
 void BrewUi::encoder_isr()
 {
   _encoder->service();
@@ -110,95 +276,232 @@ void BrewUi::set_screen(Screen s)
   {
     clear_screen();
     _current_screen = s;
+    // new screen, everything has to be rendered
+    _changes = BrewProcess::ChangedAll | ChangedMenu;
+    _tick = true;
   }
 }
 
 void BrewUi::display_error()
 {
-  update_line_P(PSTR(""), 0, false, false, false);
-  update_line(_brew_process->getMessage(), 1, false, false, false);
-  update_line_P(PSTR(""), 2, false, false, false);
-  update_line_P(PSTR("      Ok?"), 3, false, false, false);
+  if (!(_changes & BrewProcess::ChangedError))
+  {
+    return;
+  }
+  char buffer[LCD_COLS + 1];
+  update_line("", 0, false, false, false);
+  fmt_end(fmt_string(buffer, StrMsgNone + _brew_process->getMessageCode()));
+  update_line(buffer, 1, false, false, false);
+  update_line("", 2, false, false, false);
+  memset(buffer, ' ', 6);
+  fmt_end(fmt_string(buffer + 6, StrOk));
+  update_line(buffer, 3, false, false, false);
 }
 
 void BrewUi::display_menu()
 {
-  char buffer[21];
+  if (_tick || (_changes & STATUS_LINE_CHANGES))
+  {
+    char buffer[21];
+    create_status_line(buffer);
+    update_line(buffer, 0, false, false, false);
+  }
 
-  create_status_line(buffer);
+  if (_changes & ChangedMenu)
+  {
+    // the items below the status line, scrolled so the selected one is shown
+    char buffer[LCD_COLS + 1];
+    byte first = _menu_ptr >= LCD_LINES ? _menu_ptr - (LCD_LINES - 1) : 0;
+    for (byte i = 0; i + 1 < LCD_LINES; i++)
+    {
+      byte item = first + i;
+      // first column is the menu pointer
+      buffer[0] = ' ';
+      char* p = buffer + 1;
+      if (item < MENU_ITEM_COUNT)
+      {
+        p = fmt_string(p, pgm_read_byte(&MENU_ITEMS[item]));
+      }
+      else if (item == MENU_ITEM_COUNT && _menu)
+      {
+        p = fmt_string(p, StrBack);
+      }
+      fmt_end(p);
+      update_line(buffer, i + 1, false, false, _menu_ptr == item + 1);
+    }
+  }
+}
+
+void BrewUi::display_settings()
+{
+  char buffer[LCD_COLS + 1];
+  if (_tick || (_changes & STATUS_LINE_CHANGES))
+  {
+    create_status_line(buffer);
+    update_line(buffer, 0, false, false, false);
+  }
+
+  if (_changes & ChangedMenu)
+  {
+    // name of the selected value, the pointer moves to its value while it is edited
+    byte idx = _config_ptr;
+    buffer[0] = ' ';
+    if (idx == _brew_process->numConfig())
+    {
+      fmt_end(fmt_string(buffer + 1, StrBack));
+      update_line(buffer, 1, false, false, true);
+      update_line("", 2, false, false, false);
+      return;
+    }
+    fmt_end(fmt_str_P(buffer + 1, _brew_process->configName(idx)));
+    update_line(buffer, 1, false, false, !_config_edit);
 
-  update_line(buffer, 0, false, false, false);
-  update_line_P(PSTR(" Maischen"), 1, false, false, _menu_ptr == 1);
-  update_line_P(PSTR(" Nachguss"), 2, false, false, _menu_ptr == 2);
-  update_line_P(PSTR(" Kochen"), 3, false, false, _menu_ptr == 3);
+    byte decimals = _brew_process->configDecimals(idx);
+    long value = _config_edit ? _config_value : lround(_brew_process->getConfig(idx) * config_scale(decimals));
+    fmt_end(fmt_fixed(buffer + 1, value, decimals));
+    update_line(buffer, 2, false, false, _config_edit);
+  }
 }
 
 void BrewUi::display_process_state()
 {
 
-  // first line: status
   char buffer[21];
-  create_status_line(buffer);
-  update_line(buffer, 0, false, false, false);
 
-  // second line: status name
-  update_line(_brew_process->getDisplayName(), 1, false, false, false);
+  // first line: status
+  if (_tick || (_changes & STATUS_LINE_CHANGES))
+  {
+    create_status_line(buffer);
+    update_line(buffer, 0, false, false, false);
+  }
 
-  // third line: target temp
-  if(_brew_process->getTargetTemp() > 0)
+  if (_changes & BrewProcess::ChangedPhase)
   {
-    float targ_temp = _brew_process->getTargetTemp();
-    int temp_deg = (int)targ_temp;
-    int temp_frac = ((int)(targ_temp * 10.0F)) % 10;
-    sprintf_P(buffer, PSTR("Soll: %02d.%d%cC"), temp_deg, temp_frac, (char)223);  
+    // second line: phase name and step, of the sparge vessel if it runs alone
+    byte phase = _brew_process->getPhase();
+    byte step = _brew_process->getStep();
+    if (!_brew_process->isMashRunning())
+    {
+      phase = BrewProcess::SecondWash;
+      step = _brew_process->getSpargeStep();
+    }
+    char* p = fmt_string(buffer, pgm_read_byte(&PHASE_NAMES[phase]));
+    if (phase == BrewProcess::Rest)
+    {
+      p = fmt_uint<1>(p, _brew_process->getCurrentRest() + 1);
+    }
+    switch (step)
+    {
+    case BrewProcess::Heat:
+      p = fmt_string(p, StrStepHeat);
+      break;
+    case BrewProcess::Hold:
+      p = fmt_string(p, StrStepHold);
+      break;
+    case BrewProcess::Ramp:
+      p = fmt_string(p, StrStepRamp);
+      break;
+    default:
+      break;
+    }
+    fmt_end(p);
+    update_line(buffer, 1, false, false, false);
+  }
+
+#ifdef SPARGE_VESSEL
+  if (_brew_process->isSpargeRunning())
+  {
+    // third line: mash target and the sparge vessel, in the columns of the status line
+    // "TT.T°C    N H TT.T°C"
+    if (_changes & (BrewProcess::ChangedPhase | BrewProcess::ChangedTemp | BrewProcess::ChangedHeater))
+    {
+      memset(buffer, ' ', 10);
+      if (_brew_process->isMashRunning() && _brew_process->getTargetTemp() > 0)
+      {
+        fmt_temp(buffer, _brew_process->getTargetTemp());
+      }
+      char* p = buffer + 10;
+      *p++ = 'N';
+      *p++ = ' ';
+      *p++ = _brew_process->heaterOn(BrewProcess::ChannelSparge) ? 'H' : ' ';
+      *p++ = ' ';
+      p = fmt_temp(p, _brew_process->getCurrentTemp(BrewProcess::ChannelSparge));
+      fmt_end(p);
+      update_line(buffer, 2, false, false, false);
+    }
   }
   else
+#endif
   {
-    sprintf(buffer, "");
+    // third line: target temp and the time until the next step starts, "Soll: TT.T°C +HH:MM"
+    // not a time of day, the controller clock only counts from power-on
+    unsigned long eta = _planner->active() ? _planner->nextEta() : 0;
+    unsigned long left = eta > _last_second ? (eta - _last_second + 59) / 60 : 0;
+    if ((_changes & BrewProcess::ChangedPhase) || left != _eta_shown)
+    {
+      _eta_shown = left;
+      char* p = buffer;
+      if(_brew_process->getTargetTemp() > 0)
+      {
+        p = fmt_string(p, StrTarget);
+        p = fmt_temp(p, _brew_process->getTargetTemp());
+      }
+      if (left != 0 && p - buffer <= LCD_COLS - 7)
+      {
+        memset(p, ' ', LCD_COLS - 6 - (p - buffer));
+        p = buffer + LCD_COLS - 6;
+        *p++ = '+';
+        p = fmt_2d(p, left / 60);
+        *p++ = ':';
+        p = fmt_2d(p, left % 60);
+      }
+      fmt_end(p);
+      update_line(buffer, 2, false, false, false);
+    }
   }
-  update_line(buffer, 2, false, false, false);
 
   // fourth line: either Prompt or Timings
+  if (!_tick && !(_changes & (BrewProcess::ChangedPhase | BrewProcess::ChangedPrompt)))
+  {
+    return;
+  }
   if (_brew_process->needConfirmation())
   {
-    sprintf_P(buffer, PSTR("        %s"), _brew_process->getPrompt());
+    memset(buffer, ' ', 8);
+    char* p = fmt_string(buffer + 8, _brew_process->getPrompt());
+    fmt_end(p);
   }
   else
   {
-    unsigned long phase_running = now() - _brew_process->phaseStart();
+    unsigned long phase_start = _brew_process->isMashRunning() ? _brew_process->phaseStart() : _brew_process->spargeStart();
+    unsigned long phase_running = _last_second - phase_start;
     unsigned long phase_rest = _brew_process->phaseRest();
-    
-    int phase_min = numberOfMinutes(phase_running);
-    int phase_sec = numberOfSeconds(phase_running);
-    
+
+    char* p = fmt_mmss(buffer, phase_running);
     if (phase_rest > 0)
     {
-      int rest_min = numberOfMinutes(phase_rest);
-      int rest_sec = numberOfSeconds(phase_rest);
-      sprintf_P(buffer, PSTR("%02d:%02d (Rest %02d:%02d)"), phase_min, phase_sec, rest_min, rest_sec);
-    }
-    else
-    {
-      sprintf_P(buffer, PSTR("%02d:%02d"), phase_min, phase_sec);
+      p = fmt_string(p, StrRemaining);
+      p = fmt_mmss(p, phase_rest);
+      *p++ = ')';
     }
+    fmt_end(p);
   }
   update_line(buffer, 3, false, false, false);
 }
 
 void BrewUi::create_status_line(char* strbuf)
 {
-  unsigned long proc_running = now() - _brew_process->procStart();
-  int run_hrs = numberOfHours(proc_running);
-  int run_min = numberOfMinutes(proc_running);
-  int run_sec = numberOfSeconds(proc_running);
-  float current_temp = _brew_process->getCurrentTemp();
-  int temp_deg = (int)current_temp;
-  int temp_frac = ((int)(current_temp * 10.0F)) % 10;
-  sprintf_P(strbuf, PSTR("%02d:%02d:%02d  %c %c %02d.%d%cC"),
-      run_hrs, run_min, run_sec,
-      _brew_process->getPhaseChar(),
-      _brew_process->heaterOn() ? 'H' : ' ',
-      temp_deg, temp_frac, (char)223);  
+  unsigned long proc_running = _last_second - _brew_process->procStart();
+  // "HH:MM:SS  P H TT.T°C"
+  char* p = fmt_hhmmss(strbuf, proc_running);
+  *p++ = ' ';
+  *p++ = ' ';
+  *p++ = _brew_process->getPhaseChar();
+  *p++ = ' ';
+  *p++ = _brew_process->heaterOn() ? 'H' : ' ';
+  *p++ = ' ';
+  p = fmt_temp(p, _brew_process->getCurrentTemp());
+  fmt_end(p);
 }
 
 /**
@@ -223,6 +526,8 @@ void BrewUi::update_line_P(const char* buffer, int line_idx, bool scrollUp, bool
 
 void BrewUi::update_line(const char* buffer, int line_idx, bool scrollUp, bool scrollDown, bool menuPtr)
 {
+  PERF_SCOPE(PerfUpdateLine);
+
   char full_line[LCD_COLS + 1];
   memset(full_line, ' ', LCD_COLS);
   full_line[LCD_COLS] = '\0';
@@ -241,18 +546,29 @@ void BrewUi::update_line(const char* buffer, int line_idx, bool scrollUp, bool s
     full_line[0] = '>';
   }
 
+#ifndef TELEMETRY_BINARY
   bool diff = false;
+#endif
   for(int i = 0; i < LCD_COLS; i++)
   {
     if (full_line[i] != _lines[line_idx][i])
     {
+      if (_lcd->room() < 2)
+      {
+        // output queue is full, the remaining characters are written with the next frame
+        _frame_incomplete = true;
+        break;
+      }
+#ifndef TELEMETRY_BINARY
       diff = true;
+#endif
       _lcd->setCursor(i, line_idx);
       _lcd->print(full_line[i]);
+      _lines[line_idx][i] = full_line[i];
     }
   }
-  memcpy(_lines[line_idx], full_line, LCD_COLS + 1);
 
+#ifndef TELEMETRY_BINARY
   if (diff)
   {
     bool dump_serial = false;
@@ -267,12 +583,7 @@ void BrewUi::update_line(const char* buffer, int line_idx, bool scrollUp, bool s
       }
       break;
     case Screen::Process:
-      // dump process screen every 5 secs to serial
-      if(millis() - last_print_ui > 5000)
-      {
-        dump_serial = true;
-        last_print_ui = millis();
-      }
+      // process screen is dumped by the logging task, see log_state()
       break;
     default:
       // splash screen and error/warning are dumped whenever something changes
@@ -283,15 +594,23 @@ void BrewUi::update_line(const char* buffer, int line_idx, bool scrollUp, bool s
       output_serial();
     }
   }
+#endif
+}
 
+void BrewUi::log_state()
+{
+  if (_current_screen == Screen::Process)
+  {
+    output_serial();
+  }
 }
 
 void BrewUi::output_serial()
 {
-  debug(F("--------------------"));
+  Serial.println(F("--------------------"));
   for (int i = 0; i < LCD_LINES; i++)
   {
-    debug(_lines[i]);    
+    Serial.println(_lines[i]);
   }
-  debug(F("--------------------"));
-}
+  Serial.println(F("--------------------"));
+}
@@ -1,13 +1,12 @@
 #ifndef __UI_H
 #define __UI_H
 
-#define __DEBUG
-
-#include "debug.h"
 #include "encoder.h"
 #include "Arduino.h"
 #include "brauwerkstatt.h"
 
+class Planner;
+
 /**
  * UI owns the LCD and the encoder
  */
@@ -15,13 +14,26 @@ class BrewUi
 {
 public:
 
-  BrewUi(BrewProcess* brew_proc, LiquidCrystal_I2C* lcd, byte enc_pin_a, byte enc_pin_b, byte enc_pin_switch);
+  BrewUi(BrewProcess* brew_proc, Planner* planner, LcdQueue* lcd, byte enc_pin_a, byte enc_pin_b, byte enc_pin_switch);
   void init();
   void update_ui();
   void encoder_isr();
 
+  /*
+   * true if there is user input waiting to be handled by update_ui()
+   */
+  bool inputPending() { return _encoder->pending(); };
+
+  /*
+   * dump the process screen to Serial, called periodically by the logging task
+   */
+  void log_state();
+
 private:
-  enum Screen { Error, Warning, Menu, Process, Splash };
+  enum Screen { Error, Warning, Menu, Process, Splash, Settings };
+
+  // UI side change bit, shares the byte with the BrewProcess::Change bits
+  enum { ChangedMenu = 0x80 };
 
   Screen _current_screen = Screen::Splash;
 
@@ -29,15 +41,39 @@ private:
   char _lines[LCD_LINES][LCD_COLS + 1];
   
   int _menu_ptr = 1;
+  // the menu is shown over the running process, a click without a prompt opens it
+  bool _menu = false;
+  // settings screen: the config value selected, numConfig() is "back", and the value being edited
+  bool _settings = false;
+  byte _config_ptr = 0;
+  bool _config_edit = false;
+  long _config_value = 0; // in units of 10^-configDecimals()
+  // language of the rendered screen
+  byte _language;
+
+  // only lines affected by these changes are rendered
+  byte _changes = BrewProcess::ChangedAll | ChangedMenu;
+  // a new second has started, timers need to be rendered
+  bool _tick = true;
+  unsigned long _last_second = 0;
+  // set by update_line() if the output queue was too full to write a complete line
+  bool _frame_incomplete = false;
+  // LCD bus errors seen so far, output was lost when the count of the queue is ahead
+  unsigned int _lcd_errors = 0;
+
+  unsigned long _eta_shown = 0; // minutes until the next step, shown in the target line
 
   BrewProcess* _brew_process;
-  LiquidCrystal_I2C* _lcd;
+  Planner* _planner;
+  LcdQueue* _lcd;
   Encoder* _encoder;
 
-  unsigned long last_print_ui = 0;
+  void handle_input(const input_event_t& event);
+  void handle_settings_input(const input_event_t& event);
 
   void display_process_state();
   void display_menu();
+  void display_settings();
   void display_error();
   void display_warning();
 
@@ -51,4 +87,4 @@ private:
   void output_serial();
 };
 
-#endif /* __UI_H */
+#endif /* __UI_H */
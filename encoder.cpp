@@ -1,111 +1,292 @@
-#undef __DEBUG
+#include <avr/interrupt.h>
+#include <util/atomic.h>
 
-#include "debug.h"
 #include "brauwerkstatt.h"
 #include "encoder.h"
 
-Encoder::Encoder(int pinA, int pinB, int pinSwitch)
-{
-  _enc_a_pin = pinA;
-  _enc_b_pin = pinB;
-  _switch_pin = pinSwitch;
+#define LOG_LEVEL LOG_LEVEL_ENCODER
+#include "log.h"
 
-  pinMode(_enc_a_pin, INPUT);
-  pinMode(_enc_b_pin, INPUT);
-  pinMode(_switch_pin, INPUT);
-  // turn on internal pull-up for switch, since the resistor is not mounted on the encoder PCB
-  digitalWrite(_switch_pin, HIGH);
-}
+#if ENC_A_PIN > 7 || ENC_B_PIN > 7 || ENC_SW_PIN > 7
+#error "Encoder pins must be on port D, they are read from PIND in the PCINT2 interrupt"
+#endif
+
+// KY-040 rests with both contacts open, i.e. A and B high
+#define ENC_DETENT_STATE 0x3
+
+// intervals are capped at this value, so acceleration reacts quickly after a pause
+#define ENC_ACCEL_SLOW_US 255000UL
+
+#ifdef ENC_HALF_STEP
+#define ENC_MIN_QUARTERS 1
+#else
+#define ENC_MIN_QUARTERS 2
+#endif
+
+/*
+ * Quadrature transition table, indexed by (previous state << 2) | current state
+ * +1/-1 for a valid quarter step, 0 for no change or an invalid transition (both
+ * contacts changed, i.e. bounce or a missed edge), which is simply dropped.
+ */
+static const int8_t QUADRATURE_TABLE[16] PROGMEM = {
+   0,  1, -1,  0,
+  -1,  0,  0,  1,
+   1,  0,  0, -1,
+   0, -1,  1,  0
+};
+
+struct accel_point_t {
+  byte max_ms; // time between detents
+  byte factor;
+};
+
+static const accel_point_t ACCEL_CURVE[] PROGMEM = ENC_ACCEL_CURVE;
 
-int Encoder::readSteps()
+static Encoder* encoder_instance = NULL;
+
+ISR(PCINT2_vect)
 {
-  int result = _steps;
-  _steps = 0;
-  return result;
+  encoder_instance->pinChange();
 }
 
-int Encoder::readClicks()
+Encoder::Encoder(int pinA, int pinB, int pinSwitch)
 {
-  int result = _clicks;
-  _clicks = 0;
-  return result;
+  _enc_a_mask = digitalPinToBitMask(pinA);
+  _enc_b_mask = digitalPinToBitMask(pinB);
+  _switch_mask = digitalPinToBitMask(pinSwitch);
+
+  pinMode(pinA, INPUT);
+  pinMode(pinB, INPUT);
+  pinMode(pinSwitch, INPUT);
+  // turn on internal pull-up for switch, since the resistor is not mounted on the encoder PCB
+  digitalWrite(pinSwitch, HIGH);
+
+  _enc_state = readState(PIND);
+
+#ifndef INPUT_SERIAL
+  encoder_instance = this;
+  PCMSK2 |= _enc_a_mask | _enc_b_mask | _switch_mask;
+  PCIFR = _BV(PCIF2);
+  PCICR |= _BV(PCIE2);
+#endif
 }
 
-int Encoder::readHolds()
+bool Encoder::read(input_event_t& event)
 {
-  int result = _holds;
-  _holds = 0;
-  return result;
+  byte tail = _ev_tail;
+  bool queued = tail != _ev_head;
+
+  // a hold has no edge of its own, it is inserted here as soon as the button has been down
+  // long enough, before any queued event that happened later
+  if (_btn_down && !_btn_held && !queued && (PIND & _switch_mask))
+  {
+    // button is up although no release came through (debounced away), don't report a hold
+    _btn_down = false;
+  }
+  if (_btn_down && !_btn_held)
+  {
+    unsigned long until = queued ? _events[tail].micros : micros();
+    if (until - _btn_down_micros >= ENC_HOLD_US)
+    {
+      log_debug(LogEncoderHold);
+      _btn_held = true;
+      event.type = HoldStart;
+      event.steps = 0;
+      event.micros = _btn_down_micros + ENC_HOLD_US;
+      return true;
+    }
+  }
+
+  if (!queued)
+  {
+    // steps that did not fit into the queue are older than anything queued after them
+    int8_t steps;
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+    {
+      steps = _pending_steps;
+      _pending_steps = 0;
+    }
+    if (steps == 0)
+    {
+      return false;
+    }
+    event.type = Step;
+    event.steps = steps;
+    event.micros = micros();
+    return true;
+  }
+
+  event.type = _events[tail].type;
+  event.steps = _events[tail].steps;
+  event.micros = _events[tail].micros;
+  _ev_tail = (tail + 1) & (ENC_EVENT_QUEUE_SIZE - 1);
+
+  if (event.type == Click)
+  {
+    _btn_down = true;
+    _btn_held = false;
+    _btn_down_micros = event.micros;
+  }
+  else if (event.type == Release)
+  {
+    _btn_down = false;
+  }
+  return true;
 }
 
-void Encoder::service()
+int Encoder::accelerate(const input_event_t& event)
 {
-#ifdef INPUT_SERIAL
-  serialService();
-#else
-  encoderService();
-  buttonService();
-#endif
+  if (event.type != Step || event.steps == 0)
+  {
+    return 0;
+  }
+
+  int8_t dir = event.steps > 0 ? 1 : -1;
+  unsigned long interval = (event.micros - _accel_last_micros) / abs(event.steps);
+  _accel_last_micros = event.micros;
+  if (interval > ENC_ACCEL_SLOW_US)
+  {
+    interval = ENC_ACCEL_SLOW_US;
+  }
+  if (dir != _accel_dir)
+  {
+    // turning back is for fine adjustment, start slow again
+    _accel_dir = dir;
+    _accel_interval = ENC_ACCEL_SLOW_US;
+    return event.steps;
+  }
+  // moving average, speed builds up over a few detents and a single fast one is ignored
+  _accel_interval = _accel_interval / 2 + interval / 2;
+
+  byte factor = 1;
+  for (byte i = 0; i < sizeof(ACCEL_CURVE) / sizeof(ACCEL_CURVE[0]); i++)
+  {
+    if (_accel_interval <= pgm_read_byte(&ACCEL_CURVE[i].max_ms) * 1000UL)
+    {
+      factor = pgm_read_byte(&ACCEL_CURVE[i].factor);
+      break;
+    }
+  }
+  return event.steps * factor;
 }
 
-void Encoder::encoderService()
+/*
+ * queue an event, called from interrupt context only
+ */
+void Encoder::push(byte type, int8_t steps, unsigned long micros)
 {
-  unsigned long now = micros();
-  // TODO make debounce time (10ms = 10000us) configurable
-  if (_enc_last_micros - now >= 10000)
+  // steps that did not fit before go first, to keep the order of events
+  if (_pending_steps != 0)
   {
-    _enc_last_micros = now;
-    byte cur_a = digitalRead(2);
-    byte cur_b = digitalRead(4);
-    if (_enc_a_last_state == LOW && cur_a == HIGH)
+    if (!enqueue(Step, _pending_steps, micros))
     {
-      if(cur_b == LOW)
+      if (type == Step)
       {
-        debug("step--");
-        _steps--;
+        _pending_steps += steps;
       }
       else
       {
-        debug("step++");
-        _steps++;
+        _dropped++;
       }
+      return;
     }
-    _enc_a_last_state = cur_a;
+    _pending_steps = 0;
   }
+  if (!enqueue(type, steps, micros))
+  {
+    // queue is full: steps are summed up until there is room again, other events are lost
+    if (type == Step)
+    {
+      _pending_steps += steps;
+    }
+    else
+    {
+      _dropped++;
+    }
+  }
+}
+
+bool Encoder::enqueue(byte type, int8_t steps, unsigned long micros)
+{
+  byte head = _ev_head;
+  byte next = (head + 1) & (ENC_EVENT_QUEUE_SIZE - 1);
+  if (next == _ev_tail)
+  {
+    return false;
+  }
+  _events[head].type = type;
+  _events[head].steps = steps;
+  _events[head].micros = micros;
+  // publish the event only after it has been written completely
+  _ev_head = next;
+  return true;
+}
 
+void Encoder::pinChange()
+{
+  byte pins = PIND;
+  encoderService(pins);
+  buttonService(pins);
 }
 
-void Encoder::buttonService()
+void Encoder::service()
 {
-  unsigned long now = micros();
-  // TODO make debounce time (10ms = 10000us) configurable
-  if(now - _btn_last_micros > 10000)
+#ifdef INPUT_SERIAL
+  serialService();
+#endif
+}
+
+byte Encoder::readState(byte pins)
+{
+  return ((pins & _enc_a_mask) ? 0x2 : 0) | ((pins & _enc_b_mask) ? 0x1 : 0);
+}
+
+void Encoder::encoderService(byte pins)
+{
+  byte state = readState(pins);
+  if (state == _enc_state)
   {
-    byte state = digitalRead(_switch_pin);
-    
-    if (_btn_last_state == HIGH && state == LOW)
-    {
-      debug("click++");
-      _btn_down_micros = micros();
-      _clicks++;
-    }
-    else if (_btn_last_state == LOW && state == HIGH)
+    return;
+  }
+  _enc_quarters += (int8_t)pgm_read_byte(&QUADRATURE_TABLE[(_enc_state << 2) | state]);
+  _enc_state = state;
+
+#ifdef ENC_HALF_STEP
+  if (state == ENC_DETENT_STATE || state == (ENC_DETENT_STATE ^ 0x3))
+#else
+  if (state == ENC_DETENT_STATE)
+#endif
+  {
+    // arrived at a detent: count a step if we got here through the quadrature cycle
+    // contact bounce around the detent adds up to 0
+    if (_enc_quarters >= ENC_MIN_QUARTERS)
     {
-      _btn_held = false;
+      push(Step, 1, micros());
     }
-    else if (_btn_last_state == LOW && state == LOW && !_btn_held)
+    else if (_enc_quarters <= -ENC_MIN_QUARTERS)
     {
-      if (micros() - _btn_down_micros > 2000000)
-      {      
-        debug("holds++");
-        _holds++;
-        _btn_held = true;
-      }
+      push(Step, -1, micros());
     }
+    _enc_quarters = 0;
+  }
+}
 
-    _btn_last_state = state;
-    _btn_last_micros = now;
+void Encoder::buttonService(byte pins)
+{
+  byte state = (pins & _switch_mask) ? HIGH : LOW;
+  if (state == _btn_last_state)
+  {
+    return;
+  }
+
+  unsigned long now = micros();
+  // an edge only counts if the contact has been quiet before, all bounces follow within a few ms
+  if (now - _btn_last_micros >= ENC_DEBOUNCE_US)
+  {
+    push(state == LOW ? Click : Release, 0, now);
   }
+  _btn_last_micros = now;
+  _btn_last_state = state;
 }
 
 void Encoder::serialService()
@@ -117,22 +298,22 @@ void Encoder::serialService()
   if (Serial.available() > 0)
   {
     byte c = Serial.read();
-    debugnnl("Got a char on serial: ");
-    debug((char)c);
+    log_debug(LogSerialChar, c);
+    unsigned long now = micros();
     switch (c)
     {
     case '-':
-      _steps--;
+      push(Step, -1, now);
       break;
     case '+':
-      _steps++;
+      push(Step, 1, now);
       break;
     case 'c':
-      _clicks++;
+      push(Click, 0, now);
+      push(Release, 0, now);
       break;
     case 'h':
-      _holds++;
+      push(HoldStart, 0, now);
     }
   }
 }
-
@@ -2,59 +2,108 @@
 #define BW_ENCODER_H_
 
 #include "Arduino.h"
+#include "brauwerkstatt.h"
+
+/*
+ * input event as queued by the encoder interrupt
+ */
+struct input_event_t {
+  byte type; // Encoder::EventType
+  int8_t steps; // only for Step: number of steps, negative for left turns
+  unsigned long micros; // time of the event
+};
 
 class Encoder
 {
 public:
+  enum EventType { Step, Click, HoldStart, Release };
+
   Encoder(int pinA, int pinB, int pinSwitch);
 
   /*
-   * return number of encoder steps and reset internal counter back to 0
+   * take the next input event from the queue, returns false if there is none
+   *
+   * Events are returned in the order they happened. A button hold is a long press
+   * of >2sec and is reported as soon as the button has been held long enough.
+   * Only ever call this from the main loop, the queue is single-consumer.
+   */
+  bool read(input_event_t& event);
+
+  /*
+   * true if read() has a queued event to return
+   * holds are not included, they show up with the next regular read()
    */
-  int readSteps();
+  bool pending() { return _ev_tail != _ev_head || _pending_steps != 0; };
 
   /*
-   * return number of clicks and reset internal counter back to 0
+   * scale a Step event by the rotational speed, for entering numeric values
+   * speed is derived from the time between detents and mapped with ENC_ACCEL_CURVE,
+   * slow turns and changes of direction return the unscaled steps
+   * returns 0 for other events
    */
-  int readClicks();
+  int accelerate(const input_event_t& event);
 
   /*
-   * return number of button holds and reset internal counter back to 0
-   * a button hold is a long press of >2sec and is counted as soon as the button
-   * has been held long enough
+   * number of events that were lost because the queue was full
    */
-  int readHolds();
+  byte dropped() { return _dropped; };
 
   /*
-   * the encoder service routine, which is supposed to be called by a timer interrupt
+   * the pin change service routine, which is called from the PCINT2 interrupt
+   * for every edge on the encoder and switch pins
+   */
+  void pinChange();
+
+  /*
+   * the serial input service routine, which is supposed to be called by a timer interrupt
+   * only used with INPUT_SERIAL
    */
   void service();
 
 private:
-  volatile byte _encoder_last = LOW;
+  // ==========================================================
+  // Event queue
+  // single producer (interrupt) / single consumer (main loop)
+  // _ev_head is only written by the producer, _ev_tail only by the consumer,
+  // both are single bytes and therefore read and written atomically
+  // ==========================================================
+  volatile input_event_t _events[ENC_EVENT_QUEUE_SIZE];
+  volatile byte _ev_head = 0;
+  volatile byte _ev_tail = 0;
+  // steps that did not fit into the queue, they are queued with the next event
+  volatile int8_t _pending_steps = 0;
+  volatile byte _dropped = 0;
+
+  // encoder state variables (interrupt)
+  volatile byte _enc_state;  // last quadrature state, A in bit 1, B in bit 0
+  volatile int8_t _enc_quarters = 0;  // quarter steps since the last detent
 
-  volatile int _steps = 0;
-  volatile int _clicks = 0;
-  volatile int _holds = 0;
+  // button state variables (interrupt)
+  volatile unsigned long _btn_last_micros = 0;  // time of last button edge, for debouncing
+  volatile byte _btn_last_state = HIGH;  // last button state
 
-  // encoder state variables
-  volatile unsigned long _enc_last_micros = 0;  // time of last encoder event, for debouncing
-  volatile byte _enc_a_last_state = LOW;
+  // button state as seen by the consumer, for hold detection
+  bool _btn_down = false;
+  bool _btn_held = false;
+  unsigned long _btn_down_micros = 0;
 
-  // button state variables
-  volatile unsigned long _btn_last_micros = 0;  // time of last button event, for debouncing and HOLD detection
-  volatile bool _btn_held = false;  // state goes to true as soon as button remains pressed
-  volatile unsigned long _btn_down_micros = 0;  // last button down event
-  volatile int _btn_last_state = HIGH;  // last button state
+  // acceleration state (consumer)
+  unsigned long _accel_last_micros = 0;
+  unsigned long _accel_interval = 0; // smoothed time per detent
+  int8_t _accel_dir = 0;
 
+  // bit masks of the pins in PIND
+  byte _enc_a_mask;
+  byte _enc_b_mask;
+  byte _switch_mask;
 
-  int _enc_a_pin;
-  int _enc_b_pin;
-  int _switch_pin;
+  void push(byte type, int8_t steps, unsigned long micros);
+  bool enqueue(byte type, int8_t steps, unsigned long micros);
 
-  void encoderService();
-  void buttonService();
+  byte readState(byte pins);
+  void encoderService(byte pins);
+  void buttonService(byte pins);
   void serialService();
 };
 
-#endif /* BW_ENCODER_H_ */
+#endif /* BW_ENCODER_H_ */
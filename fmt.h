@@ -0,0 +1,179 @@
+#ifndef BW_FMT_H_
+#define BW_FMT_H_
+
+#include "Arduino.h"
+#include <Time.h>
+
+/*
+ * Fixed-width number formatters for the LCD line buffers and log output.
+ *
+ * Replacement for sprintf_P, which pulls in vfprintf and parses the format string at runtime.
+ * All functions write into the buffer at p and return the position behind the last written
+ * character, so calls can be chained. None of them writes a terminating '\0', use fmt_end().
+ */
+
+/*
+ * decimal number with at least DIGITS digits, zero padded ("%0<DIGITS>u")
+ */
+template<byte DIGITS>
+char* fmt_uint(char* p, unsigned long value)
+{
+  char tmp[DIGITS > 10 ? DIGITS : 10];
+  byte n = 0;
+  do
+  {
+    tmp[n++] = '0' + value % 10;
+    value /= 10;
+  } while (value > 0);
+  while (n < DIGITS)
+  {
+    tmp[n++] = '0';
+  }
+  while (n > 0)
+  {
+    *p++ = tmp[--n];
+  }
+  return p;
+}
+
+/*
+ * fixed point number, value in units of 10^-decimals ("%lu.%0<decimals>lu")
+ */
+inline char* fmt_fixed(char* p, unsigned long value, byte decimals)
+{
+  unsigned long scale = 1;
+  for (byte i = 0; i < decimals; i++)
+  {
+    scale *= 10;
+  }
+  p = fmt_uint<1>(p, value / scale);
+  if (decimals > 0)
+  {
+    *p++ = '.';
+    for (unsigned long div = scale / 10; div > 0; div /= 10)
+    {
+      *p++ = '0' + value / div % 10;
+    }
+  }
+  return p;
+}
+
+/*
+ * two digits ("%02d" for clock fields), values above 99 show as 99
+ */
+inline char* fmt_2d(char* p, unsigned long value)
+{
+  if (value > 99)
+  {
+    value = 99;
+  }
+  *p++ = '0' + value / 10;
+  *p++ = '0' + value % 10;
+  return p;
+}
+
+/*
+ * two hex digits ("%02x")
+ */
+inline char* fmt_hex8(char* p, byte value)
+{
+  static const char hex[] = "0123456789abcdef";
+  *p++ = hex[value >> 4];
+  *p++ = hex[value & 0x0F];
+  return p;
+}
+
+/*
+ * duration in seconds as HH:MM:SS
+ */
+inline char* fmt_hhmmss(char* p, unsigned long secs)
+{
+  p = fmt_2d(p, numberOfHours(secs));
+  *p++ = ':';
+  p = fmt_2d(p, numberOfMinutes(secs));
+  *p++ = ':';
+  return fmt_2d(p, numberOfSeconds(secs));
+}
+
+/*
+ * duration in seconds as MM:SS, hours are not shown
+ */
+inline char* fmt_mmss(char* p, unsigned long secs)
+{
+  p = fmt_2d(p, numberOfMinutes(secs));
+  *p++ = ':';
+  return fmt_2d(p, numberOfSeconds(secs));
+}
+
+/*
+ * temperature, always 6 characters: one decimal and degree sign, e.g. "42.5°C" ("%02d.%d%cC"),
+ * whole degrees from 100 (" 100°C"), "-9.9" at most below 0 and "--.-" for NaN
+ */
+inline char* fmt_temp(char* p, float temp)
+{
+  if (isnan(temp))
+  {
+    *p++ = '-';
+    *p++ = '-';
+    *p++ = '.';
+    *p++ = '-';
+  }
+  else if (temp >= 100.0F)
+  {
+    *p++ = ' ';
+    p = fmt_uint<3>(p, temp < 999.0F ? (unsigned int)temp : 999);
+  }
+  else if (temp < 0)
+  {
+    int tenths = temp > -9.9F ? (int)(-temp * 10.0F) : 99;
+    *p++ = '-';
+    *p++ = '0' + tenths / 10;
+    *p++ = '.';
+    *p++ = '0' + tenths % 10;
+  }
+  else
+  {
+    int tenths = (int)(temp * 10.0F);
+    p = fmt_2d(p, tenths / 10);
+    *p++ = '.';
+    *p++ = '0' + tenths % 10;
+  }
+  *p++ = (char)223; // degree sign in the HD44780 character set
+  *p++ = 'C';
+  return p;
+}
+
+/*
+ * copy a PROGMEM string without its terminating '\0'
+ */
+inline char* fmt_str_P(char* p, const char* str)
+{
+  char c;
+  while ((c = pgm_read_byte(str++)) != '\0')
+  {
+    *p++ = c;
+  }
+  return p;
+}
+
+/*
+ * copy a RAM string without its terminating '\0'
+ */
+inline char* fmt_str(char* p, const char* str)
+{
+  while (*str != '\0')
+  {
+    *p++ = *str++;
+  }
+  return p;
+}
+
+/*
+ * terminate the string at p
+ */
+inline void fmt_end(char* p)
+{
+  *p = '\0';
+}
+
+#endif /* BW_FMT_H_ */
@@ -0,0 +1,234 @@
+#include <avr/interrupt.h>
+#include <util/atomic.h>
+#include <util/twi.h>
+
+#include "brauwerkstatt.h"
+#include "lcdqueue.h"
+
+// PCF8574 pin mapping of the LCD backpack
+#define LCD_RS 0x01
+#define LCD_EN 0x04
+#define LCD_BL 0x08
+
+// queue entries with the EN bit set are sent once without strobe, to keep the bus busy
+// while the LCD executes a slow command
+#define LCD_PAD LCD_EN
+
+// one byte on the bus takes 9 clocks, 90us at 100kHz
+#define LCD_PAD_US (9000000UL / LCD_I2C_FREQ)
+#define LCD_PADS_FOR_US(us) ((us) / LCD_PAD_US + 1)
+
+#define LCD_QUEUE_MASK (LCD_QUEUE_SIZE - 1)
+
+#define TWCR_START (_BV(TWINT) | _BV(TWEN) | _BV(TWIE) | _BV(TWSTA))
+#define TWCR_SEND (_BV(TWINT) | _BV(TWEN) | _BV(TWIE))
+#define TWCR_STOP (_BV(TWINT) | _BV(TWEN) | _BV(TWSTO))
+
+static LcdQueue* lcd_queue_instance = NULL;
+
+ISR(TWI_vect)
+{
+  lcd_queue_instance->service();
+}
+
+LcdQueue::LcdQueue(byte address)
+{
+  _address = address;
+  _backlight = LCD_BL;
+  _cursor = 0xFF;
+}
+
+void LcdQueue::init()
+{
+  lcd_queue_instance = this;
+
+  // internal pull-ups, 100kHz bus clock, prescaler 1
+  digitalWrite(SDA, HIGH);
+  digitalWrite(SCL, HIGH);
+  TWSR &= ~(_BV(TWPS0) | _BV(TWPS1));
+  TWBR = ((F_CPU / LCD_I2C_FREQ) - 16) / 2;
+  TWCR = _BV(TWEN);
+
+  // LCD needs >40ms after power-up
+  delay(50);
+
+  // HD44780 4-bit init sequence, see datasheet figure 24
+  push_pad(1);
+  push_nibble(0x30, 0);
+  push_pad(LCD_PADS_FOR_US(4500));
+  push_nibble(0x30, 0);
+  push_pad(LCD_PADS_FOR_US(4500));
+  push_nibble(0x30, 0);
+  push_pad(LCD_PADS_FOR_US(150));
+  push_nibble(0x20, 0);
+
+  command(0x28); // function set: 4 bit, 2 lines, 5x8 dots
+  command(0x0C); // display on, no cursor, no blink
+  clear();
+  command(0x06); // entry mode: increment, no shift
+
+  while (!idle());
+}
+
+void LcdQueue::backlight()
+{
+  _backlight = LCD_BL;
+  push_pad(1);
+  kick();
+}
+
+void LcdQueue::noBacklight()
+{
+  _backlight = 0;
+  push_pad(1);
+  kick();
+}
+
+void LcdQueue::clear()
+{
+  command(0x01);
+  push_pad(LCD_PADS_FOR_US(2000));
+  _cursor = 0;
+}
+
+void LcdQueue::setCursor(byte col, byte row)
+{
+  static const byte row_offsets[] = { 0x00, 0x40, 0x14, 0x54 };
+  byte addr = row_offsets[row % 4] + col;
+  if (addr != _cursor)
+  {
+    command(0x80 | addr);
+    _cursor = addr;
+  }
+}
+
+void LcdQueue::print(char c)
+{
+  write(c, LCD_RS);
+  if (_cursor != 0xFF)
+  {
+    // the LCD increments the address after each write and wraps between its two memory lines
+    ++_cursor;
+    if (_cursor == 0x28) _cursor = 0x40;
+    else if (_cursor == 0x68) _cursor = 0x00;
+  }
+}
+
+byte LcdQueue::room()
+{
+  byte used = (_head - _tail) & LCD_QUEUE_MASK;
+  return (LCD_QUEUE_MASK - used) / 2;
+}
+
+bool LcdQueue::idle()
+{
+  return _head == _tail && !_busy;
+}
+
+void LcdQueue::command(byte value)
+{
+  write(value, 0);
+}
+
+void LcdQueue::write(byte value, byte mode)
+{
+  push_nibble(value & 0xF0, mode);
+  push_nibble(value << 4, mode);
+  kick();
+}
+
+void LcdQueue::push_nibble(byte nibble, byte mode)
+{
+  push((nibble & 0xF0) | mode);
+}
+
+void LcdQueue::push_pad(byte count)
+{
+  while (count-- > 0)
+  {
+    push(LCD_PAD);
+  }
+}
+
+void LcdQueue::push(byte entry)
+{
+  byte next = (_head + 1) & LCD_QUEUE_MASK;
+  while (next == _tail)
+  {
+    // queue is full, wait for the ISR to make room
+    // callers are expected to check room() first
+    kick();
+  }
+  _queue[_head] = entry;
+  _head = next;
+}
+
+/*
+ * start a transmission if the queue has data and the bus is not already running
+ */
+void LcdQueue::kick()
+{
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+  {
+    if (!_busy && _head != _tail)
+    {
+      // previous stop condition might still be on the bus
+      while (TWCR & _BV(TWSTO));
+      _busy = true;
+      TWCR = TWCR_START;
+    }
+  }
+}
+
+void LcdQueue::service()
+{
+  switch (TW_STATUS)
+  {
+  case TW_START:
+  case TW_REP_START:
+    TWDR = (_address << 1) | TW_WRITE;
+    TWCR = TWCR_SEND;
+    break;
+  case TW_MT_SLA_ACK:
+  case TW_MT_DATA_ACK:
+    if (_strobe_pending)
+    {
+      // EN falling edge, the LCD latches the nibble
+      TWDR = _strobe_byte;
+      _strobe_pending = false;
+      TWCR = TWCR_SEND;
+    }
+    else if (_head != _tail)
+    {
+      byte entry = _queue[_tail];
+      _tail = (_tail + 1) & LCD_QUEUE_MASK;
+      if (entry & LCD_PAD)
+      {
+        TWDR = (entry & ~LCD_PAD) | _backlight;
+      }
+      else
+      {
+        TWDR = entry | LCD_EN | _backlight;
+        _strobe_byte = entry | _backlight;
+        _strobe_pending = true;
+      }
+      TWCR = TWCR_SEND;
+    }
+    else
+    {
+      // queue drained, release the bus
+      TWCR = TWCR_STOP;
+      _busy = false;
+    }
+    break;
+  default:
+    // no ACK or arbitration lost: drop what is queued, the display state is unknown anyway
+    // and so is the cursor, the next setCursor() has to send its command
+    ++_errors;
+    _tail = _head;
+    _cursor = 0xFF;
+    _strobe_pending = false;
+    TWCR = TWCR_STOP;
+    _busy = false;
+  }
+}
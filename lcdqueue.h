@@ -0,0 +1,92 @@
+#ifndef BW_LCDQUEUE_H_
+#define BW_LCDQUEUE_H_
+
+#include "Arduino.h"
+#include "brauwerkstatt.h"
+
+/*
+ * Interrupt driven output queue for the HD44780 LCD behind the PCF8574 I2C backpack.
+ *
+ * Every byte for the LCD is split into two queue entries, one per nibble, which already
+ * carry the RS bit of the expander. The TWI interrupt drains the queue in the background
+ * and strobes EN for each nibble, so writing a character costs the main loop a few
+ * microseconds instead of a blocking Wire transaction.
+ *
+ * This class replaces LiquidCrystal_I2C: Wire would claim the TWI interrupt vector as well.
+ */
+class LcdQueue
+{
+public:
+  LcdQueue(byte address);
+
+  /*
+   * set up TWI and run the HD44780 4-bit init sequence
+   * blocks until the sequence has been sent, so only call this from setup()
+   */
+  void init();
+
+  void backlight();
+  void noBacklight();
+
+  /*
+   * clear display and move cursor home
+   * the LCD needs ~1.6ms to execute this, the queue pads the bus accordingly
+   */
+  void clear();
+
+  /*
+   * move the cursor, no command is queued if the cursor is already there
+   */
+  void setCursor(byte col, byte row);
+
+  void print(char c);
+
+  /*
+   * number of LCD bytes (characters or commands) that can be queued without blocking
+   * use this for back-pressure: writes on a full queue wait for the interrupt
+   */
+  byte room();
+
+  /*
+   * true when everything queued so far has been sent to the display, i.e. the frame is complete
+   */
+  bool idle();
+
+  /*
+   * number of bus errors (missing ACK, lost arbitration) since startup
+   * queued output is lost on an error, the caller has to redraw the display when this advances
+   */
+  unsigned int errors() { return _errors; };
+
+  /*
+   * the TWI service routine, which is called from the TWI interrupt
+   */
+  void service();
+
+private:
+  byte _address;
+  byte _backlight;
+
+  // DDRAM address the LCD cursor is at, 0xFF if unknown, reset by the ISR on a bus error
+  volatile byte _cursor;
+
+  volatile byte _queue[LCD_QUEUE_SIZE];
+  volatile byte _head = 0; // written by main loop only
+  volatile byte _tail = 0; // written by ISR only
+  volatile bool _busy = false;
+
+  // second half of the EN strobe for the nibble on the bus
+  volatile byte _strobe_byte;
+  volatile bool _strobe_pending = false;
+
+  volatile unsigned int _errors = 0;
+
+  void command(byte value);
+  void write(byte value, byte mode);
+  void push_nibble(byte nibble, byte mode);
+  void push_pad(byte count);
+  void push(byte entry);
+  void kick();
+};
+
+#endif /* BW_LCDQUEUE_H_ */
@@ -0,0 +1,124 @@
+#include <util/atomic.h>
+
+#include "log.h"
+#include "telemetry.h"
+
+#define LOG_MASK (LOG_BUFFER_SIZE - 1)
+
+static_assert(LOG_BUFFER_SIZE <= 128 && (LOG_BUFFER_SIZE & LOG_MASK) == 0, "LOG_BUFFER_SIZE must be a power of 2 <= 128");
+
+static byte log_buffer[LOG_BUFFER_SIZE];
+static volatile byte log_head = 0; // next byte to write
+static volatile byte log_tail = 0; // next byte to send
+static unsigned long log_last_ms = 0;
+static unsigned int log_dropped = 0;
+
+static byte put_varint(byte* p, unsigned long v)
+{
+  byte n = 0;
+  while (v >= 0x80)
+  {
+    p[n++] = (v & 0x7F) | 0x80;
+    v >>= 7;
+  }
+  p[n++] = v;
+  return n;
+}
+
+bool log_record(byte id, byte argc, const long* args)
+{
+  byte rec[LOG_MAX_RECORD];
+  byte n = 1;
+  rec[0] = argc << 6 | id;
+
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+  {
+    unsigned long now = millis();
+    n += put_varint(rec + n, now - log_last_ms);
+    for (byte i = 0; i < argc; i++)
+    {
+      n += put_varint(rec + n, ((unsigned long)args[i] << 1) ^ (unsigned long)(args[i] >> 31));
+    }
+
+    if ((byte)(LOG_BUFFER_SIZE - (byte)(log_head - log_tail)) < n)
+    {
+      log_dropped++;
+      return false;
+    }
+    for (byte i = 0; i < n; i++)
+    {
+      log_buffer[(log_head + i) & LOG_MASK] = rec[i];
+    }
+    log_head += n;
+    // only advanced for records that made it, so the time deltas stay consistent
+    log_last_ms = now;
+  }
+  return true;
+}
+
+/*
+ * length of the record starting at ring position pos
+ */
+static byte record_length(byte pos)
+{
+  byte argc = log_buffer[pos & LOG_MASK] >> 6;
+  byte n = 1;
+  // time delta plus arguments, each ends with a byte without the continuation bit
+  for (byte v = 0; v <= argc; v++)
+  {
+    while (log_buffer[(pos + n++) & LOG_MASK] & 0x80);
+  }
+  return n;
+}
+
+bool log_flush()
+{
+  // only as many records as fit into the TX buffer with the frame overhead
+  int room = Serial.availableForWrite() - (TELEMETRY_MAX_FRAME - TELEMETRY_MAX_PAYLOAD);
+  byte max_len = constrain(room, 0, TELEMETRY_MAX_PAYLOAD);
+
+  byte payload[TELEMETRY_MAX_PAYLOAD];
+  byte n = 0;
+  byte head = log_head;
+  byte pos = log_tail;
+  while (pos != head)
+  {
+    byte len = record_length(pos);
+    if (n + len > max_len)
+    {
+      break;
+    }
+    for (byte i = 0; i < len; i++)
+    {
+      payload[n++] = log_buffer[(pos + i) & LOG_MASK];
+    }
+    pos += len;
+  }
+
+  if (n == 0 || !Telemetry::send(TELEMETRY_MSG_LOG, payload, n))
+  {
+    return false;
+  }
+  log_tail = pos;
+
+  // report dropped records now that there is room again
+  unsigned int dropped;
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+  {
+    dropped = log_dropped;
+    log_dropped = 0;
+  }
+  if (dropped > 0)
+  {
+    long arg = dropped;
+    if (!log_record(LogDropped, 1, &arg))
+    {
+      // counted itself as dropped, keep the original count
+      ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+      {
+        log_dropped += dropped - 1;
+      }
+    }
+  }
+  return true;
+}
@@ -0,0 +1,56 @@
+#ifndef BW_LOG_H_
+#define BW_LOG_H_
+
+#include "Arduino.h"
+#include "brauwerkstatt.h"
+#include "logmsg.h"
+
+/*
+ * Tokenized, deferred logging
+ *
+ * log_error() .. log_debug() write a message id from logmsg.h and up to LOG_MAX_ARGS integer
+ * arguments as a few bytes into a RAM ring buffer, they never touch Serial. log_flush() sends
+ * the buffered records as TELEMETRY_MSG_LOG frames when the TX buffer has room, it is called
+ * from the loop when no task is due. tools/bwlog turns the records back into text.
+ * A record that does not fit into the ring buffer is dropped, the number of dropped records
+ * is logged as soon as there is room again.
+ *
+ * Each module sets its level before including this file:
+ *   #define LOG_LEVEL LOG_LEVEL_PROC
+ *   #include "log.h"
+ * Calls above the level of the module are removed at compile time, arguments included.
+ */
+#define LOG_OFF 0
+#define LOG_ERROR 1
+#define LOG_WARN 2
+#define LOG_INFO 3
+#define LOG_DEBUG 4
+
+#ifndef LOG_LEVEL
+#define LOG_LEVEL LOG_WARN
+#endif
+
+#define LOG_AT(level, ...) do { if ((level) <= LOG_LEVEL) log_write(__VA_ARGS__); } while (0)
+#define log_error(...) LOG_AT(LOG_ERROR, __VA_ARGS__)
+#define log_warn(...) LOG_AT(LOG_WARN, __VA_ARGS__)
+#define log_info(...) LOG_AT(LOG_INFO, __VA_ARGS__)
+#define log_debug(...) LOG_AT(LOG_DEBUG, __VA_ARGS__)
+
+/*
+ * append a record to the ring buffer, safe to call from interrupts
+ * returns false if the record was dropped
+ */
+bool log_record(byte id, byte argc, const long* args);
+
+inline void log_write(byte id) { log_record(id, 0, NULL); }
+inline void log_write(byte id, long a) { log_record(id, 1, &a); }
+inline void log_write(byte id, long a, long b) { long args[] = { a, b }; log_record(id, 2, args); }
+inline void log_write(byte id, long a, long b, long c) { long args[] = { a, b, c }; log_record(id, 3, args); }
+
+/*
+ * send one frame of buffered records, if the TX buffer has room for it
+ * returns false if there was nothing to send or no room
+ */
+bool log_flush();
+
+#endif /* BW_LOG_H_ */
@@ -0,0 +1,77 @@
+#ifndef BW_LOGMSG_H_
+#define BW_LOGMSG_H_
+
+/*
+ * Log message table
+ *
+ * X(id, german text, english text)
+ * The firmware only uses the ids, the texts are expanded on the host (tools/bwlog). Arguments
+ * are integers, the placeholders in the texts are
+ *   %d  decimal
+ *   %x  hex
+ *   %c  character
+ *   %T  temperature in 1/100 C
+ * New messages are appended at the end, so logs of older firmware can still be read.
+ * This file is plain C++ and shared with the host tools in tools/.
+ */
+#define LOG_MESSAGES(X) \
+  X(LogStartup, "Start, Version %d", "startup, version %d") \
+  X(LogDropped, "%d Meldungen verworfen", "%d messages dropped") \
+  X(LogError, "Fehler %d", "error %d") \
+  X(LogWarning, "Warnung %d", "warning %d") \
+  X(LogMashStarted, "Maischen initialisiert", "mashing started") \
+  X(LogSpargeStarted, "Nachguss initialisiert", "sparge heating started") \
+  X(LogAlreadyRunning, "Prozess laeuft bereits", "process already running") \
+  X(LogNoReceipe, "Rezept nicht geladen", "receipe not loaded") \
+  X(LogReceipeKeyTooLong, "Rezept: Schluessel zu lang", "receipe: key too long") \
+  X(LogReceipeValueTooLong, "Rezept: Wert zu lang", "receipe: value too long") \
+  X(LogReceipeNoEquals, "Rezept: = fehlt", "receipe: = missing") \
+  X(LogInvalidPhase, "Ungueltige Phase %d", "invalid phase %d") \
+  X(LogInvalidStep, "Ungueltiger Step %d in Phase %d", "invalid step %d in phase %d") \
+  X(LogMashInTempReached, "Einmaischtemperatur erreicht", "mash-in temperature reached") \
+  X(LogRestTempReached, "Rasttemperatur erreicht, Rast %d", "rest temperature reached, rest %d") \
+  X(LogRestEnd, "Ende Rast %d", "end of rest %d") \
+  X(LogSpargeTempReached, "Nachguss-Temperatur erreicht", "sparge temperature reached") \
+  X(LogUserConfirmed, "User hat bestaetigt", "user confirmed") \
+  X(LogBogusReading, "Ungueltiger Messwert %T", "bogus reading %T") \
+  X(LogNoTempSensor, "Kein Temperatursensor gefunden", "no temperature sensor found") \
+  X(LogEepromRead, "Status aus EEPROM gelesen", "state read from EEPROM") \
+  X(LogEepromUpdate, "EEPROM wird aktualisiert", "updating EEPROM") \
+  X(LogEepromVerify, "EEPROM-Fehler an %d: erwartet %x, gelesen %x", "EEPROM error at %d: expected %x, read %x") \
+  X(LogEepromWrite, "%d Bytes in %d ms geschrieben, %d geaendert", "wrote %d bytes in %d ms, %d changed") \
+  X(LogStatePhase, "Status: Phase %d, Step %d, Rast %d", "state: phase %d, step %d, rest %d") \
+  X(LogStateTimes, "Status: Start %d, Phase %d, Rast %d", "state: start %d, phase %d, rest %d") \
+  X(LogStateTarget, "Status: Ziel %T, Bestaetigung %d, laeuft %d", "state: target %T, confirmation %d, running %d") \
+  X(LogMenuSelect, "Menuepunkt %d gewaehlt", "menu item %d selected") \
+  X(LogSerialChar, "Zeichen von Serial: %c", "char from serial: %c") \
+  X(LogEncoderHold, "Taste gehalten", "button held") \
+  X(LogStackLow, "Nur noch %d Bytes zwischen Heap und Stack", "only %d bytes left between heap and stack") \
+  X(LogHeatRate, "Heizrate %d mK/min", "heating rate %d mK/min") \
+  X(LogPreheat, "Vorheizen auf %T", "preheating towards %T") \
+  X(LogTempReached, "Temperatur %T erreicht, Schritt %d", "temperature %T reached, step %d") \
+  X(LogAlarm, "Alarm in Schritt %d", "alarm in step %d") \
+  X(LogProgramError, "Programmfehler in Schritt %d: Opcode %d", "program error in step %d: opcode %d") \
+  X(LogReceipeTooLong, "Rezept: kein Platz nach %d Bytes", "receipe: no room after %d bytes") \
+  X(LogBoilStarted, "Kochen initialisiert", "boiling started") \
+  X(LogHopAddition, "Hopfengabe %d (%d min)", "hop addition %d (%d min)") \
+  X(LogBoilDetected, "Kochen erkannt bei %T (%d mK/min)", "boil detected at %T (%d mK/min)") \
+  X(LogCooled, "Auf %T gekuehlt nach %d min", "cooled down to %T after %d min") \
+  X(LogRampEnd, "Rampe: %d statt %d mK/min, max. Abweichung %T", "ramp: %d of %d mK/min, max. deviation %T")
+
+#define LOG_MESSAGE_ID(id, de, en) id,
+enum LogMessage { LOG_MESSAGES(LOG_MESSAGE_ID) LogMessageCount };
+#undef LOG_MESSAGE_ID
+
+/*
+ * Log record, TELEMETRY_MSG_LOG frames carry one or more of them
+ *   header          argument count << 6 | message id
+ *   varint          ms since the previous record
+ *   varint * count  zigzag encoded arguments
+ * varints are little endian base 128
+ */
+#define LOG_MAX_ARGS 3
+#define LOG_MAX_RECORD (1 + 5 + LOG_MAX_ARGS * 5)
+
+static_assert(LogMessageCount <= 64, "log message ids must fit into 6 bits");
+
+#endif /* BW_LOGMSG_H_ */
@@ -0,0 +1,95 @@
+#include "memstat.h"
+
+#define LOG_LEVEL LOG_LEVEL_MAIN
+#include "log.h"
+
+// linker and avr-libc malloc symbols
+extern "C" {
+extern uint8_t __data_start;
+extern uint8_t __bss_end;
+extern uint8_t __heap_start;
+extern char* __brkval; // end of the heap, 0 until the first malloc()
+}
+
+static uint8_t* mem_stack_low = (uint8_t*)RAMEND + 1; // lowest address the stack has reached
+static uint8_t* mem_scan_pos = NULL;
+
+/*
+ * paint the free RAM, runs in .init3: the stack pointer is set up, .bss is not yet cleared
+ * and no constructor has run, so nothing but this function is on the stack
+ * naked: no prologue and no ret, the startup code just runs on into .init4
+ */
+void mem_paint() __attribute__((naked, used, section(".init3")));
+void mem_paint()
+{
+  for (uint8_t* p = &__heap_start; p <= (uint8_t*)RAMEND; p++)
+  {
+    *p = MEM_CANARY;
+  }
+}
+
+static uint8_t* heap_end()
+{
+  return __brkval != NULL ? (uint8_t*)__brkval : &__heap_start;
+}
+
+void mem_scan()
+{
+  uint8_t* end = heap_end();
+  if (mem_scan_pos < end || mem_scan_pos >= mem_stack_low)
+  {
+    mem_scan_pos = end;
+  }
+  for (byte n = 0; n < MEM_SCAN_BYTES && mem_scan_pos < mem_stack_low; n++, mem_scan_pos++)
+  {
+    if (*mem_scan_pos != MEM_CANARY)
+    {
+      // the stack has been down here, and it only ever grows downwards
+      // (a stack byte that happens to equal MEM_CANARY makes the result a bit too optimistic)
+      mem_stack_low = mem_scan_pos;
+      unsigned int headroom = mem_stack_low - end;
+      if (headroom < MEM_HEADROOM_WARN)
+      {
+        log_warn(LogStackLow, headroom);
+      }
+      return;
+    }
+  }
+}
+
+void mem_stat(mem_stat_t& stat)
+{
+  uint8_t* end = heap_end();
+  stat.static_size = &__bss_end - &__data_start;
+  stat.heap_size = end - &__heap_start;
+  stat.free_now = (uint8_t*)SP - end;
+  stat.stack_max = (uint8_t*)RAMEND + 1 - mem_stack_low;
+  stat.headroom = mem_stack_low - end;
+}
+
+void mem_report()
+{
+  mem_stat_t stat;
+  mem_stat(stat);
+  Serial.println(F("static heap free stack_max headroom"));
+  Serial.print(stat.static_size);
+  Serial.print(' ');
+  Serial.print(stat.heap_size);
+  Serial.print(' ');
+  Serial.print(stat.free_now);
+  Serial.print(' ');
+  Serial.print(stat.stack_max);
+  Serial.print(' ');
+  Serial.println(stat.headroom);
+
+  Serial.println(F("object size budget"));
+  for (byte i = 0; i < MEM_OBJECT_COUNT; i++)
+  {
+    const mem_object_t* o = &MEM_OBJECTS[i];
+    Serial.print((const __FlashStringHelper*)o->name);
+    Serial.print(' ');
+    Serial.print(pgm_read_word(&o->size));
+    Serial.print(' ');
+    Serial.println(pgm_read_word(&o->budget));
+  }
+}
@@ -0,0 +1,55 @@
+#ifndef BW_MEMSTAT_H_
+#define BW_MEMSTAT_H_
+
+#include "Arduino.h"
+#include "brauwerkstatt.h"
+
+/*
+ * SRAM instrumentation
+ *
+ * SRAM layout of the ATmega328P, from low to high addresses:
+ *   .data | .bss | heap (grows up) -> free <- stack (grows down) | RAMEND
+ * At startup, before any constructor runs, the free space between the end of .bss and RAMEND
+ * is painted with MEM_CANARY. mem_scan() is called in idle time and searches the painted
+ * area from the heap end upwards: the first overwritten byte is the deepest the stack has
+ * ever been. The bytes between the heap end and that point are the headroom that is left.
+ * The scan covers at most MEM_SCAN_BYTES per call, so it never delays a task noticeably.
+ */
+#define MEM_CANARY 0xC5
+
+struct mem_stat_t {
+  unsigned int static_size; // .data + .bss
+  unsigned int heap_size; // allocated by malloc()/new, including free list
+  unsigned int free_now; // between the heap end and the current stack pointer
+  unsigned int stack_max; // deepest stack usage since startup
+  unsigned int headroom; // smallest gap between the heap end and the stack since startup
+};
+
+/*
+ * static RAM of one global object, the table MEM_OBJECTS is defined in brauwerkstatt.ino
+ */
+struct mem_object_t {
+  char name[14];
+  unsigned int size;
+  unsigned int budget;
+};
+
+extern const mem_object_t MEM_OBJECTS[];
+extern const byte MEM_OBJECT_COUNT;
+
+/*
+ * continue the high water mark scan, logs a warning if the headroom falls below MEM_HEADROOM_WARN
+ */
+void mem_scan();
+
+/*
+ * current memory usage, the stack values are as up to date as the last complete scan
+ */
+void mem_stat(mem_stat_t& stat);
+
+/*
+ * print mem_stat() and the size of the objects in MEM_OBJECTS to Serial
+ */
+void mem_report();
+
+#endif /* BW_MEMSTAT_H_ */
@@ -0,0 +1,98 @@
+#include "perf.h"
+
+#ifdef PERF_PROBES
+
+struct latency_hist_t {
+  unsigned int buckets[PERF_BUCKETS];
+  unsigned long max_us;
+  unsigned long max_ever_us;
+};
+
+static latency_hist_t perf_hist[PerfProbeCount];
+
+static const char perf_name_loop[] PROGMEM = "loop";
+static const char perf_name_read_temp[] PROGMEM = "read_temp_sensor";
+static const char perf_name_heater[] PROGMEM = "update_heater";
+static const char perf_name_eeprom[] PROGMEM = "update_eeprom";
+static const char perf_name_ui[] PROGMEM = "update_ui";
+static const char perf_name_update_line[] PROGMEM = "update_line";
+
+static const char* const perf_names[PerfProbeCount] PROGMEM = {
+  perf_name_loop,
+  perf_name_read_temp,
+  perf_name_heater,
+  perf_name_eeprom,
+  perf_name_ui,
+  perf_name_update_line
+};
+
+void perf_record(byte probe, unsigned long us)
+{
+  latency_hist_t* h = &perf_hist[probe];
+
+  byte bucket = 0;
+  for (unsigned long v = us; v > 0 && bucket < PERF_BUCKETS - 1; v >>= 1)
+  {
+    bucket++;
+  }
+  if (h->buckets[bucket] < 0xFFFF)
+  {
+    h->buckets[bucket]++;
+  }
+
+  if (us > h->max_us)
+  {
+    h->max_us = us;
+  }
+  if (us > h->max_ever_us)
+  {
+    h->max_ever_us = us;
+  }
+}
+
+void perf_dump()
+{
+  for (byte p = 0; p < PerfProbeCount; p++)
+  {
+    latency_hist_t* h = &perf_hist[p];
+    Serial.print((const __FlashStringHelper*)pgm_read_ptr(&perf_names[p]));
+    Serial.print(F(" max "));
+    Serial.print(h->max_us);
+    Serial.print(F("us, ever "));
+    Serial.print(h->max_ever_us);
+    Serial.println(F("us"));
+    // only non-empty buckets, as "<upper bound in us>:count"
+    for (byte b = 0; b < PERF_BUCKETS; b++)
+    {
+      if (h->buckets[b] == 0)
+      {
+        continue;
+      }
+      Serial.print(' ');
+      if (b == PERF_BUCKETS - 1)
+      {
+        Serial.print('>');
+        Serial.print(1UL << (b - 1));
+      }
+      else
+      {
+        Serial.print('<');
+        Serial.print(1UL << b);
+      }
+      Serial.print(':');
+      Serial.print(h->buckets[b]);
+    }
+    Serial.println();
+  }
+}
+
+void perf_reset()
+{
+  for (byte p = 0; p < PerfProbeCount; p++)
+  {
+    memset(perf_hist[p].buckets, 0, sizeof(perf_hist[p].buckets));
+    perf_hist[p].max_us = 0;
+  }
+}
+
+#endif /* PERF_PROBES */
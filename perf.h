@@ -0,0 +1,63 @@
+#ifndef BW_PERF_H_
+#define BW_PERF_H_
+
+#include "Arduino.h"
+#include "brauwerkstatt.h"
+
+/*
+ * Latency instrumentation for the hot paths
+ *
+ * Every probe keeps a histogram of execution times with log2 buckets (bucket b counts
+ * durations of 2^(b-1) to 2^b - 1 us, the last bucket everything above) and the max ever seen.
+ * Only compiled with PERF_PROBES, otherwise PERF_SCOPE() expands to nothing.
+ */
+enum PerfProbe {
+  PerfLoop,
+  PerfReadTemp,
+  PerfHeater,
+  PerfEeprom,
+  PerfUi,
+  PerfUpdateLine,
+  PerfProbeCount
+};
+
+#ifdef PERF_PROBES
+
+/*
+ * add one measurement to the histogram of a probe
+ */
+void perf_record(byte probe, unsigned long us);
+
+/*
+ * print all histograms to Serial
+ */
+void perf_dump();
+
+/*
+ * clear the histograms, max ever values are kept
+ */
+void perf_reset();
+
+/*
+ * measures the time until it goes out of scope
+ */
+class PerfScope
+{
+public:
+  PerfScope(byte probe) : _probe(probe), _start(micros()) {};
+  ~PerfScope() { perf_record(_probe, micros() - _start); };
+
+private:
+  byte _probe;
+  unsigned long _start;
+};
+
+#define PERF_SCOPE(probe) PerfScope perf_scope_(probe)
+
+#else
+
+#define PERF_SCOPE(probe)
+
+#endif /* PERF_PROBES */
+
+#endif /* BW_PERF_H_ */
@@ -0,0 +1,301 @@
+#include <Time.h>
+
+#include "planner.h"
+#include "telemetry.h"
+
+Planner::Planner(BrewProcess* brew_proc)
+{
+  _brew_process = brew_proc;
+}
+
+void Planner::update()
+{
+  if (!_brew_process->isMashRunning())
+  {
+    _count = 0;
+    return;
+  }
+
+  // the timeline only changes with a new process or a different heating rate
+  float rate = _brew_process->heatRate();
+  if (_count == 0 || _brew_process->procStart() != _process_start ||
+      rate > _rate * 1.1F || rate < _rate * 0.9F)
+  {
+    rebuild();
+  }
+
+  byte current = find_current();
+  if (current != _current)
+  {
+    _current = current;
+    _segment_start = now();
+    _send_pos = 0;
+  }
+  _remaining = estimate_remaining();
+}
+
+void Planner::rebuild()
+{
+  _process_start = _brew_process->procStart();
+  _rate = _brew_process->heatRate();
+  _count = 0;
+  _end = 0;
+  _boil = 0;
+
+  // one segment per step with a duration, in program order as find_current() expects
+  const byte* program = _brew_process->program();
+  byte start = _brew_process->programStart();
+  float temp = _brew_process->getCurrentTemp();
+  byte phase = BrewProcess::MashIn;
+  byte rest = 0;
+  byte prompts = 0;
+  for (byte pc = start; pc < PROGRAM_SIZE && program[pc] != OpEnd; pc += program_op_length(program[pc]))
+  {
+    const byte* op = &program[pc];
+    switch (op[0])
+    {
+    case OpPhase:
+      phase = op[1];
+      rest = 0;
+      break;
+    case OpHeatTo:
+    case OpRamp:
+      if (phase == BrewProcess::Rest) rest++;
+      add(PlanHeat, rest, pc, max(heat_seconds(temp, op[1]), program_op_seconds(op)));
+      temp = op[1];
+      break;
+    case OpHoldFor:
+      add(PlanHold, rest, pc, program_op_seconds(op));
+      break;
+    case OpPrompt:
+      add(PlanPrompt, prompts++, pc, PLAN_PROMPT_SECONDS);
+      break;
+    case OpBoil:
+      add(PlanBoilHeat, 0, pc, heat_seconds(temp, _brew_process->cookTemp()));
+      _boil = _count;
+      add(PlanBoil, 0, pc, program_op_seconds(op));
+      temp = _brew_process->cookTemp();
+      break;
+    case OpCool:
+      add(PlanCool, 0, pc, PLAN_COOL_SECONDS);
+      break;
+    default:
+      break;
+    }
+  }
+  // the mash is followed by lautering, the boil and the cooling
+  if (start == 0 && _boil == 0)
+  {
+    add(PlanLauter, 0, 0xFF, PLAN_LAUTER_SECONDS);
+    add(PlanBoilHeat, 0, 0xFF, heat_seconds(temp, _brew_process->cookTemp()));
+    _boil = _count;
+    add(PlanBoil, 0, 0xFF, _brew_process->boilDuration() * 60UL);
+    if (_brew_process->pitchTemp() > 0)
+    {
+      add(PlanCool, 0, 0xFF, PLAN_COOL_SECONDS);
+    }
+  }
+
+  _current = find_current();
+  _segment_start = now();
+  _send_pos = 0;
+}
+
+void Planner::add(byte type, byte index, byte pc, unsigned long duration)
+{
+  if (_count >= PLAN_MAX_SEGMENTS)
+  {
+    return;
+  }
+  segment_t* s = &_segments[_count];
+  s->type = type;
+  s->index = index;
+  s->pc = pc;
+  s->start = _end;
+  _end = min(_end + duration, 0xFFFFUL);
+  _count++;
+}
+
+/*
+ * segment of the step at the program counter: the last one that starts at or before it
+ * the search goes on from the current segment, the program only moves forward
+ */
+byte Planner::find_current()
+{
+  byte pc = _brew_process->programCounter();
+  byte seg = _current < _count && _segments[_current].pc <= pc ? _current : 0;
+  while (seg + 1 < _count && _segments[seg + 1].pc <= pc)
+  {
+    seg++;
+  }
+  // heating up and boiling are one step of the program
+  if (_segments[seg].type == PlanBoil && _brew_process->getStep() != BrewProcess::Boiling)
+  {
+    seg--;
+  }
+  return seg;
+}
+
+unsigned long Planner::heat_seconds(float from, float to)
+{
+  if (to <= from || _rate <= 0)
+  {
+    return 0;
+  }
+  return (to - from) / _rate;
+}
+
+/*
+ * seconds left in the current segment
+ * heating from the temperature and the rate, rests from the rest timer, everything else
+ * from its estimate and the time already spent in it (0 once it takes longer)
+ */
+unsigned long Planner::estimate_remaining()
+{
+  switch (_segments[_current].type)
+  {
+  case PlanHeat:
+  case PlanBoilHeat:
+    // a ramp takes at least its time
+    return max(heat_seconds(_brew_process->getCurrentTemp(), _brew_process->getTargetTemp()), _brew_process->phaseRest());
+  case PlanHold:
+  case PlanBoil:
+    return _brew_process->phaseRest();
+  case PlanCool:
+    // predicted from the cooling curve, once there are enough samples
+    if (_brew_process->phaseRest() > 0)
+    {
+      return _brew_process->phaseRest();
+    }
+    // fall through
+  default:
+    unsigned long spent = now() - _segment_start;
+    unsigned int d = duration(_current);
+    return spent < d ? d - spent : 0;
+  }
+}
+
+/*
+ * offset of the start of a segment from the start of the first one, seg == _count is the end
+ */
+unsigned int Planner::offset(byte seg)
+{
+  return seg < _count ? _segments[seg].start : _end;
+}
+
+unsigned long Planner::etaSegment(byte seg)
+{
+  if (seg <= _current)
+  {
+    return _segment_start;
+  }
+  return now() + _remaining + offset(seg) - offset(_current + 1);
+}
+
+// ====================================================
+// output
+// ====================================================
+byte Planner::numEntries()
+{
+  // segments from the current one, hop additions if there is a boil, end
+  return _count - _current + numHops() + 1;
+}
+
+void Planner::entry(byte i, byte& type, byte& index, unsigned long& eta)
+{
+  byte segments = _count - _current;
+  if (i < segments)
+  {
+    type = _segments[_current + i].type;
+    index = _segments[_current + i].index;
+    eta = etaSegment(_current + i);
+    return;
+  }
+  i -= segments;
+  if (i < numHops())
+  {
+    type = PlanHop;
+    index = i;
+    unsigned int t = _brew_process->hopTime(i);
+    if (t == HOP_ADD_FIRST_WORT)
+    {
+      eta = etaSegment(_boil >= 2 ? _boil - 2 : 0); // lautering
+    }
+    else if (t == HOP_ADD_WHIRLPOOL)
+    {
+      eta = etaSegment(_boil + 1); // end of boil
+    }
+    else
+    {
+      unsigned int boil = _brew_process->boilDuration();
+      eta = etaSegment(_boil) + (t < boil ? boil - t : 0) * 60UL;
+    }
+    return;
+  }
+  type = PlanEnd;
+  index = 0;
+  eta = etaSegment(_count);
+}
+
+void Planner::print()
+{
+  if (!active())
+  {
+    return;
+  }
+  for (byte i = 0; i < numEntries(); i++)
+  {
+    byte type, index;
+    unsigned long eta;
+    entry(i, type, index, eta);
+    Serial.print(eta);
+    Serial.print(' ');
+    Serial.print(type);
+    Serial.print(' ');
+    Serial.println(index);
+  }
+}
+
+void Planner::send()
+{
+  if (!active())
+  {
+    return;
+  }
+  if (_send_pos == 0xFF)
+  {
+    if (now() - _last_sent < PLAN_SEND_PERIOD)
+    {
+      return;
+    }
+    _send_pos = 0;
+  }
+
+  telemetry_plan_t rec;
+  rec.now = now();
+  rec.first = _send_pos;
+  rec.total = numEntries();
+  byte n = 0;
+  for (; n < TELEMETRY_PLAN_ENTRIES && _send_pos + n < rec.total; n++)
+  {
+    byte type, index;
+    unsigned long eta;
+    entry(_send_pos + n, type, index, eta);
+    rec.entries[n].type = type;
+    rec.entries[n].index = index;
+    rec.entries[n].eta = eta;
+  }
+
+  // no room in the TX buffer: try again with the next call
+  byte len = sizeof(rec) - sizeof(rec.entries) + n * sizeof(telemetry_plan_entry_t);
+  if (!Telemetry::send(TELEMETRY_MSG_PLAN, &rec, len))
+  {
+    return;
+  }
+  _send_pos += n;
+  if (_send_pos >= rec.total)
+  {
+    _send_pos = 0xFF;
+    _last_sent = now();
+  }
+}
@@ -0,0 +1,103 @@
+#ifndef BW_PLANNER_H_
+#define BW_PLANNER_H_
+
+#include "Arduino.h"
+#include "brauwerkstatt.h"
+#include "brewproc.h"
+
+// mash-in, dough-in, one per step of the receipe (at least two bytes each), mash-out,
+// lautering, heating to boil, boil, cooling
+#define PLAN_MAX_SEGMENTS (2 + (PROGRAM_SIZE - PROGRAM_HEADER - PROGRAM_TAIL) / 2 + 5)
+
+/*
+ * Brew day timeline
+ *
+ * The program of the running process (program.h) is laid out as a list of segments (heat up,
+ * hold, prompt, ...) with an estimated duration each, branches are assumed not to be taken.
+ * Heating durations come from the heating rate, measured or configured
+ * (BrewProcess::heatRate()), prompts, lautering and cooling from PLAN_PROMPT_SECONDS,
+ * PLAN_LAUTER_SECONDS and PLAN_COOL_SECONDS. The list and the start offsets of all segments are
+ * only rebuilt when a new process starts or the heating rate has changed noticeably. update()
+ * runs with every control tick and only re-estimates the rest of the current segment, the
+ * cooling from the fitted cooling curve, all later ETAs move along with it.
+ * After the mash program come lautering, the boil and the cooling, hop additions are placed
+ * relative to the boil.
+ */
+class Planner
+{
+public:
+  // PlanHop and PlanEnd (end of the process) only appear as entries of the timeline, not as segments
+  enum SegmentType { PlanHeat, PlanHold, PlanPrompt, PlanLauter, PlanBoilHeat, PlanBoil, PlanCool, PlanHop, PlanEnd };
+
+  Planner(BrewProcess* brew_proc);
+
+  /*
+   * follow the process, called after BrewProcess::update_control()
+   */
+  void update();
+
+  /*
+   * false if no mash process is running, there is no timeline then
+   */
+  bool active() { return _count > 0; };
+
+  /*
+   * controller clock (seconds) at which the current step ends and the next one begins
+   */
+  unsigned long nextEta() { return etaSegment(_current + 1); };
+
+  /*
+   * print the remaining timeline to Serial, one "eta type index" line per entry, starting with
+   * the current segment, eta is the controller clock in seconds
+   * index: heat and hold 0 for mash-in, n for rest n; prompt 0 for dough-in, then counting up
+   * (1 for mash-out without further prompts); hop addition 0-based number
+   */
+  void print();
+
+  /*
+   * send the remaining timeline as TELEMETRY_MSG_PLAN frames, one frame per call
+   * a new timeline is sent when it has changed, otherwise every PLAN_SEND_PERIOD seconds
+   */
+  void send();
+
+private:
+  struct segment_t {
+    byte type; // SegmentType
+    byte index; // see print()
+    byte pc; // of the step in the program, 0xFF after its end
+    unsigned int start; // sum of the estimated durations of all segments before, saturates at 0xFFFF
+  };
+
+  BrewProcess* _brew_process;
+
+  segment_t _segments[PLAN_MAX_SEGMENTS];
+  byte _count = 0;
+  byte _current = 0; // segment the process is in
+  byte _boil = 0; // index of the boil segment, 0 if there is none
+  unsigned int _end = 0; // offset of the end of the last segment
+
+  // what the timeline was built for
+  unsigned long _process_start = 0;
+  float _rate = 0;
+
+  unsigned long _segment_start; // controller clock when the current segment was entered
+  unsigned long _remaining; // estimated seconds left in the current segment
+
+  byte _send_pos = 0xFF; // next entry to send, 0xFF when nothing is pending
+  unsigned long _last_sent = 0;
+
+  void rebuild();
+  void add(byte type, byte index, byte pc, unsigned long duration);
+  unsigned int duration(byte seg) { return offset(seg + 1) - offset(seg); };
+  byte find_current();
+  unsigned long heat_seconds(float from, float to);
+  unsigned long estimate_remaining();
+
+  byte numEntries();
+  byte numHops() { return _boil > 0 ? _brew_process->numHopAdditions() : 0; };
+  void entry(byte i, byte& type, byte& index, unsigned long& eta);
+  unsigned int offset(byte seg);
+  unsigned long etaSegment(byte seg);
+};
+
+#endif /* BW_PLANNER_H_ */
@@ -0,0 +1,44 @@
+#include "program.h"
+
+// in the order of Opcode
+static const byte PROGRAM_OP_LENGTH[OpCount] PROGMEM = { 1, 2, 2, 2, 3, 2, 2, 2, 3, 2 };
+
+byte program_op_length(byte op)
+{
+  return op < OpCount ? pgm_read_byte(&PROGRAM_OP_LENGTH[op]) : 1;
+}
+
+unsigned long program_op_seconds(const byte* op)
+{
+  switch (op[0])
+  {
+  case OpHoldFor:
+  case OpBoil:
+    return op[1] * 60UL;
+  case OpRamp:
+    return op[2] * 60UL;
+  default:
+    return 0;
+  }
+}
+
+byte program_skip(const byte* program, byte pc, byte steps)
+{
+  for (; steps > 0 && pc < PROGRAM_SIZE && program[pc] != OpEnd; steps--)
+  {
+    pc += program_op_length(program[pc]);
+  }
+  return pc;
+}
+
+float program_next_temp(const byte* program, byte pc)
+{
+  for (pc = program_skip(program, pc, 1); pc < PROGRAM_SIZE && program[pc] != OpEnd; pc += program_op_length(program[pc]))
+  {
+    if (program[pc] == OpHeatTo || program[pc] == OpRamp)
+    {
+      return program[pc + 1];
+    }
+  }
+  return -1;
+}
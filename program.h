@@ -0,0 +1,62 @@
+#ifndef BW_PROGRAM_H_
+#define BW_PROGRAM_H_
+
+#include "Arduino.h"
+
+/*
+ * Brew program
+ *
+ * A process is a flat byte array of steps, each an opcode followed by its operands (one byte
+ * each). BrewProcess runs it with one handler per opcode and keeps the program counter in the
+ * EEPROM checkpoint. Temperatures are in C, durations in minutes.
+ *
+ *   opcode         operands        step
+ *   OpEnd          -               end of the process
+ *   OpPhase        phase           start a phase (BrewProcess::Phase), no target temperature
+ *   OpHeatTo       temp            heat up to temp, counts as the next rest
+ *   OpHoldFor      minutes         hold the temperature for minutes
+ *   OpRamp         temp, minutes   move the target linearly to temp within minutes, a rest as OpHeatTo
+ *   OpPrompt       text            hold the temperature until confirmed, text: StringId
+ *   OpAlarm        text            show text until confirmed, the program goes on
+ *   OpBoil         minutes         heat at full power until it boils, then boil for minutes
+ *   OpBranchBelow  temp, steps     skip the next steps if the temperature is below temp
+ *   OpCool         temp            heater off until the wort has cooled down to temp
+ *
+ * The receipe is compiled into PROGRAM_SIZE bytes: a fixed header (mash-in and dough-in), the
+ * steps of the receipe in their order, the mash-out and, each after the OpEnd of the one before,
+ * the single vessel sparge program and the boil program, with the cooling if the receipe has a
+ * pitching temperature. The header and the tail take PROGRAM_HEADER and PROGRAM_TAIL bytes,
+ * the rest is left for the steps, four per rest with heat-up and hold.
+ */
+enum Opcode { OpEnd, OpPhase, OpHeatTo, OpHoldFor, OpRamp, OpPrompt, OpAlarm, OpBoil, OpBranchBelow, OpCool, OpCount };
+
+#define PROGRAM_SIZE 62
+#define PROGRAM_HEADER 8 // OpPhase MashIn, OpHeatTo, OpPrompt, OpPhase Rest
+#define PROGRAM_MASH_IN_TEMP 3 // operand of the mash-in OpHeatTo
+// mash-out: OpPhase, OpPrompt, OpEnd; sparge: OpPhase, OpHeatTo, OpPrompt, OpEnd;
+// boil: OpPhase, OpPrompt (first wort hops), OpBoil, OpPrompt (whirlpool hops),
+// OpPhase, OpCool, OpPrompt (pitching), OpEnd
+#define PROGRAM_TAIL 27
+
+/*
+ * length of a step in bytes, opcode and operands
+ */
+byte program_op_length(byte op);
+
+/*
+ * timer of a step in seconds, 0 for steps without one
+ */
+unsigned long program_op_seconds(const byte* op);
+
+/*
+ * program counter after the next steps steps from pc
+ */
+byte program_skip(const byte* program, byte pc, byte steps);
+
+/*
+ * temperature of the first heating step after the one at pc, before the end of the program,
+ * -1 if there is none
+ */
+float program_next_temp(const byte* program, byte pc);
+
+#endif /* BW_PROGRAM_H_ */
@@ -0,0 +1,297 @@
+#include "recorder.h"
+
+#ifdef RECORDER
+
+#include "telemetry.h"
+
+#define REC_MASK (REC_BUFFER_SIZE - 1)
+#define REC_MAX_RECORD (1 + 5 + 3 + 1 + REC_MAX_DATA) // header, time delta, payload
+
+static_assert(REC_BUFFER_SIZE <= 128 && (REC_BUFFER_SIZE & REC_MASK) == 0, "REC_BUFFER_SIZE must be a power of 2 <= 128");
+static_assert(REC_MAX_RECORD <= REC_BUFFER_SIZE, "REC_MAX_DATA does not fit into REC_BUFFER_SIZE");
+static_assert(REC_SERIAL_CHUNK <= 15 && REC_SERIAL_CHUNK <= REC_MAX_DATA, "REC_SERIAL_CHUNK must fit into the record header");
+
+static byte rec_buffer[REC_BUFFER_SIZE];
+static byte rec_head = 0; // next byte to write
+static byte rec_tail = 0; // next byte to send
+static byte rec_seq = 0;
+static unsigned long rec_last_ms = 0;
+static unsigned int rec_lost = 0;
+// serial input not recorded yet, see RecTaskSerial
+static byte rec_serial_buf[REC_SERIAL_CHUNK];
+static byte rec_serial_len = 0;
+static unsigned long rec_serial_ms; // start of the current run of the serial task
+// clock of the running task and now() as known to the replay
+static unsigned long rec_task_ms = 0;
+static unsigned long rec_task_now = 0;
+static unsigned long rec_replay_now = 0;
+static byte rec_current_task = RecTaskSetup;
+// receipe file read in the running task, see rec_file()
+static unsigned int rec_file_len;
+static uint16_t rec_file_crc;
+
+static byte put_varint(byte* p, unsigned long v)
+{
+  byte n = 0;
+  while (v >= 0x80)
+  {
+    p[n++] = (v & 0x7F) | 0x80;
+    v >>= 7;
+  }
+  p[n++] = v;
+  return n;
+}
+
+/*
+ * append a record with the time ms to the ring buffer, false if there is no room
+ * the count of lost records goes first, the replay has to know where the gap is
+ */
+static bool put(byte header, unsigned long ms, const byte* payload, byte len)
+{
+  byte rec[REC_MAX_RECORD];
+  byte room = REC_BUFFER_SIZE - (byte)(rec_head - rec_tail);
+  ms = max(ms, rec_last_ms);
+  if (rec_lost > 0)
+  {
+    rec[0] = RecLost << 4;
+    byte n = 1 + put_varint(rec + 1, ms - rec_last_ms);
+    n += put_varint(rec + n, rec_lost);
+    if (room < n)
+    {
+      return false;
+    }
+    for (byte i = 0; i < n; i++)
+    {
+      rec_buffer[(rec_head + i) & REC_MASK] = rec[i];
+    }
+    rec_head += n;
+    room -= n;
+    rec_last_ms = ms;
+    rec_lost = 0;
+  }
+
+  rec[0] = header;
+  byte n = 1 + put_varint(rec + 1, ms - rec_last_ms);
+  for (byte i = 0; i < len; i++)
+  {
+    rec[n++] = payload[i];
+  }
+  if (room < n)
+  {
+    return false;
+  }
+  for (byte i = 0; i < n; i++)
+  {
+    rec_buffer[(rec_head + i) & REC_MASK] = rec[i];
+  }
+  rec_head += n;
+  rec_last_ms = ms;
+  return true;
+}
+
+static void record(byte type, byte arg, const byte* payload = NULL, byte len = 0)
+{
+  if (!put(type << 4 | arg, millis(), payload, len))
+  {
+    rec_lost++;
+  }
+}
+
+/*
+ * the EEPROM state is read in setup(), before the loop runs, there the records wait until they
+ * have been sent so the burst of step transitions of a recovered process finds the buffer empty
+ * anywhere else they are dropped like any other record
+ */
+static void record_eeprom(const byte* payload, byte len)
+{
+  if (rec_current_task != RecTaskSetup)
+  {
+    record(RecEeprom, 0, payload, len);
+    return;
+  }
+  while (!put(RecEeprom << 4, millis(), payload, len))
+  {
+    rec_flush();
+  }
+  while (rec_head != rec_tail)
+  {
+    rec_flush();
+  }
+}
+
+/*
+ * the task record with the time it started, followed by now() if that changed since the last one
+ */
+static void put_task(byte task, unsigned long ms)
+{
+  if (!put(RecTask << 4 | task, ms, NULL, 0))
+  {
+    rec_lost++;
+    return;
+  }
+  if (rec_task_now != rec_replay_now)
+  {
+    byte payload[5];
+    long delta = rec_task_now - rec_replay_now;
+    byte n = put_varint(payload, (unsigned long)(delta << 1) ^ (unsigned long)(delta >> 31));
+    if (!put(RecClock << 4, ms, payload, n))
+    {
+      rec_lost++;
+      return;
+    }
+    rec_replay_now = rec_task_now;
+  }
+}
+
+void rec_task(byte task)
+{
+  rec_task_ms = millis();
+  rec_task_now = now();
+  rec_current_task = task;
+  rec_file_len = 0;
+  rec_file_crc = 0xFFFF;
+  if (task == RecTaskSerial)
+  {
+    rec_serial_ms = rec_task_ms;
+    return;
+  }
+  put_task(task, rec_task_ms);
+}
+
+unsigned long rec_millis()
+{
+  return rec_task_ms;
+}
+
+unsigned long rec_now()
+{
+  return rec_task_now;
+}
+
+void rec_set_time(unsigned long t)
+{
+  setTime(t);
+  // the replay sets it from the recorded EEPROM contents as well
+  rec_task_now = t;
+  rec_replay_now = t;
+}
+
+float rec_temp(byte ch, float temp)
+{
+  int16_t t = isnan(temp) ? REC_NO_TEMP : (int16_t)lround(temp * 128);
+  record(RecTemp, ch, (const byte*)(void*)&t, sizeof(t));
+  return temp;
+}
+
+bool rec_input(bool read, input_event_t& event)
+{
+  if (read)
+  {
+    byte payload[6];
+    payload[0] = event.steps;
+    byte n = 1 + put_varint(payload + 1, event.micros);
+    record(RecInput, event.type, payload, n);
+  }
+  return read;
+}
+
+int rec_serial(int c)
+{
+  if (c < 0)
+  {
+    return c;
+  }
+  rec_serial_buf[rec_serial_len++] = c;
+  bool line_end = c == '\r' || c == '\n';
+  if (line_end)
+  {
+    put_task(RecTaskSerial, rec_serial_ms);
+  }
+  if (line_end || rec_serial_len == REC_SERIAL_CHUNK)
+  {
+    // at the time the run started, like its task record
+    if (!put(RecSerial << 4 | rec_serial_len, rec_serial_ms, rec_serial_buf, rec_serial_len))
+    {
+      rec_lost++;
+    }
+    rec_serial_len = 0;
+  }
+  return c;
+}
+
+byte rec_result(byte result)
+{
+  record(RecResult, result);
+  return result;
+}
+
+void rec_eeprom(int offset, byte* data, int size)
+{
+  byte payload[3 + REC_MAX_DATA];
+  for (int i = 0; i < size; i += REC_MAX_DATA)
+  {
+    byte len = min(size - i, REC_MAX_DATA);
+    byte n = put_varint(payload, offset + i);
+    payload[n++] = len;
+    memcpy(payload + n, data + i, len);
+    record_eeprom(payload, n + len);
+  }
+}
+
+unsigned int rec_file(char* buf, unsigned int cnt)
+{
+  // the contents do not fit into the buffer, the replay reads its own copy of the file
+  if (cnt > 0)
+  {
+    rec_file_len += cnt;
+    rec_file_crc = telemetry_crc16(rec_file_crc, (const uint8_t*)buf, cnt);
+    return cnt;
+  }
+  byte payload[5];
+  byte n = put_varint(payload, rec_file_len);
+  payload[n++] = rec_file_crc & 0xFF;
+  payload[n++] = rec_file_crc >> 8;
+  record(RecFile, 0, payload, n);
+  return cnt;
+}
+
+void rec_heater(byte outlet, bool on)
+{
+  record(RecHeater, outlet << 1 | on);
+}
+
+void rec_step(byte phase, byte step, byte pc)
+{
+  byte payload[] = { phase, pc };
+  record(RecStep, step, payload, sizeof(payload));
+}
+
+bool rec_flush()
+{
+  // only as many bytes as fit into the TX buffer with the frame overhead
+  int room = Serial.availableForWrite() - (TELEMETRY_MAX_FRAME - TELEMETRY_MAX_PAYLOAD);
+  byte max_len = constrain(room, 0, TELEMETRY_MAX_PAYLOAD);
+  byte n = min((byte)(rec_head - rec_tail), (byte)(max_len - 1));
+  if (max_len < 2 || n == 0)
+  {
+    return false;
+  }
+
+  // the records are a byte stream, a frame ends wherever the room does
+  byte payload[TELEMETRY_MAX_PAYLOAD];
+  payload[0] = rec_seq;
+  for (byte i = 0; i < n; i++)
+  {
+    payload[1 + i] = rec_buffer[(rec_tail + i) & REC_MASK];
+  }
+  if (!Telemetry::send(TELEMETRY_MSG_RECORD, payload, 1 + n))
+  {
+    return false;
+  }
+  rec_tail += n;
+  // 0 only marks the first frame after a reset
+  rec_seq = rec_seq == 0xFF ? 1 : rec_seq + 1;
+  return true;
+}
+
+#endif /* RECORDER */
@@ -0,0 +1,141 @@
+#ifndef BW_RECORDER_H_
+#define BW_RECORDER_H_
+
+#include "Arduino.h"
+#include <Time.h>
+#include "brauwerkstatt.h"
+#include "encoder.h"
+
+/*
+ * Input recorder for the replay in tools/bwreplay.cpp
+ *
+ * Everything BrewProcess and BrewUi take from outside is recorded where it is consumed: the
+ * start of the scheduler tasks with their millis() and now(), temperature readings, encoder
+ * events, serial input, the EEPROM state read at startup and the CRC of the receipe file. The
+ * heater commands and step transitions are recorded as well, the replay compares its own
+ * against them.
+ *
+ * BrewProcess reads the clock through rec_millis() and rec_now(), which stand still at the time
+ * the running task started. Otherwise a task that takes a few ms longer on the controller than
+ * in the replay could see a timer run out that the replay does not.
+ *
+ * Each tap returns what the code goes on with. recorder.cpp records the live value and returns
+ * it, the replay links its own implementation of these functions, which returns the recorded one.
+ *
+ * Records are written into a RAM ring buffer and sent as TELEMETRY_MSG_RECORD frames by
+ * rec_flush(), which is called from the loop when no task is due, like log_flush(). The frame
+ * payload is a sequence number followed by the next bytes of the record stream, records may
+ * span frames. The sequence number starts at 0 after a reset and then counts 1 .. 255, so a
+ * receiver can tell lost frames from a restart. A record that does not fit into the ring buffer
+ * is dropped and RecLost is written as soon as there is room again, the replay ends there.
+ * Nothing waits for room in the loop: only the EEPROM state, which is read in setup(), waits
+ * there until it has been sent. The receipe file is too large for the buffer, only its length
+ * and CRC are recorded, the replay reads a copy of the file and checks it against them.
+ *
+ * Record: header (type << 4 | arg), varint ms since the previous record, payload
+ *   type        arg              payload
+ *   RecTask     RecordTask       -
+ *   RecClock    -                zigzag varint change of now(), after a RecTask if it changed
+ *   RecTemp     channel          int16 temperature in 1/128 C (DS18B20 resolution) or REC_NO_TEMP
+ *   RecInput    Encoder::Event   int8 steps, varint micros
+ *   RecSerial   length           up to REC_SERIAL_CHUNK bytes read from Serial
+ *   RecResult   FRESULT          -, of pf_mount() and pf_open()
+ *   RecEeprom   -                varint offset, length, data
+ *   RecFile     -                varint length, CRC-16 (telemetry.h) of the receipe file, at its end
+ *   RecHeater   outlet << 1 | on -
+ *   RecStep     Step             phase, program counter
+ *   RecLost     -                varint number of records dropped
+ * varints are little endian base 128, as in the log records (logmsg.h).
+ *
+ * Only call the taps from the main loop, not from interrupts.
+ */
+enum RecordType { RecTask, RecClock, RecTemp, RecInput, RecSerial, RecResult, RecEeprom, RecFile, RecHeater, RecStep, RecLost };
+
+// the tasks of brauwerkstatt.ino
+// SerialCommand only acts on a line end, so RecTaskSerial is only recorded for the runs of the
+// serial task that read one. The input before is recorded as it comes in, in chunks.
+enum RecordTask { RecTaskSetup, RecTaskSensor, RecTaskControl, RecTaskUi, RecTaskPersist, RecTaskSerial };
+
+#define REC_MAX_DATA 32 // data bytes per RecEeprom record
+#define REC_SERIAL_CHUNK 8 // serial input bytes per RecSerial record, at most 15
+#define REC_NO_TEMP (-32767 - 1) // RecTemp of a sensor that was not found, NaN
+
+#ifdef RECORDER
+
+/*
+ * a task starts
+ */
+void rec_task(byte task);
+
+/*
+ * millis() and now() at the start of the running task
+ */
+unsigned long rec_millis();
+unsigned long rec_now();
+
+/*
+ * setTime() of the Time library, the clock of the running task is set as well
+ */
+void rec_set_time(unsigned long t);
+
+/*
+ * a temperature reading of a channel
+ */
+float rec_temp(byte ch, float temp);
+
+/*
+ * the result of Encoder::read(), the event is only valid if it returns true
+ */
+bool rec_input(bool read, input_event_t& event);
+
+/*
+ * a byte from Serial, -1 if there was none
+ */
+int rec_serial(int c);
+
+/*
+ * the result of a Petit FatFs call
+ */
+byte rec_result(byte result);
+
+/*
+ * size bytes read from the EEPROM at offset
+ */
+void rec_eeprom(int offset, byte* data, int size);
+
+/*
+ * cnt bytes read from the receipe file, 0 at its end, returns the number of bytes in buf
+ */
+unsigned int rec_file(char* buf, unsigned int cnt);
+
+/*
+ * outputs: a heater command, a step transition
+ */
+void rec_heater(byte outlet, bool on);
+void rec_step(byte phase, byte step, byte pc);
+
+/*
+ * send one frame of buffered records, if the TX buffer has room for it
+ * returns false if there was nothing to send or no room
+ */
+bool rec_flush();
+
+#else
+
+inline void rec_task(byte) {}
+inline unsigned long rec_millis() { return millis(); }
+inline unsigned long rec_now() { return now(); }
+inline void rec_set_time(unsigned long t) { setTime(t); }
+inline float rec_temp(byte, float temp) { return temp; }
+inline bool rec_input(bool read, input_event_t&) { return read; }
+inline int rec_serial(int c) { return c; }
+inline byte rec_result(byte result) { return result; }
+inline void rec_eeprom(int, byte*, int) {}
+inline unsigned int rec_file(char*, unsigned int cnt) { return cnt; }
+inline void rec_heater(byte, bool) {}
+inline void rec_step(byte, byte, byte) {}
+inline bool rec_flush() { return false; }
+
+#endif /* RECORDER */
+
+#endif /* BW_RECORDER_H_ */
@@ -0,0 +1,141 @@
+#include <avr/interrupt.h>
+#include <avr/sleep.h>
+
+#include "scheduler.h"
+
+int8_t Scheduler::addTask(const char* name, task_fn_t fn, unsigned int period_ms, unsigned int phase_ms, byte priority)
+{
+  if (_num_tasks >= SCHED_MAX_TASKS)
+  {
+    return -1;
+  }
+  task_t* t = &_tasks[_num_tasks];
+  t->name = name;
+  t->fn = fn;
+  t->period_ms = period_ms;
+  t->priority = priority;
+  t->next_due = millis() + phase_ms;
+  t->runs = 0;
+  t->total_us = 0;
+  t->max_us = 0;
+  t->misses = 0;
+  return _num_tasks++;
+}
+
+bool Scheduler::run()
+{
+  unsigned long now = millis();
+
+  task_t* next = NULL;
+  for (byte i = 0; i < _num_tasks; i++)
+  {
+    task_t* t = &_tasks[i];
+    if ((long)(now - t->next_due) < 0)
+    {
+      continue;
+    }
+    // highest priority first, the longest overdue one among equals
+    if (next == NULL || t->priority > next->priority ||
+        (t->priority == next->priority && (long)(t->next_due - next->next_due) < 0))
+    {
+      next = t;
+    }
+  }
+  if (next == NULL)
+  {
+    return false;
+  }
+
+  if (now - next->next_due >= next->period_ms)
+  {
+    // missed its deadline (the start of the next period): re-align, don't run a burst
+    next->misses++;
+    next->next_due = now + next->period_ms;
+  }
+  else
+  {
+    next->next_due += next->period_ms;
+  }
+
+  unsigned long start = micros();
+  next->fn();
+  unsigned long duration = micros() - start;
+
+  next->runs++;
+  next->total_us += duration;
+  if (duration > next->max_us)
+  {
+    next->max_us = duration;
+  }
+  return true;
+}
+
+void Scheduler::idle(bool (*wake)())
+{
+  set_sleep_mode(SLEEP_MODE_IDLE);
+  while (true)
+  {
+    // check and sleep with interrupts disabled, so an interrupt after the check
+    // is not slept through: sleep_cpu() runs before any interrupt after sei()
+    cli();
+    if (isDue(millis()) || (wake != NULL && wake()))
+    {
+      sei();
+      return;
+    }
+    // the millis() timer wakes the CPU every ms, so does every other interrupt
+    sleep_enable();
+    sei();
+    sleep_cpu();
+    sleep_disable();
+  }
+}
+
+bool Scheduler::isDue(unsigned long now)
+{
+  for (byte i = 0; i < _num_tasks; i++)
+  {
+    if ((long)(now - _tasks[i].next_due) >= 0)
+    {
+      return true;
+    }
+  }
+  return false;
+}
+
+void Scheduler::trigger(int8_t id)
+{
+  if (id >= 0 && id < _num_tasks)
+  {
+    _tasks[id].next_due = millis();
+  }
+}
+
+void Scheduler::printStats()
+{
+  Serial.println(F("task runs avg_us max_us misses"));
+  for (byte i = 0; i < _num_tasks; i++)
+  {
+    task_t* t = &_tasks[i];
+    Serial.print((const __FlashStringHelper*)t->name);
+    Serial.print(' ');
+    Serial.print(t->runs);
+    Serial.print(' ');
+    Serial.print(t->runs > 0 ? t->total_us / t->runs : 0);
+    Serial.print(' ');
+    Serial.print(t->max_us);
+    Serial.print(' ');
+    Serial.println(t->misses);
+  }
+}
+
+void Scheduler::resetStats()
+{
+  for (byte i = 0; i < _num_tasks; i++)
+  {
+    _tasks[i].runs = 0;
+    _tasks[i].total_us = 0;
+    _tasks[i].max_us = 0;
+    _tasks[i].misses = 0;
+  }
+}
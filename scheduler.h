@@ -0,0 +1,75 @@
+#ifndef BW_SCHEDULER_H_
+#define BW_SCHEDULER_H_
+
+#include "Arduino.h"
+#include "brauwerkstatt.h"
+
+typedef void (*task_fn_t)();
+
+/*
+ * Cooperative periodic task scheduler
+ *
+ * Each call to run() executes at most one due task, the one with the highest priority.
+ * Tasks are scheduled drift-free at phase + n * period. A task that starts more than one
+ * period late counts as a deadline miss and is re-aligned instead of catching up.
+ */
+class Scheduler
+{
+public:
+  /*
+   * register a task, returns its id or -1 if the task table is full
+   * name must be a PROGMEM string
+   * phase_ms delays the first run, to spread tasks with the same period
+   * when several tasks are due, the one with the higher priority value runs first
+   */
+  int8_t addTask(const char* name, task_fn_t fn, unsigned int period_ms, unsigned int phase_ms, byte priority);
+
+  /*
+   * run the most urgent due task, if any
+   * returns false if no task was due
+   */
+  bool run();
+
+  /*
+   * simple idle wait: halt the CPU in SLEEP_MODE_IDLE until a task is due
+   * This is not a tickless sleep. The millis() timer still wakes the CPU every ms and the wait
+   * only checks whether a task is due, no deadline is computed. It saves the busy polling of
+   * the loop, not the ticks.
+   * wake is checked after every interrupt, if it returns true the wait ends early,
+   * so input can be handled before the next scheduled run
+   */
+  void idle(bool (*wake)());
+
+  /*
+   * make a task due immediately
+   */
+  void trigger(int8_t id);
+
+  /*
+   * print run count, average and max execution time and deadline misses per task to Serial
+   */
+  void printStats();
+  void resetStats();
+
+private:
+  bool isDue(unsigned long now);
+
+  struct task_t {
+    const char* name;
+    task_fn_t fn;
+    unsigned int period_ms;
+    byte priority;
+    unsigned long next_due; // millis
+
+    // statistics
+    unsigned long runs;
+    unsigned long total_us;
+    unsigned long max_us;
+    unsigned int misses;
+  };
+
+  struct task_t _tasks[SCHED_MAX_TASKS];
+  byte _num_tasks = 0;
+};
+
+#endif /* BW_SCHEDULER_H_ */
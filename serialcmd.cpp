@@ -0,0 +1,308 @@
+#include <stdlib.h>
+
+#include "brewproc.h"
+#include "scheduler.h"
+#include "perf.h"
+#include "memstat.h"
+#include "planner.h"
+#include "recorder.h"
+#include "serialcmd.h"
+#include "uistrings.h"
+
+SerialCommand::SerialCommand(BrewProcess* brew_proc, Planner* planner, Scheduler* scheduler)
+{
+  _brew_process = brew_proc;
+  _planner = planner;
+  _scheduler = scheduler;
+}
+
+void SerialCommand::service()
+{
+  // finish a listing before reading the next command, so replies stay in order
+  if (_listing >= 0)
+  {
+    if (Serial.availableForWrite() < SERIAL_CMD_LINE_LEN / 2)
+    {
+      return;
+    }
+    print_config(_listing++);
+    if (_listing >= _brew_process->numConfig())
+    {
+      _listing = -1;
+      reply_ok();
+    }
+    return;
+  }
+
+  int c;
+  for (byte n = 0; n < SERIAL_CMD_BYTES_PER_RUN && (c = rec_serial(Serial.available() > 0 ? Serial.read() : -1)) >= 0; n++)
+  {
+    if (c == '\r' || c == '\n')
+    {
+      if (_overflow)
+      {
+        reply_error(PSTR("line too long"));
+      }
+      else if (_len > 0)
+      {
+        _line[_len] = '\0';
+        execute();
+      }
+      _len = 0;
+      _overflow = false;
+      // one command per call, the next one may produce output as well
+      return;
+    }
+    if (_len < SERIAL_CMD_LINE_LEN)
+    {
+      _line[_len++] = c;
+    }
+    else
+    {
+      _overflow = true;
+    }
+  }
+}
+
+/*
+ * split off the next space separated word, p points behind it afterwards
+ */
+static char* next_word(char*& p)
+{
+  while (*p == ' ')
+  {
+    p++;
+  }
+  char* word = p;
+  while (*p != '\0' && *p != ' ')
+  {
+    p++;
+  }
+  if (*p != '\0')
+  {
+    *p++ = '\0';
+  }
+  return word;
+}
+
+void SerialCommand::execute()
+{
+  char* p = _line;
+  char* cmd = next_word(p);
+
+  if (strcmp_P(cmd, PSTR("state")) == 0) cmd_state();
+  else if (strcmp_P(cmd, PSTR("get")) == 0) cmd_get(next_word(p));
+  else if (strcmp_P(cmd, PSTR("set")) == 0)
+  {
+    char* name = next_word(p);
+    cmd_set(name, next_word(p));
+  }
+  else if (strcmp_P(cmd, PSTR("start")) == 0) cmd_start(next_word(p));
+  else if (strcmp_P(cmd, PSTR("stop")) == 0)
+  {
+    char* what = next_word(p);
+    if (*what == '\0') _brew_process->stop_process();
+    else if (strcmp_P(what, PSTR("sparge")) == 0) _brew_process->stop_sparge();
+    else
+    {
+      reply_error(PSTR("unknown process"));
+      return;
+    }
+    reply_ok();
+  }
+  else if (strcmp_P(cmd, PSTR("ok")) == 0)
+  {
+    if (_brew_process->needConfirmation())
+    {
+      _brew_process->confirm();
+      reply_ok();
+    }
+    else
+    {
+      reply_error(PSTR("no prompt"));
+    }
+  }
+  else if (strcmp_P(cmd, PSTR("stats")) == 0)
+  {
+    _scheduler->printStats();
+#ifdef PERF_PROBES
+    perf_dump();
+#endif
+    reply_ok();
+  }
+  else if (strcmp_P(cmd, PSTR("plan")) == 0)
+  {
+    if (_planner->active())
+    {
+      _planner->print();
+      reply_ok();
+    }
+    else
+    {
+      reply_error(PSTR("no mash process"));
+    }
+  }
+  else if (strcmp_P(cmd, PSTR("mem")) == 0)
+  {
+    mem_report();
+    reply_ok();
+  }
+  else if (strcmp_P(cmd, PSTR("rcp")) == 0) cmd_receipe(p);
+  else if (strcmp_P(cmd, PSTR("lang")) == 0) cmd_language(next_word(p));
+  else if (*cmd != '\0') reply_error(PSTR("unknown command"));
+}
+
+void SerialCommand::cmd_state()
+{
+  Serial.print(F("OK "));
+  Serial.print(_brew_process->isRunning());
+  Serial.print(' ');
+  Serial.print(_brew_process->getPhase());
+  Serial.print(' ');
+  Serial.print(_brew_process->getStep());
+  Serial.print(' ');
+  Serial.print(_brew_process->getCurrentRest());
+  Serial.print(' ');
+  Serial.print(_brew_process->getCurrentTemp());
+  Serial.print(' ');
+  Serial.print(_brew_process->getTargetTemp());
+  Serial.print(' ');
+  Serial.print(_brew_process->heaterOn());
+  Serial.print(' ');
+#ifdef SPARGE_VESSEL
+  Serial.print(_brew_process->needConfirmation());
+  Serial.print(' ');
+  Serial.print(_brew_process->isSpargeRunning());
+  Serial.print(' ');
+  Serial.print(_brew_process->getCurrentTemp(BrewProcess::ChannelSparge));
+  Serial.print(' ');
+  Serial.println(_brew_process->heaterOn(BrewProcess::ChannelSparge));
+#else
+  Serial.println(_brew_process->needConfirmation());
+#endif
+}
+
+void SerialCommand::cmd_get(const char* name)
+{
+  if (*name == '\0')
+  {
+    _listing = 0;
+    return;
+  }
+  int8_t idx = _brew_process->findConfig(name);
+  if (idx < 0)
+  {
+    reply_error(PSTR("unknown name"));
+    return;
+  }
+  print_config(idx);
+  reply_ok();
+}
+
+void SerialCommand::cmd_set(const char* name, const char* value)
+{
+  int8_t idx = _brew_process->findConfig(name);
+  if (idx < 0)
+  {
+    reply_error(PSTR("unknown name"));
+    return;
+  }
+  char* end;
+  float v = strtod(value, &end);
+  if (end == value || *end != '\0' || !_brew_process->setConfig(idx, v))
+  {
+    reply_error(PSTR("invalid value"));
+    return;
+  }
+  reply_ok();
+}
+
+void SerialCommand::cmd_start(const char* what)
+{
+  bool started;
+  if (strcmp_P(what, PSTR("mash")) == 0) started = _brew_process->start_mash_process();
+  else if (strcmp_P(what, PSTR("sparge")) == 0) started = _brew_process->start_second_wash_process();
+  else if (strcmp_P(what, PSTR("boil")) == 0) started = _brew_process->start_boil_process();
+  else
+  {
+    reply_error(PSTR("unknown process"));
+    return;
+  }
+  // already running, or no receipe
+  if (started) reply_ok(); else reply_error(PSTR("not started"));
+}
+
+void SerialCommand::cmd_receipe(char* line)
+{
+  char* p = line;
+  char* word = next_word(p);
+  if (strcmp_P(word, PSTR("begin")) == 0)
+  {
+    _receipe_upload = _brew_process->begin_receipe();
+    if (_receipe_upload) reply_ok(); else reply_error(PSTR("process running"));
+    return;
+  }
+  if (!_receipe_upload)
+  {
+    reply_error(PSTR("no upload"));
+    return;
+  }
+  if (strcmp_P(word, PSTR("end")) == 0)
+  {
+    _receipe_upload = false;
+    _brew_process->end_receipe();
+    reply_ok();
+    return;
+  }
+  // next_word() has cut the line, the parser gets it in one piece
+  if (*p != '\0')
+  {
+    p[-1] = ' ';
+  }
+  if (_brew_process->add_receipe_line(word))
+  {
+    reply_ok();
+  }
+  else
+  {
+    // the receipe is incomplete now, it has to be uploaded again
+    _receipe_upload = false;
+    reply_error(PSTR("parse error"));
+  }
+}
+
+void SerialCommand::cmd_language(const char* lang)
+{
+  if (*lang == '\0')
+  {
+    Serial.println(ui_language() == LangEn ? F("OK en") : F("OK de"));
+    return;
+  }
+  byte l;
+  if (strcmp_P(lang, PSTR("de")) == 0) l = LangDe;
+  else if (strcmp_P(lang, PSTR("en")) == 0) l = LangEn;
+  else
+  {
+    reply_error(PSTR("unknown language"));
+    return;
+  }
+  if (set_ui_language(l)) reply_ok(); else reply_error(PSTR("not compiled in"));
+}
+
+void SerialCommand::print_config(byte idx)
+{
+  Serial.print((const __FlashStringHelper*)_brew_process->configName(idx));
+  Serial.print('=');
+  Serial.println(_brew_process->getConfig(idx), _brew_process->configDecimals(idx));
+}
+
+void SerialCommand::reply_ok()
+{
+  Serial.println(F("OK"));
+}
+
+void SerialCommand::reply_error(const char* msg)
+{
+  Serial.print(F("ERR "));
+  Serial.println((const __FlashStringHelper*)msg);
+}
@@ -0,0 +1,73 @@
+#ifndef BW_SERIALCMD_H_
+#define BW_SERIALCMD_H_
+
+#include "Arduino.h"
+#include "brauwerkstatt.h"
+
+class BrewProcess;
+class Planner;
+class Scheduler;
+
+/*
+ * Line based command interface on Serial
+ *
+ * service() runs as a scheduler task. It takes at most SERIAL_CMD_BYTES_PER_RUN bytes from the
+ * RX buffer per call and executes a command once its line is complete, so it never waits for
+ * input. Every command is answered with one line starting with "OK" or "ERR".
+ *
+ *   state                    OK running phase step rest temp target heater need_confirmation
+ *                            with SPARGE_VESSEL followed by sparge_running sparge_temp sparge_heater
+ *   get [name]               config values as name=value, all of them without a name
+ *   set name value           change a config value
+ *   start mash|sparge|boil   start a process, with SPARGE_VESSEL sparge can run next to mash
+ *   stop [sparge]            stop all processes, or only the sparge vessel
+ *   ok                       confirm the current prompt
+ *   stats                    task statistics, plus latency histograms with PERF_PROBES
+ *   plan                     remaining timeline, "eta type index" per line, see Planner::print()
+ *   mem                      RAM usage, stack high water mark and static RAM per object
+ *   lang [de|en]             show or switch the UI language
+ *   rcp begin                start a receipe upload, the current receipe is discarded
+ *   rcp key=value            one line in the format of REZEPT.TXT
+ *   rcp end                  finish the upload, the receipe is loaded
+ */
+class SerialCommand
+{
+public:
+  SerialCommand(BrewProcess* brew_proc, Planner* planner, Scheduler* scheduler);
+
+  /*
+   * read available input and execute complete commands
+   */
+  void service();
+
+  /*
+   * true if there is input waiting in the RX buffer
+   */
+  bool pending() { return Serial.available() > 0; };
+
+private:
+  BrewProcess* _brew_process;
+  Planner* _planner;
+  Scheduler* _scheduler;
+
+  char _line[SERIAL_CMD_LINE_LEN + 1];
+  byte _len = 0;
+  bool _overflow = false; // discard the rest of an overlong line
+  bool _receipe_upload = false;
+  // "get" without a name lists one value per call, as long as it fits into the TX buffer
+  int8_t _listing = -1;
+
+  void execute();
+  void cmd_state();
+  void cmd_get(const char* name);
+  void cmd_set(const char* name, const char* value);
+  void cmd_start(const char* what);
+  void cmd_receipe(char* line);
+  void cmd_language(const char* lang);
+
+  void print_config(byte idx);
+  void reply_ok();
+  void reply_error(const char* msg);
+};
+
+#endif /* BW_SERIALCMD_H_ */
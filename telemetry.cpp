@@ -0,0 +1,77 @@
+#include <Time.h>
+
+#include "brewproc.h"
+#include "telemetry.h"
+
+// send() drops frames that do not fit into the TX buffer, which always keeps one byte free
+static_assert(TELEMETRY_MAX_FRAME <= SERIAL_TX_BUFFER_SIZE - 1, "TELEMETRY_MAX_FRAME does not fit into the TX buffer");
+static_assert(sizeof(telemetry_state_t) <= TELEMETRY_MAX_PAYLOAD, "telemetry_state_t exceeds TELEMETRY_MAX_PAYLOAD");
+static_assert(sizeof(telemetry_plan_t) <= TELEMETRY_MAX_PAYLOAD, "telemetry_plan_t exceeds TELEMETRY_MAX_PAYLOAD");
+
+Telemetry::Telemetry(BrewProcess* brew_proc)
+{
+  _brew_process = brew_proc;
+}
+
+void Telemetry::send_state()
+{
+  telemetry_state_t rec;
+  rec.seq = _seq++;
+
+  rec.flags = 0;
+  if (_brew_process->isRunning()) rec.flags |= TELEMETRY_RUNNING;
+  if (_brew_process->heaterOn()) rec.flags |= TELEMETRY_HEATER;
+  if (_brew_process->needConfirmation()) rec.flags |= TELEMETRY_NEED_CONFIRMATION;
+  if (_brew_process->hasError()) rec.flags |= TELEMETRY_ERROR;
+  if (_brew_process->hasWarning()) rec.flags |= TELEMETRY_WARNING;
+#ifdef SPARGE_VESSEL
+  if (_brew_process->isSpargeRunning()) rec.flags |= TELEMETRY_SPARGE_RUNNING;
+  if (_brew_process->heaterOn(BrewProcess::ChannelSparge)) rec.flags |= TELEMETRY_SPARGE_HEATER;
+#endif
+
+  rec.phase = _brew_process->getPhase();
+  rec.step = _brew_process->getStep();
+  rec.rest = _brew_process->getCurrentRest();
+  rec.message = _brew_process->getMessageCode();
+  rec.temp = (int16_t)(_brew_process->getCurrentTemp() * 100.0F);
+  rec.target = (int16_t)(_brew_process->getTargetTemp() * 100.0F);
+  rec.now = now();
+  rec.process_start = _brew_process->procStart();
+  rec.phase_start = _brew_process->phaseStart();
+  rec.rest_remaining = _brew_process->phaseRest();
+#ifdef SPARGE_VESSEL
+  rec.sparge_temp = (int16_t)(_brew_process->getCurrentTemp(BrewProcess::ChannelSparge) * 100.0F);
+#else
+  rec.sparge_temp = 0;
+#endif
+
+  send(TELEMETRY_MSG_STATE, &rec, sizeof(rec));
+}
+
+bool Telemetry::send(byte type, const void* payload, byte len)
+{
+  if (len > TELEMETRY_MAX_PAYLOAD)
+  {
+    return false;
+  }
+
+  byte raw[TELEMETRY_MAX_PAYLOAD + 3];
+  raw[0] = type;
+  memcpy(raw + 1, payload, len);
+  uint16_t crc = telemetry_crc16(0xFFFF, raw, len + 1);
+  raw[len + 1] = crc & 0xFF;
+  raw[len + 2] = crc >> 8;
+
+  byte frame[TELEMETRY_MAX_FRAME];
+  frame[0] = 0;
+  byte n = 1 + telemetry_cobs_encode(raw, len + 3, frame + 1);
+  frame[n++] = 0;
+
+  // writing more than fits into the TX buffer would block the loop until it has been sent
+  if (Serial.availableForWrite() < n)
+  {
+    return false;
+  }
+  Serial.write(frame, n);
+  return true;
+}
@@ -0,0 +1,144 @@
+#ifndef BW_TELEMETRY_H_
+#define BW_TELEMETRY_H_
+
+/*
+ * Binary telemetry protocol
+ *
+ * Every message is sent as one frame:
+ *   0x00 | COBS( type | payload | CRC-16 ) | 0x00
+ * COBS removes all 0x00 from the frame content, so 0x00 only appears as delimiter and a
+ * receiver can resync on it. The leading delimiter separates the frame from any text output
+ * that went to Serial before. The CRC-16/CCITT (poly 0x1021, init 0xFFFF, little endian)
+ * covers type and payload. Payloads are packed structs in little endian byte order.
+ *
+ * The protocol part of this file is plain C++ and shared with the host tools in tools/.
+ */
+#include <stdint.h>
+
+// a frame has to fit into the 63 bytes of TX room of the ATmega328P's HardwareSerial, see send()
+#define TELEMETRY_MAX_PAYLOAD 57
+// type + payload + crc, plus COBS overhead and two delimiters
+#define TELEMETRY_MAX_FRAME (TELEMETRY_MAX_PAYLOAD + 3 + 1 + 2)
+
+// message types
+#define TELEMETRY_MSG_STATE 0x01
+#define TELEMETRY_MSG_LOG 0x02 // log records, see logmsg.h
+#define TELEMETRY_MSG_PLAN 0x03 // brew day timeline, see planner.h
+#define TELEMETRY_MSG_RECORD 0x04 // input recording, see recorder.h
+
+// telemetry_state_t.flags
+#define TELEMETRY_RUNNING 0x01
+#define TELEMETRY_HEATER 0x02
+#define TELEMETRY_NEED_CONFIRMATION 0x04
+#define TELEMETRY_ERROR 0x08
+#define TELEMETRY_WARNING 0x10
+#define TELEMETRY_SPARGE_RUNNING 0x20 // sparge vessel (SPARGE_VESSEL)
+#define TELEMETRY_SPARGE_HEATER 0x40
+
+/*
+ * TELEMETRY_MSG_STATE: snapshot of the process state
+ */
+struct telemetry_state_t {
+  uint8_t seq; // incremented with every record, gaps mean lost records
+  uint8_t flags;
+  uint8_t phase; // BrewProcess::Phase
+  uint8_t step; // BrewProcess::Step
+  uint8_t rest; // current rest, 0-based
+  uint8_t message; // BrewProcess::MessageCode of the current error or warning
+  int16_t temp; // current temperature in 1/100 C
+  int16_t target; // target temperature in 1/100 C, negative if there is none
+  uint32_t now; // controller clock in seconds
+  uint32_t process_start; // controller clock at start of the process, identifies the brew
+  uint32_t phase_start; // controller clock at start of the current phase
+  uint16_t rest_remaining; // seconds left in the current rest
+  int16_t sparge_temp; // sparge vessel temperature in 1/100 C, only valid with TELEMETRY_SPARGE_RUNNING
+} __attribute__((packed));
+
+/*
+ * TELEMETRY_MSG_PLAN: part of the timeline, the entries first .. first + n - 1 of total
+ * a timeline is sent as consecutive frames, n follows from the payload length
+ */
+#define TELEMETRY_PLAN_ENTRIES 8 // 54 payload bytes, the 60 byte frame fits into the 63 bytes of TX room
+
+struct telemetry_plan_entry_t {
+  uint8_t type; // Planner::SegmentType
+  uint8_t index; // see Planner::print()
+  uint32_t eta; // controller clock in seconds
+} __attribute__((packed));
+
+struct telemetry_plan_t {
+  uint32_t now; // controller clock in seconds
+  uint8_t first;
+  uint8_t total;
+  telemetry_plan_entry_t entries[TELEMETRY_PLAN_ENTRIES];
+} __attribute__((packed));
+
+inline uint16_t telemetry_crc16(uint16_t crc, const uint8_t* data, uint8_t len)
+{
+  while (len-- > 0)
+  {
+    crc ^= (uint16_t)(*data++) << 8;
+    for (uint8_t i = 0; i < 8; i++)
+    {
+      crc = (crc & 0x8000) ? (crc << 1) ^ 0x1021 : crc << 1;
+    }
+  }
+  return crc;
+}
+
+/*
+ * COBS-encode len (< 254) bytes from in to out, returns the encoded length (len + 1)
+ */
+inline uint8_t telemetry_cobs_encode(const uint8_t* in, uint8_t len, uint8_t* out)
+{
+  uint8_t code_pos = 0;
+  uint8_t code = 1;
+  uint8_t o = 1;
+  for (uint8_t i = 0; i < len; i++)
+  {
+    if (in[i] == 0)
+    {
+      out[code_pos] = code;
+      code_pos = o++;
+      code = 1;
+    }
+    else
+    {
+      out[o++] = in[i];
+      code++;
+    }
+  }
+  out[code_pos] = code;
+  return o;
+}
+
+#ifdef ARDUINO
+
+#include "Arduino.h"
+
+class BrewProcess;
+
+class Telemetry
+{
+public:
+  Telemetry(BrewProcess* brew_proc);
+
+  /*
+   * send a TELEMETRY_MSG_STATE record
+   */
+  void send_state();
+
+  /*
+   * frame a message and write it to Serial
+   * never blocks: if the TX buffer has no room for the whole frame, it is dropped and false returned
+   */
+  static bool send(byte type, const void* payload, byte len);
+
+private:
+  BrewProcess* _brew_process;
+  byte _seq = 0;
+};
+
+#endif /* ARDUINO */
+
+#endif /* BW_TELEMETRY_H_ */
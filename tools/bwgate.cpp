@@ -0,0 +1,288 @@
+/*
+ * bwgate - telemetry gateway
+ *
+ * Reads the controller's serial output, decodes the TELEMETRY_MSG_STATE frames and appends
+ * them to one columnar file per brew (see bwstore.h) below the archive directory:
+ *   ARCHIVE/YYYY/brew-YYYYMMDD-HHMMSS-<process_start>.bwc
+ * Text output of the controller (stats, command replies) is passed through to stdout, log records
+ * (TELEMETRY_MSG_LOG) are printed as text in the language selected with -l.
+ *
+ * A brew starts with the first record that has TELEMETRY_RUNNING set and ends when the
+ * controller reports no running process for a while. A brew the controller recovers after a
+ * reset (same process_start) is appended to the file it was recorded in.
+ *
+ * Build: g++ -std=c++11 -O2 -Wall -o bwgate bwgate.cpp
+ * Usage: bwgate [-b baud] [-g group_rows] [-l de|en] DEVICE ARCHIVE
+ *   DEVICE is the serial port, a pty, a recorded stream or "-" for stdin
+ */
+#include <getopt.h>
+#include <glob.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <sys/stat.h>
+#include <time.h>
+
+#include "bwlogtext.h"
+#include "bwproto.h"
+#include "bwstore.h"
+
+#define IDLE_RECORDS_END_BREW 30 // records without a running process that end a brew
+#define RESUME_WINDOW_S (12 * 3600) // brews recovered later than this get a new file
+
+static volatile sig_atomic_t stop_requested = 0;
+
+static void on_signal(int)
+{
+  stop_requested = 1;
+}
+
+static int64_t host_ms()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_REALTIME, &ts);
+  return (int64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+class Gateway
+{
+public:
+  Gateway(const std::string& archive, unsigned group_rows)
+    : archive_(archive), group_rows_(group_rows), process_start_(0), idle_(0),
+      have_seq_(false), seq_(0), records_(0), lost_(0) {}
+
+  ~Gateway() { writer_.close(); }
+
+  void onFrame(uint8_t type, const uint8_t* payload, size_t len)
+  {
+    if (type != TELEMETRY_MSG_STATE || len != sizeof(telemetry_state_t))
+    {
+      return;
+    }
+    telemetry_state_t rec;
+    memcpy(&rec, payload, sizeof(rec));
+    records_++;
+    if (have_seq_)
+    {
+      lost_ += (uint8_t)(rec.seq - seq_ - 1);
+    }
+    have_seq_ = true;
+    seq_ = rec.seq;
+
+    if ((rec.flags & TELEMETRY_RUNNING) == 0)
+    {
+      if (writer_.isOpen() && ++idle_ >= IDLE_RECORDS_END_BREW)
+      {
+        fprintf(stderr, "bwgate: brew finished, %s\n", writer_.path().c_str());
+        writer_.close();
+      }
+      return;
+    }
+    idle_ = 0;
+
+    int64_t now = host_ms();
+    if (!writer_.isOpen() || rec.process_start != process_start_)
+    {
+      openBrew(rec.process_start, now);
+    }
+    if (!writer_.isOpen())
+    {
+      return;
+    }
+
+    sample_t s;
+    s.t_ms = now;
+    s.temp = rec.temp;
+    s.target = rec.target;
+    s.heater = (rec.flags & TELEMETRY_HEATER) ? 1 : 0;
+    s.phase = rec.phase;
+    s.step = rec.step;
+    s.rest = rec.rest;
+    s.flags = rec.flags;
+    if (!writer_.append(s))
+    {
+      fprintf(stderr, "bwgate: write to %s failed: %s\n", writer_.path().c_str(), strerror(errno));
+    }
+  }
+
+  void printSummary()
+  {
+    fprintf(stderr, "bwgate: %lu records, %lu lost\n", records_, lost_);
+  }
+
+private:
+  std::string archive_;
+  unsigned group_rows_;
+  BrewWriter writer_;
+  uint32_t process_start_;
+  unsigned idle_;
+  bool have_seq_;
+  uint8_t seq_;
+  unsigned long records_;
+  unsigned long lost_;
+
+  void openBrew(uint32_t process_start, int64_t now_ms)
+  {
+    writer_.close();
+    process_start_ = process_start;
+
+    std::string path = findRecent(process_start, now_ms / 1000);
+    if (path.empty())
+    {
+      time_t t = now_ms / 1000;
+      struct tm tm;
+      localtime_r(&t, &tm);
+      char dir[32], name[64];
+      strftime(dir, sizeof(dir), "/%Y", &tm);
+      strftime(name, sizeof(name), "/brew-%Y%m%d-%H%M%S", &tm);
+      mkdir(archive_.c_str(), 0755);
+      path = archive_ + dir;
+      mkdir(path.c_str(), 0755);
+      path += name;
+      path += "-" + std::to_string(process_start) + ".bwc";
+    }
+    if (!writer_.open(path, process_start, now_ms))
+    {
+      fprintf(stderr, "bwgate: cannot open %s: %s\n", path.c_str(), strerror(errno));
+      return;
+    }
+    writer_.setGroupRows(group_rows_);
+    fprintf(stderr, "bwgate: recording brew to %s\n", path.c_str());
+  }
+
+  /*
+   * file of the same brew (same process_start) written to recently, if any
+   */
+  std::string findRecent(uint32_t process_start, time_t now)
+  {
+    std::string pattern = archive_ + "/*/brew-*-" + std::to_string(process_start) + ".bwc";
+    std::string found;
+    glob_t g;
+    if (glob(pattern.c_str(), 0, NULL, &g) == 0)
+    {
+      for (size_t i = 0; i < g.gl_pathc; i++)
+      {
+        struct stat st;
+        if (stat(g.gl_pathv[i], &st) == 0 && now - st.st_mtime < RESUME_WINDOW_S)
+        {
+          found = g.gl_pathv[i];
+        }
+      }
+    }
+    globfree(&g);
+    return found;
+  }
+};
+
+static void usage()
+{
+  fprintf(stderr, "usage: bwgate [-b baud] [-g group_rows] [-l de|en] DEVICE ARCHIVE\n");
+  exit(2);
+}
+
+int main(int argc, char** argv)
+{
+  int baud = 9600;
+  unsigned group_rows = BWC_GROUP_ROWS;
+  LogLanguage lang = LangDe;
+  int opt;
+  while ((opt = getopt(argc, argv, "b:g:l:")) != -1)
+  {
+    switch (opt)
+    {
+    case 'b':
+      baud = atoi(optarg);
+      break;
+    case 'g':
+      group_rows = atoi(optarg);
+      break;
+    case 'l':
+      if (strcmp(optarg, "de") == 0) lang = LangDe;
+      else if (strcmp(optarg, "en") == 0) lang = LangEn;
+      else usage();
+      break;
+    default:
+      usage();
+    }
+  }
+  if (argc - optind != 2)
+  {
+    usage();
+  }
+  const char* device = argv[optind];
+  std::string archive = argv[optind + 1];
+
+  int fd = serial_open(device, baud);
+  if (fd < 0)
+  {
+    fprintf(stderr, "bwgate: cannot open %s: %s\n", device, strerror(errno));
+    return 1;
+  }
+
+  struct sigaction sa;
+  memset(&sa, 0, sizeof(sa));
+  sa.sa_handler = on_signal;
+  sigaction(SIGINT, &sa, NULL);
+  sigaction(SIGTERM, &sa, NULL);
+  // a closed stdout must not kill the gateway before it has flushed the brew file
+  signal(SIGPIPE, SIG_IGN);
+
+  Gateway gateway(archive, group_rows);
+  LogExpander expander(lang);
+  FrameDecoder decoder(
+      [&gateway, &expander](uint8_t type, const uint8_t* payload, size_t len) {
+        if (type == TELEMETRY_MSG_LOG)
+        {
+          expander.expand(payload, len, [](uint64_t ms, const std::string& text) {
+            printf("%s %s\n", log_timestamp(ms).c_str(), text.c_str());
+          });
+          fflush(stdout);
+          return;
+        }
+        gateway.onFrame(type, payload, len);
+      },
+      [](const std::string& line) { printf("%s\n", line.c_str()); fflush(stdout); });
+
+  uint8_t buf[256];
+  while (!stop_requested)
+  {
+    struct pollfd pfd = { fd, POLLIN, 0 };
+    int n = poll(&pfd, 1, 1000);
+    if (n < 0)
+    {
+      if (errno == EINTR)
+      {
+        continue;
+      }
+      perror("bwgate: poll");
+      break;
+    }
+    if (n == 0)
+    {
+      continue;
+    }
+    ssize_t len = read(fd, buf, sizeof(buf));
+    if (len < 0 && (errno == EAGAIN || errno == EINTR))
+    {
+      continue;
+    }
+    if (len <= 0)
+    {
+      // end of a recorded stream, or the device / pty went away
+      if (len < 0)
+      {
+        perror("bwgate: read");
+      }
+      break;
+    }
+    decoder.feed(buf, len);
+  }
+  decoder.finish();
+
+  gateway.printSummary();
+  if (decoder.crc_errors() > 0)
+  {
+    fprintf(stderr, "bwgate: %lu frames with CRC errors\n", decoder.crc_errors());
+  }
+  return 0;
+}
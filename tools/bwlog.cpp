@@ -0,0 +1,102 @@
+/*
+ * bwlog - controller log viewer
+ *
+ * Reads the controller's serial output and prints the log records of the TELEMETRY_MSG_LOG
+ * frames as text, prefixed with the controller time (minutes:seconds since reset). Text output
+ * of the controller is printed as is, state frames are skipped.
+ *
+ * Build: g++ -std=c++11 -O2 -Wall -o bwlog bwlog.cpp
+ * Usage: bwlog [-b baud] [-l de|en] DEVICE
+ *   DEVICE is the serial port, a pty, a recorded stream or "-" for stdin
+ */
+#include <getopt.h>
+#include <poll.h>
+#include <stdlib.h>
+
+#include "bwlogtext.h"
+#include "bwproto.h"
+
+static void usage()
+{
+  fprintf(stderr, "usage: bwlog [-b baud] [-l de|en] DEVICE\n");
+  exit(2);
+}
+
+int main(int argc, char** argv)
+{
+  int baud = 9600;
+  LogLanguage lang = LangDe;
+  int opt;
+  while ((opt = getopt(argc, argv, "b:l:")) != -1)
+  {
+    switch (opt)
+    {
+    case 'b':
+      baud = atoi(optarg);
+      break;
+    case 'l':
+      if (strcmp(optarg, "de") == 0) lang = LangDe;
+      else if (strcmp(optarg, "en") == 0) lang = LangEn;
+      else usage();
+      break;
+    default:
+      usage();
+    }
+  }
+  if (argc - optind != 1)
+  {
+    usage();
+  }
+
+  int fd = serial_open(argv[optind], baud);
+  if (fd < 0)
+  {
+    fprintf(stderr, "bwlog: cannot open %s: %s\n", argv[optind], strerror(errno));
+    return 1;
+  }
+
+  LogExpander expander(lang);
+  FrameDecoder decoder(
+      [&expander](uint8_t type, const uint8_t* payload, size_t len) {
+        if (type != TELEMETRY_MSG_LOG)
+        {
+          return;
+        }
+        bool ok = expander.expand(payload, len, [](uint64_t ms, const std::string& text) {
+          printf("%s %s\n", log_timestamp(ms).c_str(), text.c_str());
+        });
+        if (!ok)
+        {
+          printf("bwlog: malformed log frame\n");
+        }
+        fflush(stdout);
+      },
+      [](const std::string& line) { printf("%s\n", line.c_str()); fflush(stdout); });
+
+  uint8_t buf[256];
+  while (true)
+  {
+    struct pollfd pfd = { fd, POLLIN, 0 };
+    if (poll(&pfd, 1, -1) < 0)
+    {
+      if (errno == EINTR)
+      {
+        continue;
+      }
+      perror("bwlog: poll");
+      return 1;
+    }
+    ssize_t len = read(fd, buf, sizeof(buf));
+    if (len < 0 && (errno == EAGAIN || errno == EINTR))
+    {
+      continue;
+    }
+    if (len <= 0)
+    {
+      break;
+    }
+    decoder.feed(buf, len);
+  }
+  decoder.finish();
+  return 0;
+}
@@ -0,0 +1,145 @@
+/*
+ * Expansion of the TELEMETRY_MSG_LOG records (../logmsg.h) into text, German or English
+ */
+#ifndef BW_TOOLS_LOGTEXT_H_
+#define BW_TOOLS_LOGTEXT_H_
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include <string>
+
+#include "../logmsg.h"
+
+#define LOG_MESSAGE_TEXT(id, de, en) { de, en },
+static const char* const LOG_TEXTS[][2] = { LOG_MESSAGES(LOG_MESSAGE_TEXT) };
+#undef LOG_MESSAGE_TEXT
+
+enum LogLanguage { LangDe, LangEn };
+
+/*
+ * substitute the placeholders of a message text with the arguments
+ */
+inline std::string log_format(const char* text, const long* args, unsigned argc)
+{
+  std::string out;
+  unsigned a = 0;
+  for (const char* p = text; *p != '\0'; p++)
+  {
+    if (*p != '%' || p[1] == '\0')
+    {
+      out.push_back(*p);
+      continue;
+    }
+    char spec = *++p;
+    if (spec == '%')
+    {
+      out.push_back('%');
+      continue;
+    }
+    if (a >= argc)
+    {
+      out += "?";
+      continue;
+    }
+    long v = args[a++];
+    char buf[32];
+    switch (spec)
+    {
+    case 'x':
+      snprintf(buf, sizeof(buf), "%02lx", (unsigned long)v & 0xFFFFFFFFUL);
+      break;
+    case 'c':
+      snprintf(buf, sizeof(buf), "%c", (char)v);
+      break;
+    case 'T':
+      snprintf(buf, sizeof(buf), "%.2f", v / 100.0);
+      break;
+    default:
+      snprintf(buf, sizeof(buf), "%ld", v);
+      break;
+    }
+    out += buf;
+  }
+  return out;
+}
+
+/*
+ * decodes log records, keeps the controller time across frames
+ */
+class LogExpander
+{
+public:
+  explicit LogExpander(LogLanguage lang) : lang_(lang), ms_(0) {}
+
+  /*
+   * expand all records of one TELEMETRY_MSG_LOG payload, on_line(ms, text) is called for each
+   * returns false if the payload is malformed
+   */
+  template<class F> bool expand(const uint8_t* p, size_t len, F on_line)
+  {
+    const uint8_t* end = p + len;
+    while (p < end)
+    {
+      uint8_t header = *p++;
+      unsigned id = header & 0x3F;
+      unsigned argc = header >> 6;
+      uint32_t delta;
+      if (!varint(p, end, delta))
+      {
+        return false;
+      }
+      ms_ += delta;
+      long args[LOG_MAX_ARGS];
+      for (unsigned i = 0; i < argc; i++)
+      {
+        uint32_t v;
+        if (!varint(p, end, v))
+        {
+          return false;
+        }
+        args[i] = (long)(int32_t)((v >> 1) ^ -(int32_t)(v & 1));
+      }
+      if (id < LogMessageCount)
+      {
+        on_line(ms_, log_format(LOG_TEXTS[id][lang_], args, argc));
+      }
+      else
+      {
+        char buf[48];
+        snprintf(buf, sizeof(buf), "unknown message %u (newer firmware?)", id);
+        on_line(ms_, std::string(buf));
+      }
+    }
+    return true;
+  }
+
+private:
+  LogLanguage lang_;
+  uint64_t ms_; // controller millis() of the last record
+
+  static bool varint(const uint8_t*& p, const uint8_t* end, uint32_t& v)
+  {
+    v = 0;
+    for (int shift = 0; p < end && shift < 35; shift += 7)
+    {
+      uint8_t b = *p++;
+      v |= (uint32_t)(b & 0x7F) << shift;
+      if ((b & 0x80) == 0)
+      {
+        return true;
+      }
+    }
+    return false;
+  }
+};
+
+inline std::string log_timestamp(uint64_t ms)
+{
+  char buf[32];
+  snprintf(buf, sizeof(buf), "%4llu:%02llu.%03llu", (unsigned long long)(ms / 60000),
+      (unsigned long long)(ms / 1000 % 60), (unsigned long long)(ms % 1000));
+  return buf;
+}
+
+#endif /* BW_TOOLS_LOGTEXT_H_ */
@@ -0,0 +1,648 @@
+/*
+ * bworch - orchestrator for several controllers on one power circuit
+ *
+ * Talks to every controller over its serial port (or a pty), follows the TELEMETRY_MSG_STATE and
+ * TELEMETRY_MSG_PLAN frames and drives the controllers with the serial commands (serialcmd.h).
+ * All controllers get a mash process, started in the order given. Start times are planned so
+ * that no more than CAP controllers are in a heating step at the same time: the heating windows
+ * of the running controllers come from their timelines (planner.h), a controller that is not
+ * running yet is assumed to heat for LEAD minutes after its start. Prompts are confirmed with
+ * "ok N" on stdin (or automatically with -a), a confirmation that leads into a heating step is
+ * held back until the power is available.
+ *
+ * Everything runs in one thread around epoll: the serial ports, stdin, a timerfd for planned
+ * starts and command timeouts and a signalfd for SIGINT/SIGTERM. Commands are sent to each
+ * controller one at a time, the next one when the previous was answered with OK or ERR.
+ *
+ * Build: g++ -std=c++11 -O2 -Wall -o bworch bworch.cpp
+ * Usage: bworch [-b baud] [-c cap] [-l lead_min] [-r receipe] [-a] DEVICE...
+ *   -r uploads the receipe file (format of REZEPT.TXT) to every controller before the start
+ * stdin: "ok N" confirms the prompt of controller N (1-based), "stop N" stops it, "status"
+ */
+#include <getopt.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <sys/epoll.h>
+#include <sys/signalfd.h>
+#include <sys/timerfd.h>
+#include <time.h>
+
+#include <algorithm>
+#include <deque>
+#include <fstream>
+#include <memory>
+
+#include "bwproto.h"
+
+// Planner::SegmentType, see ../planner.h
+#define PLAN_HEAT 0
+#define PLAN_BOIL_HEAT 4
+
+#define STEP_HEAT 1 // BrewProcess::Heat
+#define STEP_USER_PROMPT 3 // BrewProcess::UserPrompt
+
+#define COMMAND_TIMEOUT_MS 3000 // a command without reply is given up after this time
+
+static int64_t mono_ms()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (int64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+/*
+ * time span in host ms in which a controller draws full power
+ */
+struct Window
+{
+  int64_t from;
+  int64_t to;
+};
+
+struct Unit
+{
+  int id; // 1-based, as used on stdin
+  std::string device;
+  int fd;
+  std::unique_ptr<FrameDecoder> decoder;
+
+  bool have_state = false;
+  telemetry_state_t state;
+
+  // last complete timeline, plan_now is the controller clock when it was sent
+  std::vector<telemetry_plan_entry_t> plan;
+  std::vector<telemetry_plan_entry_t> plan_partial;
+  uint32_t plan_now = 0;
+  int64_t plan_ms = 0;
+
+  std::deque<std::string> commands;
+  std::string pending; // command waiting for its reply
+  int64_t pending_ms = 0;
+
+  bool start_queued = true; // still to be started
+  int64_t planned_start = 0;
+  int64_t announced_start = -1; // last planned start printed
+  bool confirm_requested = false;
+
+  bool running() const { return have_state && (state.flags & TELEMETRY_RUNNING); }
+  bool heating() const { return running() && state.step == STEP_HEAT; }
+  bool prompting() const { return running() && (state.flags & TELEMETRY_NEED_CONFIRMATION); }
+
+  /*
+   * host time of a controller clock time in the timeline
+   */
+  int64_t hostTime(uint32_t eta) const { return plan_ms + ((int64_t)eta - (int64_t)plan_now) * 1000; }
+};
+
+class Orchestrator
+{
+public:
+  Orchestrator(unsigned cap, int64_t lead_ms, bool auto_confirm)
+    : cap_(cap), lead_ms_(lead_ms), auto_confirm_(auto_confirm) {}
+
+  bool addUnit(const std::string& device, int baud)
+  {
+    int fd = serial_open(device.c_str(), baud);
+    if (fd < 0)
+    {
+      fprintf(stderr, "bworch: cannot open %s: %s\n", device.c_str(), strerror(errno));
+      return false;
+    }
+    std::unique_ptr<Unit> u(new Unit());
+    u->id = units_.size() + 1;
+    u->device = device;
+    u->fd = fd;
+    Unit* up = u.get();
+    u->decoder.reset(new FrameDecoder(
+        [this, up](uint8_t type, const uint8_t* payload, size_t len) { onFrame(*up, type, payload, len); },
+        [this, up](const std::string& line) { onText(*up, line); }));
+    units_.push_back(std::move(u));
+    return true;
+  }
+
+  void uploadReceipe(const std::vector<std::string>& lines)
+  {
+    for (auto& u : units_)
+    {
+      u->commands.push_back("rcp begin");
+      for (auto& l : lines)
+      {
+        u->commands.push_back("rcp " + l);
+      }
+      u->commands.push_back("rcp end");
+      sendNext(*u);
+    }
+  }
+
+  int run();
+
+private:
+  unsigned cap_;
+  int64_t lead_ms_;
+  bool auto_confirm_;
+  std::vector<std::unique_ptr<Unit>> units_;
+  int epoll_fd_ = -1;
+  int timer_fd_ = -1;
+  std::string stdin_line_;
+
+  void onFrame(Unit& u, uint8_t type, const uint8_t* payload, size_t len);
+  void onText(Unit& u, const std::string& line);
+  void onStdin(const std::string& line);
+
+  void sendNext(Unit& u);
+  void send(Unit& u, const std::string& cmd)
+  {
+    u.commands.push_back(cmd);
+    sendNext(u);
+  }
+
+  std::vector<Window> heatWindows(const Unit& u, int64_t now) const;
+  unsigned overlapping(const std::vector<Window>& windows, int64_t from, int64_t to) const;
+  void schedule();
+  void armTimer(int64_t at);
+  void printStatus();
+};
+
+void Orchestrator::onFrame(Unit& u, uint8_t type, const uint8_t* payload, size_t len)
+{
+  if (type == TELEMETRY_MSG_STATE && len == sizeof(telemetry_state_t))
+  {
+    memcpy(&u.state, payload, sizeof(u.state));
+    u.have_state = true;
+  }
+  else if (type == TELEMETRY_MSG_PLAN && len >= 6 && (len - 6) % sizeof(telemetry_plan_entry_t) == 0)
+  {
+    telemetry_plan_t rec;
+    memcpy(&rec, payload, len);
+    size_t n = (len - 6) / sizeof(telemetry_plan_entry_t);
+    if (rec.first == 0)
+    {
+      u.plan_partial.clear();
+    }
+    else if (rec.first != u.plan_partial.size())
+    {
+      // lost a frame of this timeline, wait for the next one
+      u.plan_partial.clear();
+      return;
+    }
+    u.plan_partial.insert(u.plan_partial.end(), rec.entries, rec.entries + n);
+    if (u.plan_partial.size() >= rec.total)
+    {
+      u.plan.swap(u.plan_partial);
+      u.plan_partial.clear();
+      u.plan_now = rec.now;
+      u.plan_ms = mono_ms();
+    }
+  }
+}
+
+void Orchestrator::onText(Unit& u, const std::string& line)
+{
+  bool ok = line.compare(0, 2, "OK") == 0;
+  bool err = line.compare(0, 3, "ERR") == 0;
+  if (u.pending.empty() || (!ok && !err))
+  {
+    // output of a multi-line reply, or something the controller printed on its own
+    return;
+  }
+  if (err || u.pending.compare(0, 4, "rcp ") != 0)
+  {
+    printf("%d: %s -> %s\n", u.id, u.pending.c_str(), line.c_str());
+  }
+  if (err && u.pending == "start mash")
+  {
+    // not started, e.g. no receipe: try again with the next planning round
+    u.start_queued = true;
+  }
+  u.pending.clear();
+  sendNext(u);
+}
+
+void Orchestrator::onStdin(const std::string& line)
+{
+  char cmd[16];
+  int id = 0;
+  if (sscanf(line.c_str(), "%15s %d", cmd, &id) < 1)
+  {
+    return;
+  }
+  if (strcmp(cmd, "status") == 0)
+  {
+    printStatus();
+    return;
+  }
+  if (id < 1 || id > (int)units_.size())
+  {
+    printf("unknown controller %d\n", id);
+    return;
+  }
+  Unit& u = *units_[id - 1];
+  if (strcmp(cmd, "ok") == 0)
+  {
+    u.confirm_requested = true;
+  }
+  else if (strcmp(cmd, "stop") == 0)
+  {
+    u.start_queued = false;
+    u.confirm_requested = false;
+    send(u, "stop");
+  }
+  else
+  {
+    printf("commands: ok N, stop N, status\n");
+  }
+}
+
+void Orchestrator::sendNext(Unit& u)
+{
+  if (!u.pending.empty() || u.commands.empty())
+  {
+    return;
+  }
+  u.pending = u.commands.front();
+  u.commands.pop_front();
+  u.pending_ms = mono_ms();
+  std::string line = u.pending + "\n";
+  if (write(u.fd, line.data(), line.size()) != (ssize_t)line.size())
+  {
+    fprintf(stderr, "bworch: %d: write failed: %s\n", u.id, strerror(errno));
+  }
+}
+
+/*
+ * where a controller is expected to heat at full power
+ */
+std::vector<Window> Orchestrator::heatWindows(const Unit& u, int64_t now) const
+{
+  std::vector<Window> w;
+  if (!u.running())
+  {
+    if (!u.start_queued && u.planned_start > now - lead_ms_)
+    {
+      // start sent, no state yet
+      w.push_back(Window{ u.planned_start, u.planned_start + lead_ms_ });
+    }
+    return w;
+  }
+  if (u.plan.empty())
+  {
+    if (u.heating())
+    {
+      w.push_back(Window{ now, now + lead_ms_ });
+    }
+    return w;
+  }
+  for (size_t i = 0; i + 1 < u.plan.size(); i++)
+  {
+    const telemetry_plan_entry_t& e = u.plan[i];
+    if (e.type != PLAN_HEAT && e.type != PLAN_BOIL_HEAT)
+    {
+      continue;
+    }
+    // the first entry is the current segment
+    int64_t from = i == 0 ? now : u.hostTime(e.eta);
+    int64_t to = std::max(from, u.hostTime(u.plan[i + 1].eta));
+    w.push_back(Window{ from, to });
+  }
+  return w;
+}
+
+unsigned Orchestrator::overlapping(const std::vector<Window>& windows, int64_t from, int64_t to) const
+{
+  unsigned n = 0;
+  for (auto& w : windows)
+  {
+    if (w.from < to && w.to > from)
+    {
+      n++;
+    }
+  }
+  return n;
+}
+
+/*
+ * plan the starts of the controllers that are not running yet, issue what is due now
+ */
+void Orchestrator::schedule()
+{
+  int64_t now = mono_ms();
+  int64_t next_timer = 0;
+
+  std::vector<Window> busy;
+  for (auto& u : units_)
+  {
+    std::vector<Window> w = heatWindows(*u, now);
+    busy.insert(busy.end(), w.begin(), w.end());
+  }
+
+  // confirmations first, a running brew goes before one that has not started
+  for (auto& u : units_)
+  {
+    if (auto_confirm_ && u->prompting())
+    {
+      u->confirm_requested = true;
+    }
+    if (!u->confirm_requested || !u->pending.empty())
+    {
+      continue;
+    }
+    if (!u->prompting())
+    {
+      u->confirm_requested = false;
+      continue;
+    }
+    // a prompt that is followed by heating needs the power
+    if (u->plan.size() >= 2 && u->plan[1].type == PLAN_HEAT)
+    {
+      int64_t heat = u->hostTime(u->plan.size() >= 3 ? u->plan[2].eta : u->plan[1].eta) - u->hostTime(u->plan[1].eta);
+      std::vector<Window> own = heatWindows(*u, now);
+      std::vector<Window> others;
+      for (auto& w : busy)
+      {
+        bool is_own = false;
+        for (auto& o : own) is_own |= o.from == w.from && o.to == w.to;
+        if (!is_own) others.push_back(w);
+      }
+      if (overlapping(others, now, now + std::max<int64_t>(heat, 1000)) >= cap_)
+      {
+        continue;
+      }
+    }
+    u->confirm_requested = false;
+    send(*u, "ok");
+  }
+
+  for (auto& u : units_)
+  {
+    if (!u->start_queued || !u->have_state || u->running())
+    {
+      continue;
+    }
+    if (!u->commands.empty() || !u->pending.empty())
+    {
+      // receipe upload still running
+      continue;
+    }
+    // earliest time at which the heat-up overlaps with less than cap_ others
+    int64_t t = now;
+    for (size_t guard = 0; guard <= busy.size() && overlapping(busy, t, t + lead_ms_) >= cap_; guard++)
+    {
+      int64_t next = INT64_MAX;
+      for (auto& w : busy)
+      {
+        if (w.from < t + lead_ms_ && w.to > t)
+        {
+          next = std::min(next, w.to);
+        }
+      }
+      t = next;
+    }
+    if (u->announced_start < 0 || llabs(t - u->announced_start) >= 60000)
+    {
+      printf("%d: start planned in %lld min\n", u->id, (long long)((t - now) / 60000));
+      u->announced_start = t;
+    }
+    u->planned_start = t;
+    busy.push_back(Window{ t, t + lead_ms_ });
+    if (t <= now)
+    {
+      u->start_queued = false;
+      send(*u, "start mash");
+    }
+    else if (next_timer == 0 || t < next_timer)
+    {
+      next_timer = t;
+    }
+  }
+
+  // commands without reply
+  for (auto& u : units_)
+  {
+    if (u->pending.empty())
+    {
+      continue;
+    }
+    int64_t deadline = u->pending_ms + COMMAND_TIMEOUT_MS;
+    if (deadline <= now)
+    {
+      printf("%d: %s -> timeout\n", u->id, u->pending.c_str());
+      u->pending.clear();
+      sendNext(*u);
+      deadline = u->pending.empty() ? 0 : u->pending_ms + COMMAND_TIMEOUT_MS;
+    }
+    if (deadline != 0 && (next_timer == 0 || deadline < next_timer))
+    {
+      next_timer = deadline;
+    }
+  }
+  armTimer(next_timer);
+  fflush(stdout);
+}
+
+void Orchestrator::armTimer(int64_t at)
+{
+  struct itimerspec its;
+  memset(&its, 0, sizeof(its));
+  if (at != 0)
+  {
+    // 0 disarms, so a time in the past becomes 1 ns
+    its.it_value.tv_sec = at / 1000;
+    its.it_value.tv_nsec = (at % 1000) * 1000000 + 1;
+  }
+  timerfd_settime(timer_fd_, TFD_TIMER_ABSTIME, &its, NULL);
+}
+
+void Orchestrator::printStatus()
+{
+  int64_t now = mono_ms();
+  for (auto& u : units_)
+  {
+    printf("%d %s: ", u->id, u->device.c_str());
+    if (!u->have_state)
+    {
+      printf("no state\n");
+      continue;
+    }
+    printf("%s %s/%s %.2f C%s%s", u->running() ? "running" : "idle", phase_name(u->state.phase),
+        step_name(u->state.step), u->state.temp / 100.0, (u->state.flags & TELEMETRY_HEATER) ? " heater" : "",
+        u->prompting() ? " prompt" : "");
+    if (u->start_queued)
+    {
+      printf(", start in %lld min", (long long)(std::max<int64_t>(u->planned_start - now, 0) / 60000));
+    }
+    printf("\n");
+  }
+  fflush(stdout);
+}
+
+int Orchestrator::run()
+{
+  epoll_fd_ = epoll_create1(0);
+  timer_fd_ = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK);
+
+  sigset_t mask;
+  sigemptyset(&mask);
+  sigaddset(&mask, SIGINT);
+  sigaddset(&mask, SIGTERM);
+  sigprocmask(SIG_BLOCK, &mask, NULL);
+  int signal_fd = signalfd(-1, &mask, SFD_NONBLOCK);
+
+  // data.u32: unit index, or one of these
+  const uint32_t EV_STDIN = 0xFFFFFFF0, EV_TIMER = 0xFFFFFFF1, EV_SIGNAL = 0xFFFFFFF2;
+  struct epoll_event ev;
+  ev.events = EPOLLIN;
+  for (size_t i = 0; i < units_.size(); i++)
+  {
+    ev.data.u32 = i;
+    epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, units_[i]->fd, &ev);
+  }
+  ev.data.u32 = EV_STDIN;
+  epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, STDIN_FILENO, &ev);
+  ev.data.u32 = EV_TIMER;
+  epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, timer_fd_, &ev);
+  ev.data.u32 = EV_SIGNAL;
+  epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, signal_fd, &ev);
+
+  size_t open_units = units_.size();
+  bool stdin_open = true;
+  struct epoll_event events[16];
+  uint8_t buf[256];
+  while (open_units > 0)
+  {
+    int n = epoll_wait(epoll_fd_, events, 16, -1);
+    if (n < 0)
+    {
+      if (errno == EINTR) continue;
+      perror("bworch: epoll_wait");
+      return 1;
+    }
+    for (int i = 0; i < n; i++)
+    {
+      uint32_t id = events[i].data.u32;
+      if (id == EV_SIGNAL)
+      {
+        return 0;
+      }
+      if (id == EV_TIMER)
+      {
+        uint64_t expirations;
+        ssize_t r = read(timer_fd_, &expirations, sizeof(expirations));
+        (void)r;
+        continue;
+      }
+      if (id == EV_STDIN)
+      {
+        ssize_t len = read(STDIN_FILENO, buf, sizeof(buf));
+        if (len <= 0)
+        {
+          // no operator, keep running on the plan
+          epoll_ctl(epoll_fd_, EPOLL_CTL_DEL, STDIN_FILENO, NULL);
+          stdin_open = false;
+          continue;
+        }
+        for (ssize_t k = 0; k < len; k++)
+        {
+          if (buf[k] == '\n')
+          {
+            onStdin(stdin_line_);
+            stdin_line_.clear();
+          }
+          else
+          {
+            stdin_line_.push_back(buf[k]);
+          }
+        }
+        continue;
+      }
+      Unit& u = *units_[id];
+      ssize_t len = read(u.fd, buf, sizeof(buf));
+      if (len < 0 && (errno == EAGAIN || errno == EINTR))
+      {
+        continue;
+      }
+      if (len <= 0)
+      {
+        fprintf(stderr, "bworch: %d: %s closed\n", u.id, u.device.c_str());
+        epoll_ctl(epoll_fd_, EPOLL_CTL_DEL, u.fd, NULL);
+        open_units--;
+        continue;
+      }
+      u.decoder->feed(buf, len);
+    }
+    // one planning round per batch of events
+    schedule();
+  }
+  (void)stdin_open;
+  return 0;
+}
+
+static void usage()
+{
+  fprintf(stderr, "usage: bworch [-b baud] [-c cap] [-l lead_min] [-r receipe] [-a] DEVICE...\n");
+  exit(2);
+}
+
+int main(int argc, char** argv)
+{
+  int baud = 9600;
+  unsigned cap = 1;
+  double lead_min = 30;
+  const char* receipe = NULL;
+  bool auto_confirm = false;
+  int opt;
+  while ((opt = getopt(argc, argv, "b:c:l:r:a")) != -1)
+  {
+    switch (opt)
+    {
+    case 'b':
+      baud = atoi(optarg);
+      break;
+    case 'c':
+      cap = atoi(optarg);
+      break;
+    case 'l':
+      lead_min = atof(optarg);
+      break;
+    case 'r':
+      receipe = optarg;
+      break;
+    case 'a':
+      auto_confirm = true;
+      break;
+    default:
+      usage();
+    }
+  }
+  if (optind >= argc || cap < 1)
+  {
+    usage();
+  }
+
+  Orchestrator orch(cap, (int64_t)(lead_min * 60000), auto_confirm);
+  for (int i = optind; i < argc; i++)
+  {
+    if (!orch.addUnit(argv[i], baud))
+    {
+      return 1;
+    }
+  }
+  if (receipe != NULL)
+  {
+    std::ifstream in(receipe);
+    if (!in)
+    {
+      fprintf(stderr, "bworch: cannot open %s\n", receipe);
+      return 1;
+    }
+    std::vector<std::string> lines;
+    std::string line;
+    while (std::getline(in, line))
+    {
+      if (!line.empty() && line.back() == '\r') line.pop_back();
+      if (!line.empty()) lines.push_back(line);
+    }
+    orch.uploadReceipe(lines);
+  }
+  signal(SIGPIPE, SIG_IGN);
+  return orch.run();
+}
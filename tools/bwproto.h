@@ -0,0 +1,210 @@
+/*
+ * Host side of the controller's serial protocol, shared by the tools in this directory.
+ *
+ * - serial_open(): raw 8N1 serial port setup (anything else, e.g. a pty or a file, is used as is)
+ * - FrameDecoder: splits the byte stream at 0x00 delimiters, COBS-decodes and CRC-checks the
+ *   frames defined in ../telemetry.h and passes everything else on as text
+ */
+#ifndef BW_TOOLS_PROTO_H_
+#define BW_TOOLS_PROTO_H_
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <termios.h>
+#include <unistd.h>
+
+#include <functional>
+#include <string>
+#include <vector>
+
+#include "../telemetry.h"
+
+static const char* const PHASE_NAMES[] = { "MashIn", "Rest", "MashOut", "SecondWash", "Boil", "Cool" };
+static const char* const STEP_NAMES[] = { "Start", "Heat", "Hold", "UserPrompt", "Terminated", "Boiling", "Cooling", "Ramp" };
+
+inline const char* phase_name(unsigned phase)
+{
+  return phase < sizeof(PHASE_NAMES) / sizeof(PHASE_NAMES[0]) ? PHASE_NAMES[phase] : "?";
+}
+
+inline const char* step_name(unsigned step)
+{
+  return step < sizeof(STEP_NAMES) / sizeof(STEP_NAMES[0]) ? STEP_NAMES[step] : "?";
+}
+
+inline speed_t baud_constant(int baud)
+{
+  switch (baud)
+  {
+  case 9600: return B9600;
+  case 19200: return B19200;
+  case 38400: return B38400;
+  case 57600: return B57600;
+  case 115200: return B115200;
+  default: return 0;
+  }
+}
+
+/*
+ * open a serial device or pty for reading and writing, a fifo or file ("-" is stdin) for reading
+ * returns the file descriptor or -1, errno is set
+ */
+inline int serial_open(const char* path, int baud)
+{
+  if (strcmp(path, "-") == 0)
+  {
+    return STDIN_FILENO;
+  }
+  // only devices are opened for writing, a fifo held open for writing never reports its end
+  struct stat st;
+  int flags = stat(path, &st) == 0 && S_ISCHR(st.st_mode) ? O_RDWR | O_NOCTTY : O_RDONLY;
+  int fd = open(path, flags | O_NONBLOCK);
+  if (fd < 0)
+  {
+    return -1;
+  }
+  struct termios tio;
+  if (tcgetattr(fd, &tio) == 0)
+  {
+    cfmakeraw(&tio);
+    tio.c_cflag |= CLOCAL | CREAD;
+    tio.c_cc[VMIN] = 1;
+    tio.c_cc[VTIME] = 0;
+    speed_t speed = baud_constant(baud);
+    if (speed != 0)
+    {
+      cfsetispeed(&tio, speed);
+      cfsetospeed(&tio, speed);
+    }
+    tcsetattr(fd, TCSANOW, &tio);
+  }
+  // not a tty: nothing to configure
+  return fd;
+}
+
+/*
+ * decode one COBS block (without delimiters), false if it is malformed
+ */
+inline bool cobs_decode(const uint8_t* in, size_t len, std::vector<uint8_t>& out)
+{
+  out.clear();
+  size_t i = 0;
+  while (i < len)
+  {
+    uint8_t code = in[i++];
+    if (code == 0)
+    {
+      return false;
+    }
+    for (uint8_t j = 1; j < code; j++)
+    {
+      if (i >= len)
+      {
+        return false;
+      }
+      out.push_back(in[i++]);
+    }
+    if (code != 0xFF && i < len)
+    {
+      out.push_back(0);
+    }
+  }
+  return true;
+}
+
+class FrameDecoder
+{
+public:
+  typedef std::function<void(uint8_t type, const uint8_t* payload, size_t len)> FrameHandler;
+  typedef std::function<void(const std::string& line)> TextHandler;
+
+  FrameDecoder(FrameHandler on_frame, TextHandler on_text)
+    : on_frame_(on_frame), on_text_(on_text), crc_errors_(0) {}
+
+  void feed(const uint8_t* data, size_t len)
+  {
+    for (size_t i = 0; i < len; i++)
+    {
+      if (data[i] == 0)
+      {
+        chunk_done();
+      }
+      else if (chunk_.size() < 4096)
+      {
+        chunk_.push_back(data[i]);
+      }
+    }
+  }
+
+  /*
+   * end of input: pass on what is left as text
+   */
+  void finish()
+  {
+    chunk_done();
+    if (!text_.empty())
+    {
+      on_text_(text_);
+      text_.clear();
+    }
+  }
+
+  /*
+   * number of chunks that looked like a frame but failed the CRC
+   */
+  unsigned long crc_errors() const { return crc_errors_; }
+
+private:
+  FrameHandler on_frame_;
+  TextHandler on_text_;
+  std::vector<uint8_t> chunk_;
+  std::vector<uint8_t> decoded_;
+  std::string text_;
+  unsigned long crc_errors_;
+
+  void chunk_done()
+  {
+    if (chunk_.empty())
+    {
+      return;
+    }
+    if (chunk_.size() <= TELEMETRY_MAX_FRAME && cobs_decode(chunk_.data(), chunk_.size(), decoded_) &&
+        decoded_.size() >= 3)
+    {
+      size_t n = decoded_.size() - 2;
+      uint16_t crc = telemetry_crc16(0xFFFF, decoded_.data(), n);
+      if ((crc & 0xFF) == decoded_[n] && (crc >> 8) == decoded_[n + 1])
+      {
+        on_frame_(decoded_[0], decoded_.data() + 1, n - 1);
+        chunk_.clear();
+        return;
+      }
+      // debug text that happens to decode is common, only count chunks of frame size
+      if (n == 1 + sizeof(telemetry_state_t))
+      {
+        crc_errors_++;
+      }
+    }
+    // not a frame: text output of the controller
+    for (size_t i = 0; i < chunk_.size(); i++)
+    {
+      char c = chunk_[i];
+      if (c == '\n')
+      {
+        on_text_(text_);
+        text_.clear();
+      }
+      else if (c != '\r')
+      {
+        text_.push_back(c);
+      }
+    }
+    chunk_.clear();
+  }
+};
+
+#endif /* BW_TOOLS_PROTO_H_ */
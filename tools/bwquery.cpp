@@ -0,0 +1,416 @@
+/*
+ * bwquery - query the brew archive written by bwgate
+ *
+ *   bwquery ARCHIVE list
+ *     one line per brew: id, start, end, samples
+ *   bwquery ARCHIVE window [-f FROM] [-t TO] [-s STEP]
+ *     CSV of all samples in [FROM, TO), across brews. With STEP (seconds) the samples are
+ *     resampled to one row per STEP: mean temperature, last target, heater duty in percent
+ *   bwquery ARCHIVE stats BREW
+ *     per phase and rest: duration, time to reach the target, overshoot above the target
+ *     and heater duty. BREW is an id from "list", a file name or "last"
+ *
+ * Times are "YYYY-MM-DD HH:MM[:SS]" in local time or seconds since the epoch.
+ * Files are read one row group at a time and groups outside the window are skipped,
+ * so the size of the archive does not matter.
+ *
+ * Build: g++ -std=c++11 -O2 -Wall -o bwquery bwquery.cpp
+ */
+#include <getopt.h>
+#include <glob.h>
+#include <limits.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include <algorithm>
+
+#include "bwproto.h"
+#include "bwstore.h"
+
+static std::vector<std::string> brew_files(const std::string& archive)
+{
+  std::vector<std::string> files;
+  glob_t g;
+  if (glob((archive + "/*/brew-*.bwc").c_str(), 0, NULL, &g) == 0)
+  {
+    files.assign(g.gl_pathv, g.gl_pathv + g.gl_pathc);
+  }
+  globfree(&g);
+  // names start with the date, so this is chronological
+  std::sort(files.begin(), files.end(), [](const std::string& a, const std::string& b) {
+    return a.substr(a.rfind('/')) < b.substr(b.rfind('/'));
+  });
+  return files;
+}
+
+static std::string brew_id(const std::string& path)
+{
+  size_t slash = path.rfind('/');
+  std::string name = path.substr(slash == std::string::npos ? 0 : slash + 1);
+  return name.substr(0, name.rfind('.'));
+}
+
+static bool parse_time(const char* s, int64_t& ms)
+{
+  char* end;
+  long long v = strtoll(s, &end, 10);
+  if (*end == '\0')
+  {
+    ms = v * 1000;
+    return true;
+  }
+  struct tm tm;
+  memset(&tm, 0, sizeof(tm));
+  const char* rest = strptime(s, "%Y-%m-%d %H:%M:%S", &tm);
+  if (rest == NULL)
+  {
+    memset(&tm, 0, sizeof(tm));
+    rest = strptime(s, "%Y-%m-%d %H:%M", &tm);
+  }
+  if (rest == NULL)
+  {
+    memset(&tm, 0, sizeof(tm));
+    rest = strptime(s, "%Y-%m-%d", &tm);
+  }
+  if (rest == NULL || *rest != '\0')
+  {
+    return false;
+  }
+  tm.tm_isdst = -1;
+  ms = (int64_t)mktime(&tm) * 1000;
+  return true;
+}
+
+static const char* format_time(int64_t ms)
+{
+  static char buf[32];
+  time_t t = ms / 1000;
+  struct tm tm;
+  localtime_r(&t, &tm);
+  strftime(buf, sizeof(buf), "%Y-%m-%d %H:%M:%S", &tm);
+  return buf;
+}
+
+static const char* format_duration(int64_t ms)
+{
+  static char buf[32];
+  if (ms < 0)
+  {
+    return "-";
+  }
+  long s = ms / 1000;
+  snprintf(buf, sizeof(buf), "%ld:%02ld:%02ld", s / 3600, s / 60 % 60, s % 60);
+  return buf;
+}
+
+static int cmd_list(const std::string& archive)
+{
+  printf("%-36s %-19s  %-19s  %8s\n", "brew", "start", "end", "samples");
+  std::vector<std::string> files = brew_files(archive);
+  for (size_t i = 0; i < files.size(); i++)
+  {
+    BrewReader reader;
+    if (!reader.open(files[i]))
+    {
+      fprintf(stderr, "bwquery: %s: not a brew file\n", files[i].c_str());
+      continue;
+    }
+    bwc_group_header_t h;
+    int64_t first = -1, last = -1;
+    unsigned long rows = 0;
+    while (reader.next(h) && reader.skip())
+    {
+      if (first < 0)
+      {
+        first = h.t_first;
+      }
+      last = h.t_last;
+      rows += h.rows;
+    }
+    printf("%-36s %-19s  ", brew_id(files[i]).c_str(), first < 0 ? "-" : format_time(first));
+    printf("%-19s  %8lu\n", last < 0 ? "-" : format_time(last), rows);
+  }
+  return 0;
+}
+
+/*
+ * accumulates the samples of one resampling interval
+ */
+struct bucket_t {
+  int64_t start;
+  unsigned n;
+  unsigned heater;
+  double temp_sum;
+  sample_t last;
+};
+
+static void print_row(int64_t t, double temp, int16_t target, double heater, const sample_t& s)
+{
+  printf("%s,%.2f,", format_time(t), temp);
+  if (target >= 0)
+  {
+    printf("%.2f", target / 100.0);
+  }
+  printf(",%.0f,%s,%s,%u\n", heater, phase_name(s.phase), step_name(s.step), s.rest + 1);
+}
+
+static void flush_bucket(bucket_t& b)
+{
+  if (b.n > 0)
+  {
+    print_row(b.start, b.temp_sum / b.n / 100.0, b.last.target, 100.0 * b.heater / b.n, b.last);
+  }
+  b.n = 0;
+  b.heater = 0;
+  b.temp_sum = 0;
+}
+
+static int cmd_window(const std::string& archive, int64_t from, int64_t to, int64_t step_ms)
+{
+  printf("time,temp,target,heater,phase,step,rest\n");
+  std::vector<std::string> files = brew_files(archive);
+  std::vector<sample_t> rows;
+  bucket_t bucket;
+  bucket.n = 0;
+  bucket.start = 0;
+  flush_bucket(bucket);
+  for (size_t i = 0; i < files.size(); i++)
+  {
+    BrewReader reader;
+    if (!reader.open(files[i]))
+    {
+      continue;
+    }
+    bwc_group_header_t h;
+    while (reader.next(h))
+    {
+      if (h.t_last < from || h.t_first >= to)
+      {
+        if (!reader.skip())
+        {
+          break;
+        }
+        continue;
+      }
+      if (!reader.read(h, rows))
+      {
+        fprintf(stderr, "bwquery: %s: corrupt row group\n", files[i].c_str());
+        break;
+      }
+      for (size_t r = 0; r < rows.size(); r++)
+      {
+        const sample_t& s = rows[r];
+        if (s.t_ms < from || s.t_ms >= to)
+        {
+          continue;
+        }
+        if (step_ms <= 0)
+        {
+          print_row(s.t_ms, s.temp / 100.0, s.target, s.heater ? 100 : 0, s);
+          continue;
+        }
+        int64_t start = s.t_ms - s.t_ms % step_ms;
+        if (bucket.n > 0 && start != bucket.start)
+        {
+          flush_bucket(bucket);
+        }
+        bucket.start = start;
+        bucket.n++;
+        bucket.heater += s.heater;
+        bucket.temp_sum += s.temp;
+        bucket.last = s;
+      }
+    }
+  }
+  flush_bucket(bucket);
+  return 0;
+}
+
+/*
+ * statistics of one segment of a brew, a segment being a phase or one rest
+ */
+struct segment_t {
+  uint8_t phase;
+  uint8_t rest;
+  int64_t start;
+  int64_t end;
+  int16_t target;
+  int64_t reached; // first time at or above the target, -1 if never
+  int16_t max_temp; // after reaching the target
+  int64_t heater_ms;
+};
+
+static void print_segment(const segment_t& seg)
+{
+  char name[32];
+  if (seg.phase == 1)
+  {
+    snprintf(name, sizeof(name), "%s %u", phase_name(seg.phase), seg.rest + 1);
+  }
+  else
+  {
+    snprintf(name, sizeof(name), "%s", phase_name(seg.phase));
+  }
+  int64_t duration = seg.end - seg.start;
+  printf("%-12s %-19s %9s", name, format_time(seg.start), format_duration(duration));
+  if (seg.target >= 0)
+  {
+    printf(" %7.2f", seg.target / 100.0);
+  }
+  else
+  {
+    printf(" %7s", "-");
+  }
+  printf(" %9s", format_duration(seg.reached < 0 ? -1 : seg.reached - seg.start));
+  if (seg.reached >= 0 && seg.target >= 0)
+  {
+    printf(" %9.2f", std::max(0, seg.max_temp - seg.target) / 100.0);
+  }
+  else
+  {
+    printf(" %9s", "-");
+  }
+  printf(" %6.1f%%\n", duration > 0 ? 100.0 * seg.heater_ms / duration : 0.0);
+}
+
+static int cmd_stats(const std::string& archive, const std::string& brew)
+{
+  std::string path;
+  std::vector<std::string> files = brew_files(archive);
+  if (brew == "last" && !files.empty())
+  {
+    path = files.back();
+  }
+  for (size_t i = 0; path.empty() && i < files.size(); i++)
+  {
+    if (brew_id(files[i]) == brew_id(brew))
+    {
+      path = files[i];
+    }
+  }
+  BrewReader reader;
+  if (path.empty() || !reader.open(path))
+  {
+    fprintf(stderr, "bwquery: no brew %s in %s\n", brew.c_str(), archive.c_str());
+    return 1;
+  }
+
+  printf("%-12s %-19s %9s %7s %9s %9s %7s\n", "segment", "start", "duration", "target", "to_target", "overshoot",
+      "heater");
+  segment_t seg;
+  bool in_segment = false;
+  sample_t prev;
+  std::vector<sample_t> rows;
+  bwc_group_header_t h;
+  while (reader.next(h) && reader.read(h, rows))
+  {
+    for (size_t r = 0; r < rows.size(); r++)
+    {
+      const sample_t& s = rows[r];
+      if (in_segment)
+      {
+        // time-weighted: the heater state holds until the next sample
+        if (prev.heater)
+        {
+          seg.heater_ms += s.t_ms - prev.t_ms;
+        }
+        seg.end = s.t_ms;
+        if (s.phase != seg.phase || s.rest != seg.rest)
+        {
+          print_segment(seg);
+          in_segment = false;
+        }
+      }
+      if (!in_segment)
+      {
+        seg.phase = s.phase;
+        seg.rest = s.rest;
+        seg.start = s.t_ms;
+        seg.end = s.t_ms;
+        seg.target = s.target;
+        seg.reached = -1;
+        seg.max_temp = INT16_MIN;
+        seg.heater_ms = 0;
+        in_segment = true;
+      }
+      if (s.target >= 0)
+      {
+        seg.target = s.target;
+      }
+      if (seg.reached < 0 && seg.target >= 0 && s.temp >= seg.target)
+      {
+        seg.reached = s.t_ms;
+      }
+      if (seg.reached >= 0)
+      {
+        seg.max_temp = std::max(seg.max_temp, s.temp);
+      }
+      prev = s;
+    }
+  }
+  if (in_segment)
+  {
+    print_segment(seg);
+  }
+  return 0;
+}
+
+static void usage()
+{
+  fprintf(stderr,
+      "usage: bwquery ARCHIVE list\n"
+      "       bwquery ARCHIVE window [-f FROM] [-t TO] [-s STEP]\n"
+      "       bwquery ARCHIVE stats BREW\n");
+  exit(2);
+}
+
+int main(int argc, char** argv)
+{
+  if (argc < 3)
+  {
+    usage();
+  }
+  std::string archive = argv[1];
+  std::string cmd = argv[2];
+
+  if (cmd == "list" && argc == 3)
+  {
+    return cmd_list(archive);
+  }
+  if (cmd == "stats" && argc == 4)
+  {
+    return cmd_stats(archive, argv[3]);
+  }
+  if (cmd != "window")
+  {
+    usage();
+  }
+
+  int64_t from = INT64_MIN, to = INT64_MAX, step = 0;
+  int opt;
+  optind = 3;
+  while ((opt = getopt(argc, argv, "f:t:s:")) != -1)
+  {
+    switch (opt)
+    {
+    case 'f':
+      if (!parse_time(optarg, from))
+      {
+        usage();
+      }
+      break;
+    case 't':
+      if (!parse_time(optarg, to))
+      {
+        usage();
+      }
+      break;
+    case 's':
+      step = atol(optarg) * 1000;
+      break;
+    default:
+      usage();
+    }
+  }
+  return cmd_window(archive, from, to, step);
+}
@@ -0,0 +1,757 @@
+/*
+ * bwreplay - replay a recording of the controller's inputs
+ *
+ * Reads a capture of the controller's serial output and takes the TELEMETRY_MSG_RECORD frames
+ * of the recorder (../recorder.h) from a reset on. The tasks of brauwerkstatt.ino are run through
+ * the firmware sources in the recorded order, with the recorded clock, temperatures, encoder
+ * events, serial input and EEPROM contents, as fast as the host can. Heater
+ * commands and step transitions of the replay are compared with the recorded ones, every
+ * difference is printed with the controller time (minutes:seconds since reset) and the task.
+ * The replay ends where frames or records were lost.
+ *
+ * The replay has to be built from the same tree, brauwerkstatt.h included, as the firmware that
+ * made the recording. The clock stands still while a task runs, at the time the task started, as
+ * rec_millis() and rec_now() do on the controller. Nothing is drawn, the display is always ready
+ * for the next frame.
+ *
+ * Build (in tools/, with RECORDER defined in ../brauwerkstatt.h), one command:
+ *   g++ -std=gnu++11 -O2 -Wall -Wextra -Ireplay -I.. -DARDUINO=10800 -DEEPROM_RECEIPE_OFFSET=128 -o bwreplay bwreplay.cpp \
+ *     ../brewproc.cpp ../brewui.cpp ../encoder.cpp ../planner.cpp ../program.cpp \
+ *     ../serialcmd.cpp ../uistrings.cpp ../log.cpp ../telemetry.cpp
+ * Usage: bwreplay [-r reset] [-n max] [-f receipe] [-v] CAPTURE
+ *   CAPTURE is a file with the serial output, e.g. from "cat /dev/ttyUSB0 > brew.cap" on a port
+ *   set to raw 9600 baud, or "-" for stdin
+ *   -f  the receipe file (REZEPT.TXT) of the SD card, only its length and CRC are recorded
+ *   -r  replay the recording that begins with the n-th reset in the capture (default 1)
+ *   -n  stop after max differences (default 10)
+ *   -v  print the heater commands and step transitions of the replay
+ * Exit status: 0 no differences, 1 differences, 2 usage, 3 no recording to replay
+ */
+#include <getopt.h>
+#include <poll.h>
+#include <stdarg.h>
+#include <stdlib.h>
+
+#include "bwproto.h"
+
+#include <EEPROM.h>
+
+#include "lcdqueue.h"
+#include "brewproc.h"
+#include "brewui.h"
+#include "memstat.h"
+#include "planner.h"
+#include "recorder.h"
+#include "scheduler.h"
+#include "serialcmd.h"
+
+#ifndef RECORDER
+#error "bwreplay needs the recorder taps, define RECORDER in brauwerkstatt.h"
+#endif
+
+struct record_t {
+  uint8_t type; // RecordType
+  uint8_t arg;
+  uint64_t ms; // controller clock
+  std::vector<uint8_t> data; // payload
+  bool used; // taken by the replay
+};
+
+struct recording_t {
+  std::vector<uint8_t> stream; // record bytes of all frames
+  bool lost_frames;
+};
+
+static const char* const TASK_NAMES[] = { "setup", "sensor", "control", "ui", "persist", "serial" };
+
+// ====================================================
+// recording
+// ====================================================
+static bool get_varint(const uint8_t* p, size_t len, size_t& pos, uint64_t& v)
+{
+  v = 0;
+  for (unsigned shift = 0; pos < len && shift < 64; shift += 7)
+  {
+    uint8_t b = p[pos++];
+    v |= (uint64_t)(b & 0x7F) << shift;
+    if (!(b & 0x80))
+    {
+      return true;
+    }
+  }
+  return false;
+}
+
+/*
+ * split the record stream into records, false if it ends in the middle of one
+ */
+static bool parse_records(const std::vector<uint8_t>& s, std::vector<record_t>& records)
+{
+  const uint8_t* p = s.data();
+  size_t pos = 0;
+  uint64_t ms = 0;
+  while (pos < s.size())
+  {
+    record_t r;
+    r.type = p[pos] >> 4;
+    r.arg = p[pos] & 0x0F;
+    r.used = false;
+    pos++;
+    uint64_t delta, v;
+    if (!get_varint(p, s.size(), pos, delta))
+    {
+      return false;
+    }
+    ms += delta;
+    r.ms = ms;
+
+    // payload length
+    size_t end = pos;
+    switch (r.type)
+    {
+    case RecTask:
+    case RecResult:
+    case RecHeater:
+      break;
+    case RecSerial:
+      end += r.arg;
+      break;
+    case RecTemp:
+    case RecStep:
+      end += 2;
+      break;
+    case RecClock:
+    case RecLost:
+      if (!get_varint(p, s.size(), end, v))
+      {
+        return false;
+      }
+      break;
+    case RecInput:
+      end++;
+      if (!get_varint(p, s.size(), end, v))
+      {
+        return false;
+      }
+      break;
+    case RecEeprom:
+      if (!get_varint(p, s.size(), end, v) || end >= s.size())
+      {
+        return false;
+      }
+      end += 1 + p[end];
+      break;
+    case RecFile:
+      if (!get_varint(p, s.size(), end, v))
+      {
+        return false;
+      }
+      end += 2;
+      break;
+    default:
+      fprintf(stderr, "bwreplay: unknown record type %u\n", r.type);
+      return false;
+    }
+    if (end > s.size())
+    {
+      return false;
+    }
+    r.data.assign(p + pos, p + end);
+    pos = end;
+    records.push_back(r);
+  }
+  return true;
+}
+
+// ====================================================
+// replay state
+// ====================================================
+static std::vector<record_t> records;
+static size_t window_begin = 0; // records of the running task
+static size_t window_end = 0;
+static uint64_t clock_ms = 0;
+static unsigned long clock_now = 0; // now() of the Time library
+static const char* task_name = "";
+static unsigned differences = 0;
+static bool verbose = false;
+// serial input is recorded as it comes in, the commands are only run in the task that reads the line end
+static size_t serial_record = 0;
+static size_t serial_byte = 0;
+// the receipe file of the SD card
+static std::vector<uint8_t> receipe;
+static bool have_receipe = false;
+static size_t receipe_pos = 0;
+
+static std::string timestamp(uint64_t ms)
+{
+  char buf[32];
+  snprintf(buf, sizeof(buf), "%4llu:%02llu.%03llu", (unsigned long long)(ms / 60000),
+      (unsigned long long)(ms / 1000 % 60), (unsigned long long)(ms % 1000));
+  return buf;
+}
+
+static void difference(const char* fmt, ...)
+{
+  va_list ap;
+  va_start(ap, fmt);
+  printf("%s %-7s ", timestamp(clock_ms).c_str(), task_name);
+  vprintf(fmt, ap);
+  printf("\n");
+  va_end(ap);
+  differences++;
+}
+
+static std::string describe(const record_t& r)
+{
+  char buf[64];
+  switch (r.type)
+  {
+  case RecClock:
+    snprintf(buf, sizeof(buf), "clock");
+    break;
+  case RecTemp:
+    snprintf(buf, sizeof(buf), "temperature of channel %u", r.arg);
+    break;
+  case RecInput:
+    snprintf(buf, sizeof(buf), "encoder event %u", r.arg);
+    break;
+  case RecSerial:
+    snprintf(buf, sizeof(buf), "%u bytes of serial input", r.arg);
+    break;
+  case RecResult:
+    snprintf(buf, sizeof(buf), "SD card result %u", r.arg);
+    break;
+  case RecEeprom:
+    snprintf(buf, sizeof(buf), "EEPROM contents");
+    break;
+  case RecFile:
+    snprintf(buf, sizeof(buf), "end of the receipe file");
+    break;
+  case RecHeater:
+    snprintf(buf, sizeof(buf), "heater %u %s", r.arg >> 1, (r.arg & 1) ? "on" : "off");
+    break;
+  case RecStep:
+    snprintf(buf, sizeof(buf), "step %s (%s, pc %u)", step_name(r.arg), phase_name(r.data[0]), r.data[1]);
+    break;
+  default:
+    snprintf(buf, sizeof(buf), "record type %u", r.type);
+    break;
+  }
+  return buf;
+}
+
+/*
+ * the next record of a type in the window of the running task, NULL if there is none
+ */
+static record_t* find(uint8_t type)
+{
+  for (size_t i = window_begin; i < window_end; i++)
+  {
+    if (records[i].type == type && !records[i].used)
+    {
+      return &records[i];
+    }
+  }
+  return NULL;
+}
+
+/*
+ * take an input the firmware reads every time, it is a difference if there is none
+ */
+static record_t* take_input(uint8_t type, const char* what)
+{
+  record_t* r = find(type);
+  if (r == NULL)
+  {
+    difference("reads %s, not recorded", what);
+    return NULL;
+  }
+  r->used = true;
+  return r;
+}
+
+/*
+ * compare an output of the replay with the next recorded one of its type
+ */
+static void compare_output(uint8_t type, const record_t& replayed)
+{
+  std::string what = describe(replayed);
+  if (verbose)
+  {
+    printf("%s %-7s %s\n", timestamp(clock_ms).c_str(), task_name, what.c_str());
+  }
+  record_t* r = find(type);
+  if (r == NULL)
+  {
+    difference("%s, not recorded", what.c_str());
+    return;
+  }
+  r->used = true;
+  if (r->arg != replayed.arg || r->data != replayed.data)
+  {
+    difference("%s, recorded %s", what.c_str(), describe(*r).c_str());
+  }
+}
+
+// ====================================================
+// recorder taps, they return the recorded input
+// ====================================================
+unsigned long rec_millis()
+{
+  return clock_ms;
+}
+
+unsigned long rec_now()
+{
+  return clock_now;
+}
+
+void rec_set_time(unsigned long t)
+{
+  clock_now = t;
+}
+
+float rec_temp(byte ch, float temp)
+{
+  record_t* r = take_input(RecTemp, "a temperature");
+  if (r == NULL)
+  {
+    return temp;
+  }
+  if (r->arg != ch)
+  {
+    difference("reads the temperature of channel %u, recorded channel %u", ch, r->arg);
+  }
+  int16_t t = r->data[0] | r->data[1] << 8;
+  return t == REC_NO_TEMP ? NAN : t / 128.0F;
+}
+
+bool rec_input(bool /* read */, input_event_t& event)
+{
+  record_t* r = find(RecInput);
+  if (r == NULL)
+  {
+    return false;
+  }
+  r->used = true;
+  uint64_t micros;
+  size_t pos = 1;
+  get_varint(r->data.data(), r->data.size(), pos, micros);
+  event.type = r->arg;
+  event.steps = (int8_t)r->data[0];
+  event.micros = micros;
+  return true;
+}
+
+/*
+ * the next record with serial input that is not taken yet, up to the end of the task's window
+ */
+static record_t* serial_input()
+{
+  for (; serial_record < window_end; serial_record++)
+  {
+    if (records[serial_record].type == RecSerial && !records[serial_record].used)
+    {
+      return &records[serial_record];
+    }
+  }
+  return NULL;
+}
+
+int rec_serial(int c)
+{
+  record_t* r = serial_input();
+  if (r == NULL)
+  {
+    return -1;
+  }
+  c = r->data[serial_byte++];
+  if (serial_byte == r->data.size())
+  {
+    r->used = true;
+    serial_byte = 0;
+  }
+  return c;
+}
+
+byte rec_result(byte result)
+{
+  record_t* r = take_input(RecResult, "an SD card result");
+  return r != NULL ? r->arg : result;
+}
+
+void rec_eeprom(int offset, byte* data, int size)
+{
+  for (int i = 0; i < size; i += REC_MAX_DATA)
+  {
+    int len = min(size - i, REC_MAX_DATA);
+    record_t* r = take_input(RecEeprom, "the EEPROM");
+    if (r == NULL)
+    {
+      return;
+    }
+    uint64_t rec_offset;
+    size_t pos = 0;
+    get_varint(r->data.data(), r->data.size(), pos, rec_offset);
+    if (rec_offset != (uint64_t)(offset + i) || r->data[pos] != len)
+    {
+      difference("reads %d bytes of the EEPROM at %d, recorded %u at %llu",
+          len, offset + i, r->data[pos], (unsigned long long)rec_offset);
+      return;
+    }
+    memcpy(data + i, &r->data[pos + 1], len);
+  }
+}
+
+unsigned int rec_file(char* /* buf */, unsigned int cnt)
+{
+  if (cnt > 0)
+  {
+    return cnt;
+  }
+
+  // at the end: is it the file the controller read?
+  record_t* r = take_input(RecFile, "the end of the receipe file");
+  if (r == NULL || !have_receipe)
+  {
+    return 0;
+  }
+  uint64_t len;
+  size_t pos = 0;
+  get_varint(r->data.data(), r->data.size(), pos, len);
+  uint16_t crc = r->data[pos] | r->data[pos + 1] << 8;
+  uint16_t replayed = 0xFFFF;
+  for (size_t i = 0; i < receipe.size(); i += 0xFF)
+  {
+    replayed = telemetry_crc16(replayed, receipe.data() + i, min(receipe.size() - i, (size_t)0xFF));
+  }
+  if (len != receipe.size() || crc != replayed)
+  {
+    difference("the receipe file is not the one recorded (%llu bytes, CRC %04x)", (unsigned long long)len, crc);
+  }
+  return 0;
+}
+
+void rec_heater(byte outlet, bool on)
+{
+  record_t replayed = { RecHeater, (uint8_t)(outlet << 1 | on), clock_ms, {}, false };
+  compare_output(RecHeater, replayed);
+}
+
+void rec_step(byte phase, byte step, byte pc)
+{
+  record_t replayed = { RecStep, step, clock_ms, { phase, pc }, false };
+  compare_output(RecStep, replayed);
+}
+
+// ====================================================
+// the controller
+// ====================================================
+unsigned long millis() { return clock_ms; }
+unsigned long micros() { return clock_ms * 1000; }
+unsigned long now() { return clock_now; }
+
+FRESULT pf_mount(FATFS* /* fs */)
+{
+  return FR_NOT_READY;
+}
+
+FRESULT pf_open(const char* /* path */)
+{
+  receipe_pos = 0;
+  return FR_OK;
+}
+
+FRESULT pf_read(void* buf, unsigned int btr, unsigned int* br)
+{
+  if (!have_receipe)
+  {
+    difference("reads the receipe file, it is given with -f");
+    *br = 0;
+    return FR_NOT_READY;
+  }
+  *br = min(btr, (unsigned int)(receipe.size() - receipe_pos));
+  memcpy(buf, receipe.data() + receipe_pos, *br);
+  receipe_pos += *br;
+  return FR_OK;
+}
+
+HardwareSerial Serial;
+EEPROMClass EEPROM;
+volatile uint8_t PIND, PCICR, PCMSK2, PCIFR;
+
+LcdQueue::LcdQueue(byte) {}
+void LcdQueue::init() {}
+void LcdQueue::backlight() {}
+void LcdQueue::noBacklight() {}
+void LcdQueue::clear() {}
+void LcdQueue::setCursor(byte, byte) {}
+void LcdQueue::print(char) {}
+byte LcdQueue::room() { return LCD_QUEUE_SIZE; }
+bool LcdQueue::idle() { return true; }
+void LcdQueue::service() {}
+
+void Scheduler::printStats() {}
+void mem_report() {}
+
+// the objects of brauwerkstatt.ino
+OneWire one_wire(TEMP_SENSOR_PIN);
+DallasTemperature temp_sensor(&one_wire);
+LcdQueue lcd(LCD_ADDRESS);
+NewRemoteTransmitter rf_sender(RF_TRANSMITTER_ID, RF_TRANSMITTER_PIN, RF_TRANSMITTER_PULSE_LENGTH_US, RF_TRANSMITTER_REPEATS);
+
+BrewProcess brewProc(&temp_sensor, &rf_sender);
+Planner planner(&brewProc);
+BrewUi brewUi(&brewProc, &planner, &lcd, ENC_A_PIN, ENC_B_PIN, ENC_SW_PIN);
+#ifdef SERIAL_COMMANDS
+Scheduler scheduler;
+SerialCommand serialCmd(&brewProc, &planner, &scheduler);
+#endif
+
+static void run_task(uint8_t task)
+{
+  switch (task)
+  {
+  case RecTaskSetup:
+    brewProc.init();
+    brewUi.init();
+    break;
+  case RecTaskSensor:
+    brewProc.update_sensor();
+    break;
+  case RecTaskControl:
+    brewProc.update_control();
+    planner.update();
+    break;
+  case RecTaskUi:
+    brewUi.update_ui();
+    break;
+  case RecTaskPersist:
+    brewProc.update_persistence();
+    break;
+#ifdef SERIAL_COMMANDS
+  case RecTaskSerial:
+    // listings of earlier commands continued in runs without input, which are not recorded
+    for (int n = 0; n < 256 && serial_input() != NULL; n++)
+    {
+      serialCmd.service();
+    }
+    break;
+#endif
+  default:
+    difference("unknown task %u", task);
+    break;
+  }
+}
+
+/*
+ * run the tasks, returns false when it stopped at max differences
+ */
+static bool replay(unsigned max_differences, unsigned long& tasks)
+{
+  size_t i = 0;
+  while (i < records.size())
+  {
+    const record_t& r = records[i];
+    clock_ms = r.ms;
+    if (r.type == RecLost)
+    {
+      uint64_t lost;
+      size_t pos = 0;
+      get_varint(r.data.data(), r.data.size(), pos, lost);
+      printf("%s %llu records lost, the replay ends here\n", timestamp(r.ms).c_str(), (unsigned long long)lost);
+      return true;
+    }
+    window_begin = i + 1;
+    window_end = window_begin;
+    while (window_end < records.size() && records[window_end].type != RecTask && records[window_end].type != RecLost)
+    {
+      window_end++;
+    }
+    if (window_end == records.size() || records[window_end].type == RecLost)
+    {
+      // the capture ends somewhere in the records of this task, or some of them were lost
+      i = window_end;
+      continue;
+    }
+    if (r.type != RecTask)
+    {
+      task_name = "";
+      difference("%s outside of a task", describe(r).c_str());
+      i++;
+      continue;
+    }
+
+    task_name = r.arg < sizeof(TASK_NAMES) / sizeof(TASK_NAMES[0]) ? TASK_NAMES[r.arg] : "?";
+    if (window_begin < window_end && records[window_begin].type == RecClock)
+    {
+      // zigzag encoded change
+      uint64_t v;
+      size_t pos = 0;
+      get_varint(records[window_begin].data.data(), records[window_begin].data.size(), pos, v);
+      clock_now += (unsigned long)((v >> 1) ^ -(v & 1));
+      records[window_begin].used = true;
+    }
+    run_task(r.arg);
+    tasks++;
+    for (size_t j = window_begin; j < window_end; j++)
+    {
+      // serial input is taken by a later task
+      if (!records[j].used && records[j].type != RecSerial)
+      {
+        bool output = records[j].type == RecHeater || records[j].type == RecStep;
+        difference("recorded %s, %s", describe(records[j]).c_str(), output ? "not replayed" : "not read");
+      }
+    }
+    if (differences >= max_differences)
+    {
+      return false;
+    }
+    i = window_end;
+  }
+  return true;
+}
+
+static void usage()
+{
+  fprintf(stderr, "usage: bwreplay [-r reset] [-n max] [-f receipe] [-v] CAPTURE\n");
+  exit(2);
+}
+
+int main(int argc, char** argv)
+{
+  unsigned reset = 1;
+  unsigned max_differences = 10;
+  int opt;
+  const char* receipe_path = NULL;
+  while ((opt = getopt(argc, argv, "r:n:f:v")) != -1)
+  {
+    switch (opt)
+    {
+    case 'r':
+      reset = atoi(optarg);
+      break;
+    case 'n':
+      max_differences = atoi(optarg);
+      break;
+    case 'f':
+      receipe_path = optarg;
+      break;
+    case 'v':
+      verbose = true;
+      break;
+    default:
+      usage();
+    }
+  }
+  if (argc - optind != 1 || reset < 1 || max_differences < 1)
+  {
+    usage();
+  }
+
+  if (receipe_path != NULL)
+  {
+    FILE* f = fopen(receipe_path, "rb");
+    if (f == NULL)
+    {
+      fprintf(stderr, "bwreplay: cannot open %s: %s\n", receipe_path, strerror(errno));
+      return 2;
+    }
+    int c;
+    while ((c = fgetc(f)) != EOF)
+    {
+      receipe.push_back(c);
+    }
+    fclose(f);
+    have_receipe = true;
+  }
+
+  int fd = serial_open(argv[optind], 9600);
+  if (fd < 0)
+  {
+    fprintf(stderr, "bwreplay: cannot open %s: %s\n", argv[optind], strerror(errno));
+    return 2;
+  }
+
+  // one recording per reset, sequence number 0 starts a new one
+  std::vector<recording_t> recordings;
+  unsigned expected = 0;
+  FrameDecoder decoder(
+      [&recordings, &expected](uint8_t type, const uint8_t* payload, size_t len) {
+        if (type != TELEMETRY_MSG_RECORD || len < 1)
+        {
+          return;
+        }
+        if (payload[0] == 0)
+        {
+          recordings.push_back(recording_t());
+          recordings.back().lost_frames = false;
+        }
+        else if (recordings.empty() || recordings.back().lost_frames)
+        {
+          return;
+        }
+        else if (payload[0] != expected)
+        {
+          // records span frames, the rest of the stream cannot be split up any more
+          recordings.back().lost_frames = true;
+          return;
+        }
+        recordings.back().stream.insert(recordings.back().stream.end(), payload + 1, payload + len);
+        expected = payload[0] == 0xFF ? 1 : payload[0] + 1;
+      },
+      [](const std::string&) {});
+
+  uint8_t buf[256];
+  while (true)
+  {
+    struct pollfd pfd = { fd, POLLIN, 0 };
+    if (poll(&pfd, 1, -1) < 0)
+    {
+      if (errno == EINTR)
+      {
+        continue;
+      }
+      perror("bwreplay: poll");
+      return 2;
+    }
+    ssize_t len = read(fd, buf, sizeof(buf));
+    if (len < 0 && (errno == EAGAIN || errno == EINTR))
+    {
+      continue;
+    }
+    if (len <= 0)
+    {
+      break;
+    }
+    decoder.feed(buf, len);
+  }
+  decoder.finish();
+
+  if (recordings.size() < reset)
+  {
+    fprintf(stderr, "bwreplay: %zu recordings from a reset in %s\n", recordings.size(), argv[optind]);
+    return 3;
+  }
+  const recording_t& recording = recordings[reset - 1];
+  // the capture may end in the middle of a record
+  parse_records(recording.stream, records);
+  if (records.empty() || records[0].type != RecTask || records[0].arg != RecTaskSetup)
+  {
+    fprintf(stderr, "bwreplay: the recording does not start with the setup\n");
+    return 3;
+  }
+
+  unsigned long tasks = 0;
+  bool finished = replay(max_differences, tasks);
+  if (!finished)
+  {
+    printf("stopped after %u differences\n", differences);
+  }
+  else if (recording.lost_frames)
+  {
+    printf("%s frames lost, the replay ends here\n", timestamp(records.back().ms).c_str());
+  }
+  printf("%lu tasks in %s replayed, %u differences\n", tasks, timestamp(clock_ms).c_str(), differences);
+  return differences > 0 ? 1 : 0;
+}
@@ -0,0 +1,413 @@
+/*
+ * Columnar per-brew archive files
+ *
+ * One file per brew: a file header followed by row groups. Each row group holds up to a few
+ * hundred samples, stored column by column:
+ *   time          host clock in ms, zigzag varint deltas (first one relative to the group's t_first)
+ *   temp, target  1/100 C, zigzag varint deltas (first one relative to 0)
+ *   heater, phase, step, rest, flags
+ *                 run-length encoded as (value byte, run length varint) pairs
+ * The group header carries the time range and the size of each column, so readers can skip
+ * groups outside a query window with one seek and never need more than one group in memory.
+ * A writer only ever appends complete groups. A group cut short by a crash ends the file for the
+ * readers, so a writer that resumes a file cuts it back to its last complete group first.
+ */
+#ifndef BW_TOOLS_STORE_H_
+#define BW_TOOLS_STORE_H_
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <string>
+#include <vector>
+
+#define BWC_MAGIC "BWC1"
+#define BWC_GROUP_MAGIC 0x4752 // "RG"
+#define BWC_GROUP_ROWS 600 // 10 minutes of 1 Hz telemetry
+
+struct sample_t {
+  int64_t t_ms; // host clock, ms since the epoch
+  int16_t temp; // 1/100 C
+  int16_t target; // 1/100 C, negative if there is none
+  uint8_t heater;
+  uint8_t phase;
+  uint8_t step;
+  uint8_t rest;
+  uint8_t flags; // TELEMETRY_* flags
+};
+
+enum Column { ColTime, ColTemp, ColTarget, ColHeater, ColPhase, ColStep, ColRest, ColFlags, NumColumns };
+
+struct bwc_file_header_t {
+  char magic[4];
+  uint32_t process_start; // controller clock at start of the brew
+  int64_t created_ms; // host clock when the file was created
+} __attribute__((packed));
+
+struct bwc_group_header_t {
+  uint16_t magic;
+  uint16_t rows;
+  int64_t t_first;
+  int64_t t_last;
+  uint32_t col_len[NumColumns];
+} __attribute__((packed));
+
+/*
+ * varint and zigzag coding
+ */
+inline void put_varint(std::vector<uint8_t>& out, uint64_t v)
+{
+  while (v >= 0x80)
+  {
+    out.push_back((uint8_t)(v | 0x80));
+    v >>= 7;
+  }
+  out.push_back((uint8_t)v);
+}
+
+inline bool get_varint(const uint8_t*& p, const uint8_t* end, uint64_t& v)
+{
+  v = 0;
+  for (int shift = 0; p < end && shift < 64; shift += 7)
+  {
+    uint8_t b = *p++;
+    v |= (uint64_t)(b & 0x7F) << shift;
+    if ((b & 0x80) == 0)
+    {
+      return true;
+    }
+  }
+  return false;
+}
+
+inline uint64_t zigzag(int64_t v)
+{
+  return ((uint64_t)v << 1) ^ (uint64_t)(v >> 63);
+}
+
+inline int64_t unzigzag(uint64_t v)
+{
+  return (int64_t)(v >> 1) ^ -(int64_t)(v & 1);
+}
+
+/*
+ * appends samples to a brew file, one row group at a time
+ */
+class BrewWriter
+{
+public:
+  BrewWriter() : file_(NULL), group_rows_(BWC_GROUP_ROWS) {}
+  ~BrewWriter() { close(); }
+
+  /*
+   * open a brew file for appending, a new one gets a file header
+   * an existing one is cut back to the end of its last complete group, or to nothing if it
+   * has no valid file header
+   */
+  bool open(const std::string& path, uint32_t process_start, int64_t created_ms)
+  {
+    close();
+    long size, complete;
+    if (complete_length(path, size, complete) && complete < size && truncate(path.c_str(), complete) != 0)
+    {
+      return false;
+    }
+    file_ = fopen(path.c_str(), "ab");
+    if (file_ == NULL)
+    {
+      return false;
+    }
+    if (ftell(file_) == 0)
+    {
+      bwc_file_header_t h;
+      memcpy(h.magic, BWC_MAGIC, 4);
+      h.process_start = process_start;
+      h.created_ms = created_ms;
+      if (fwrite(&h, sizeof(h), 1, file_) != 1 || fflush(file_) != 0)
+      {
+        close();
+        return false;
+      }
+    }
+    path_ = path;
+    return true;
+  }
+
+  bool isOpen() const { return file_ != NULL; }
+  const std::string& path() const { return path_; }
+
+  /*
+   * number of rows per group, smaller groups lose less on a crash but compress worse
+   */
+  void setGroupRows(unsigned rows) { group_rows_ = rows > 0 && rows <= 0xFFFF ? rows : BWC_GROUP_ROWS; }
+
+  bool append(const sample_t& s)
+  {
+    rows_.push_back(s);
+    return rows_.size() < group_rows_ || flush();
+  }
+
+  /*
+   * write the buffered rows as one group
+   */
+  bool flush()
+  {
+    if (file_ == NULL || rows_.empty())
+    {
+      return file_ != NULL;
+    }
+    std::vector<uint8_t> cols[NumColumns];
+    int64_t t_prev = rows_.front().t_ms;
+    int16_t temp_prev = 0, target_prev = 0;
+    for (size_t i = 0; i < rows_.size(); i++)
+    {
+      const sample_t& s = rows_[i];
+      put_varint(cols[ColTime], zigzag(s.t_ms - t_prev));
+      put_varint(cols[ColTemp], zigzag((int64_t)s.temp - temp_prev));
+      put_varint(cols[ColTarget], zigzag((int64_t)s.target - target_prev));
+      t_prev = s.t_ms;
+      temp_prev = s.temp;
+      target_prev = s.target;
+    }
+    encode_rle(cols[ColHeater], &sample_t::heater);
+    encode_rle(cols[ColPhase], &sample_t::phase);
+    encode_rle(cols[ColStep], &sample_t::step);
+    encode_rle(cols[ColRest], &sample_t::rest);
+    encode_rle(cols[ColFlags], &sample_t::flags);
+
+    bwc_group_header_t h;
+    h.magic = BWC_GROUP_MAGIC;
+    h.rows = rows_.size();
+    h.t_first = rows_.front().t_ms;
+    h.t_last = rows_.back().t_ms;
+    for (int c = 0; c < NumColumns; c++)
+    {
+      h.col_len[c] = cols[c].size();
+    }
+    bool ok = fwrite(&h, sizeof(h), 1, file_) == 1;
+    for (int c = 0; ok && c < NumColumns; c++)
+    {
+      ok = fwrite(cols[c].data(), 1, cols[c].size(), file_) == cols[c].size();
+    }
+    ok = fflush(file_) == 0 && ok;
+    rows_.clear();
+    return ok;
+  }
+
+  void close()
+  {
+    if (file_ != NULL)
+    {
+      flush();
+      fclose(file_);
+      file_ = NULL;
+    }
+  }
+
+private:
+  FILE* file_;
+  std::string path_;
+  unsigned group_rows_;
+  std::vector<sample_t> rows_;
+
+  /*
+   * size of an existing file and its length up to the end of the last complete group,
+   * false if there is no such file
+   */
+  static bool complete_length(const std::string& path, long& size, long& complete)
+  {
+    FILE* f = fopen(path.c_str(), "rb");
+    if (f == NULL)
+    {
+      return false;
+    }
+    size = 0;
+    complete = 0;
+    bwc_file_header_t fh;
+    if (fseek(f, 0, SEEK_END) == 0 && (size = ftell(f)) >= 0 && fseek(f, 0, SEEK_SET) == 0 &&
+        fread(&fh, sizeof(fh), 1, f) == 1 && memcmp(fh.magic, BWC_MAGIC, 4) == 0)
+    {
+      complete = sizeof(fh);
+      bwc_group_header_t h;
+      while (fread(&h, sizeof(h), 1, f) == 1 && h.magic == BWC_GROUP_MAGIC)
+      {
+        long end = complete + sizeof(h);
+        for (int c = 0; c < NumColumns; c++)
+        {
+          end += h.col_len[c];
+        }
+        if (end > size || fseek(f, end, SEEK_SET) != 0)
+        {
+          break;
+        }
+        complete = end;
+      }
+    }
+    fclose(f);
+    return true;
+  }
+
+  void encode_rle(std::vector<uint8_t>& out, uint8_t sample_t::*field)
+  {
+    size_t i = 0;
+    while (i < rows_.size())
+    {
+      uint8_t v = rows_[i].*field;
+      size_t run = 1;
+      while (i + run < rows_.size() && rows_[i + run].*field == v)
+      {
+        run++;
+      }
+      out.push_back(v);
+      put_varint(out, run);
+      i += run;
+    }
+  }
+};
+
+/*
+ * reads a brew file group by group
+ */
+class BrewReader
+{
+public:
+  BrewReader() : file_(NULL) {}
+  ~BrewReader() { close(); }
+
+  bool open(const std::string& path)
+  {
+    close();
+    file_ = fopen(path.c_str(), "rb");
+    if (file_ == NULL)
+    {
+      return false;
+    }
+    if (fseek(file_, 0, SEEK_END) != 0 || (size_ = ftell(file_)) < 0 || fseek(file_, 0, SEEK_SET) != 0 ||
+        fread(&header_, sizeof(header_), 1, file_) != 1 || memcmp(header_.magic, BWC_MAGIC, 4) != 0)
+    {
+      close();
+      return false;
+    }
+    return true;
+  }
+
+  void close()
+  {
+    if (file_ != NULL)
+    {
+      fclose(file_);
+      file_ = NULL;
+    }
+  }
+
+  const bwc_file_header_t& header() const { return header_; }
+
+  /*
+   * read the next group header, false at the end of the file or on a truncated group
+   * must be followed by either skip() or read()
+   */
+  bool next(bwc_group_header_t& h)
+  {
+    if (fread(&h, sizeof(h), 1, file_) != 1 || h.magic != BWC_GROUP_MAGIC)
+    {
+      return false;
+    }
+    data_len_ = 0;
+    for (int c = 0; c < NumColumns; c++)
+    {
+      data_len_ += h.col_len[c];
+    }
+    long pos = ftell(file_);
+    return pos >= 0 && data_len_ <= (size_t)(size_ - pos);
+  }
+
+  bool skip()
+  {
+    return fseek(file_, data_len_, SEEK_CUR) == 0;
+  }
+
+  /*
+   * decode the rows of the group whose header was returned by next()
+   */
+  bool read(const bwc_group_header_t& h, std::vector<sample_t>& rows)
+  {
+    buf_.resize(data_len_);
+    if (data_len_ > 0 && fread(buf_.data(), 1, data_len_, file_) != data_len_)
+    {
+      return false;
+    }
+    rows.assign(h.rows, sample_t());
+    const uint8_t* col = buf_.data();
+    const uint8_t* end[NumColumns];
+    const uint8_t* start[NumColumns];
+    for (int c = 0; c < NumColumns; c++)
+    {
+      start[c] = col;
+      col += h.col_len[c];
+      end[c] = col;
+    }
+
+    int64_t t = h.t_first;
+    int64_t temp = 0, target = 0;
+    const uint8_t* pt = start[ColTime];
+    const uint8_t* ptemp = start[ColTemp];
+    const uint8_t* ptarget = start[ColTarget];
+    for (size_t i = 0; i < rows.size(); i++)
+    {
+      uint64_t v;
+      if (!get_varint(pt, end[ColTime], v))
+      {
+        return false;
+      }
+      t += unzigzag(v);
+      if (!get_varint(ptemp, end[ColTemp], v))
+      {
+        return false;
+      }
+      temp += unzigzag(v);
+      if (!get_varint(ptarget, end[ColTarget], v))
+      {
+        return false;
+      }
+      target += unzigzag(v);
+      rows[i].t_ms = t;
+      rows[i].temp = (int16_t)temp;
+      rows[i].target = (int16_t)target;
+    }
+    return decode_rle(start[ColHeater], end[ColHeater], rows, &sample_t::heater) &&
+        decode_rle(start[ColPhase], end[ColPhase], rows, &sample_t::phase) &&
+        decode_rle(start[ColStep], end[ColStep], rows, &sample_t::step) &&
+        decode_rle(start[ColRest], end[ColRest], rows, &sample_t::rest) &&
+        decode_rle(start[ColFlags], end[ColFlags], rows, &sample_t::flags);
+  }
+
+private:
+  FILE* file_;
+  long size_;
+  bwc_file_header_t header_;
+  size_t data_len_;
+  std::vector<uint8_t> buf_;
+
+  static bool decode_rle(const uint8_t* p, const uint8_t* end, std::vector<sample_t>& rows, uint8_t sample_t::*field)
+  {
+    size_t i = 0;
+    while (p < end)
+    {
+      uint8_t v = *p++;
+      uint64_t run;
+      if (!get_varint(p, end, run) || run > rows.size() - i)
+      {
+        return false;
+      }
+      for (uint64_t j = 0; j < run; j++)
+      {
+        rows[i++].*field = v;
+      }
+    }
+    return i == rows.size();
+  }
+};
+
+#endif /* BW_TOOLS_STORE_H_ */
@@ -0,0 +1,466 @@
+/*
+ * bwtest - host tests of the brew archive, the program decoder and the brew process
+ *
+ * Writes brew files with bwstore.h and reads them back, walks programs with the decoder of
+ * ../program.cpp and runs ../brewproc.cpp across a reset, all through the Arduino stubs of the
+ * replay. The process is only tested with MOCK_TEMP_SENSOR undefined in ../brauwerkstatt.h.
+ * Every failed check is printed with its line, the files are written to $TMPDIR (default /tmp)
+ * and removed afterwards.
+ *
+ * Build (in tools/, the checkpoint of a host build is larger and needs its own EEPROM layout):
+ *   g++ -std=gnu++11 -O2 -Wall -Ireplay -I.. -DARDUINO=10800 -DEEPROM_RECEIPE_OFFSET=128 \
+ *     -o bwtest bwtest.cpp ../program.cpp ../brewproc.cpp
+ * Usage: bwtest
+ * Exit status: 0 all checks passed, 1 a check failed
+ */
+#include <stdlib.h>
+#include <unistd.h>
+
+#include <EEPROM.h>
+
+#include "brewproc.h"
+#include "bwstore.h"
+#include "program.h"
+
+static int checks = 0;
+static int failed = 0;
+
+#define CHECK(cond) check((cond), #cond, __LINE__)
+
+static bool check(bool ok, const char* what, int line)
+{
+  checks++;
+  if (!ok)
+  {
+    failed++;
+    fprintf(stderr, "bwtest.cpp:%d: check failed: %s\n", line, what);
+  }
+  return ok;
+}
+
+static std::string temp_path()
+{
+  const char* dir = getenv("TMPDIR");
+  std::string path = std::string(dir != NULL ? dir : "/tmp") + "/bwtestXXXXXX";
+  std::vector<char> buf(path.begin(), path.end());
+  buf.push_back('\0');
+  int fd = mkstemp(buf.data());
+  if (fd < 0)
+  {
+    perror("bwtest: mkstemp");
+    exit(1);
+  }
+  close(fd);
+  return buf.data();
+}
+
+static bool same(const sample_t& a, const sample_t& b)
+{
+  return a.t_ms == b.t_ms && a.temp == b.temp && a.target == b.target && a.heater == b.heater &&
+      a.phase == b.phase && a.step == b.step && a.rest == b.rest && a.flags == b.flags;
+}
+
+/*
+ * a brew with gaps in the clock, temperatures below zero and without a target
+ */
+static std::vector<sample_t> make_samples(size_t n)
+{
+  std::vector<sample_t> samples;
+  int64_t t = 1700000000000LL;
+  for (size_t i = 0; i < n; i++)
+  {
+    sample_t s;
+    t += i % 50 == 49 ? 3600000 : 1000 + (int)(i % 7) - 3;
+    s.t_ms = t;
+    s.temp = (int16_t)(i < 10 ? -250 + (int)i * 17 : 1800 + (int)(i * 37 % 8000));
+    s.target = (int16_t)(i % 30 < 10 ? -1 : 4500 + (int)(i / 30) * 100);
+    s.heater = i % 11 < 6;
+    s.phase = (uint8_t)(i / 40);
+    s.step = (uint8_t)(i / 13);
+    s.rest = (uint8_t)(i / 60);
+    s.flags = i % 97 == 0 ? 0x81 : 0;
+    samples.push_back(s);
+  }
+  samples.back().temp = INT16_MAX;
+  samples.front().target = INT16_MIN;
+  return samples;
+}
+
+/*
+ * read all groups of a file, false if one can't be read, out and groups hold the ones before it
+ */
+static bool read_all(const std::string& path, std::vector<sample_t>& out, unsigned& groups)
+{
+  BrewReader reader;
+  if (!reader.open(path))
+  {
+    return false;
+  }
+  out.clear();
+  groups = 0;
+  bwc_group_header_t h;
+  std::vector<sample_t> rows;
+  while (reader.next(h))
+  {
+    if (!reader.read(h, rows))
+    {
+      return false;
+    }
+    if (rows.empty() || h.t_first != rows.front().t_ms || h.t_last != rows.back().t_ms)
+    {
+      fprintf(stderr, "bwtest: group %u doesn't match its header\n", groups);
+      return false;
+    }
+    out.insert(out.end(), rows.begin(), rows.end());
+    groups++;
+  }
+  return true;
+}
+
+static void test_varint()
+{
+  const int64_t values[] = { 0, 1, -1, 63, -64, 64, 127, 128, -129, 300, INT32_MAX, INT32_MIN, INT64_MAX, INT64_MIN };
+  std::vector<uint8_t> buf;
+  for (size_t i = 0; i < sizeof(values) / sizeof(values[0]); i++)
+  {
+    put_varint(buf, zigzag(values[i]));
+  }
+  const uint8_t* p = buf.data();
+  for (size_t i = 0; i < sizeof(values) / sizeof(values[0]); i++)
+  {
+    uint64_t v;
+    CHECK(get_varint(p, buf.data() + buf.size(), v) && unzigzag(v) == values[i]);
+  }
+  CHECK(p == buf.data() + buf.size());
+  CHECK(zigzag(-1) == 1 && zigzag(1) == 2);
+
+  // a varint cut short
+  buf.clear();
+  put_varint(buf, 1ULL << 40);
+  p = buf.data();
+  uint64_t v;
+  CHECK(!get_varint(p, buf.data() + buf.size() - 1, v));
+}
+
+static void test_archive_round_trip()
+{
+  std::string path = temp_path();
+  std::vector<sample_t> samples = make_samples(1000);
+
+  // two sessions append to the same file, the second one must not write another file header
+  BrewWriter writer;
+  writer.setGroupRows(128);
+  CHECK(writer.open(path, 4711, samples.front().t_ms));
+  for (size_t i = 0; i < 700; i++)
+  {
+    CHECK(writer.append(samples[i]));
+  }
+  writer.close();
+  CHECK(writer.open(path, 4711, samples.front().t_ms));
+  for (size_t i = 700; i < samples.size(); i++)
+  {
+    CHECK(writer.append(samples[i]));
+  }
+  writer.close();
+
+  std::vector<sample_t> rows;
+  unsigned groups;
+  CHECK(read_all(path, rows, groups));
+  CHECK(groups == 6 + 3); // 700 = 5 * 128 + 60, 300 = 2 * 128 + 44
+  if (CHECK(rows.size() == samples.size()))
+  {
+    size_t diffs = 0;
+    for (size_t i = 0; i < rows.size(); i++)
+    {
+      diffs += !same(rows[i], samples[i]);
+    }
+    CHECK(diffs == 0);
+  }
+
+  BrewReader reader;
+  CHECK(reader.open(path));
+  CHECK(reader.header().process_start == 4711 && reader.header().created_ms == samples.front().t_ms);
+
+  // skipping a group lands on the header of the next one
+  bwc_group_header_t h;
+  CHECK(reader.next(h) && h.rows == 128 && reader.skip());
+  CHECK(reader.next(h) && h.t_first == samples[128].t_ms && reader.read(h, rows) && same(rows[0], samples[128]));
+  reader.close();
+
+  // a group cut short by a crash, in its header or in its columns, ends the file, the complete
+  // groups before it are still read
+  CHECK(reader.open(path));
+  size_t last_len = 0;
+  while (reader.next(h) && reader.skip())
+  {
+    last_len = sizeof(h);
+    for (int c = 0; c < NumColumns; c++)
+    {
+      last_len += h.col_len[c];
+    }
+  }
+  reader.close();
+  FILE* f = fopen(path.c_str(), "rb");
+  CHECK(f != NULL && fseek(f, 0, SEEK_END) == 0);
+  long size = f != NULL ? ftell(f) : 0;
+  if (f != NULL)
+  {
+    fclose(f);
+  }
+  CHECK(truncate(path.c_str(), size - 5) == 0);
+  CHECK(read_all(path, rows, groups));
+  CHECK(groups == 8 && rows.size() == samples.size() - 44);
+  CHECK(truncate(path.c_str(), size - last_len + sizeof(h) / 2) == 0);
+  CHECK(read_all(path, rows, groups));
+  CHECK(groups == 8 && rows.size() == samples.size() - 44);
+
+  // a writer that resumes the file cuts off the torn group, everything appended after it is read
+  for (int torn = 0; torn < 2; torn++)
+  {
+    if (torn == 1)
+    {
+      CHECK(truncate(path.c_str(), size - 5) == 0);
+    }
+    CHECK(writer.open(path, 4711, samples.front().t_ms));
+    for (size_t i = samples.size() - 44; i < samples.size(); i++)
+    {
+      CHECK(writer.append(samples[i]));
+    }
+    writer.close();
+    CHECK(read_all(path, rows, groups));
+    CHECK(groups == 9 && rows.size() == samples.size() && same(rows.back(), samples.back()));
+  }
+
+  // not an archive
+  f = fopen(path.c_str(), "wb");
+  if (f != NULL)
+  {
+    fputs("BWC0", f);
+    fclose(f);
+  }
+  CHECK(!reader.open(path));
+  unlink(path.c_str());
+}
+
+/*
+ * the shape of a compiled receipe: mash-in, two rests (the second one a ramp behind a branch),
+ * the mash-out and the sparge program after it
+ */
+static const byte PROGRAM[] = {
+  /*  0 */ OpPhase, 1,
+  /*  2 */ OpHeatTo, 45,
+  /*  4 */ OpPrompt, 7,
+  /*  6 */ OpPhase, 2,
+  /*  8 */ OpHeatTo, 52,
+  /* 10 */ OpHoldFor, 10,
+  /* 12 */ OpBranchBelow, 60, 1,
+  /* 15 */ OpRamp, 63, 20,
+  /* 18 */ OpHoldFor, 15,
+  /* 20 */ OpAlarm, 3,
+  /* 22 */ OpEnd,
+  /* 23 */ OpHeatTo, 78,
+  /* 25 */ OpBoil, 255,
+  /* 27 */ OpCool, 20,
+  /* 29 */ OpEnd,
+};
+
+static void test_program_decoder()
+{
+  byte program[PROGRAM_SIZE];
+  memset(program, OpEnd, sizeof(program));
+  memcpy(program, PROGRAM, sizeof(PROGRAM));
+
+  const byte lengths[OpCount] = { 1, 2, 2, 2, 3, 2, 2, 2, 3, 2 };
+  for (byte op = 0; op < OpCount; op++)
+  {
+    CHECK(program_op_length(op) == lengths[op]);
+  }
+  CHECK(program_op_length(OpCount) == 1);
+  CHECK(program_op_length(0xFF) == 1);
+
+  CHECK(program_op_seconds(&program[10]) == 600);
+  CHECK(program_op_seconds(&program[15]) == 1200);
+  CHECK(program_op_seconds(&program[25]) == 255 * 60UL);
+  CHECK(program_op_seconds(&program[8]) == 0);
+
+  CHECK(program_skip(program, 0, 0) == 0);
+  CHECK(program_skip(program, 0, 1) == 2);
+  CHECK(program_skip(program, 0, 6) == 12);
+  CHECK(program_skip(program, 12, 1) == 15); // the branch is one step with both operands
+  CHECK(program_skip(program, 12, 2) == 18);
+  CHECK(program_skip(program, 0, 100) == 22); // stops at the end of the mash program
+  CHECK(program_skip(program, 22, 1) == 22);
+  CHECK(program_skip(program, 23, 2) == 27);
+
+  CHECK(program_next_temp(program, 0) == 45);
+  CHECK(program_next_temp(program, 2) == 52);
+  CHECK(program_next_temp(program, 8) == 63); // past the hold and the branch to the ramp
+  CHECK(program_next_temp(program, 15) == -1); // no heating step before the OpEnd
+  CHECK(program_next_temp(program, 22) == -1);
+  CHECK(program_next_temp(program, 23) == -1); // the cooling doesn't count as heating
+
+  // a program without OpEnd doesn't walk past PROGRAM_SIZE
+  memset(program, OpHoldFor, sizeof(program));
+  CHECK(program_skip(program, 0, 255) == PROGRAM_SIZE);
+  CHECK(program_next_temp(program, 0) == -1);
+}
+
+/*
+ * BrewProcess on the stubs of the replay, without RECORDER: the clock is the test's, the card
+ * mounts but has no receipe file, all sensors read the temp of the DallasTemperature stub
+ */
+static unsigned long clock_ms = 0;
+static unsigned long clock_base = 1000000; // now() at clock_ms 0
+
+unsigned long millis() { return clock_ms; }
+unsigned long micros() { return clock_ms * 1000; }
+unsigned long now() { return clock_base + clock_ms / 1000; }
+void setTime(unsigned long t) { clock_base = t - clock_ms / 1000; }
+
+FRESULT pf_mount(FATFS*) { return FR_OK; }
+FRESULT pf_open(const char*) { return FR_NO_FILE; }
+FRESULT pf_read(void*, unsigned int, unsigned int* br) { *br = 0; return FR_NOT_OPENED; }
+bool log_record(byte, byte, const long*) { return true; }
+
+HardwareSerial Serial;
+EEPROMClass EEPROM;
+
+/*
+ * run the process for the given seconds, as the scheduler does, confirming every prompt if asked to
+ */
+static void run_process(BrewProcess& proc, unsigned long seconds, bool confirm)
+{
+  for (unsigned long end = clock_ms + seconds * 1000; clock_ms < end; clock_ms += 100)
+  {
+    proc.update_process();
+    if (confirm && proc.needConfirmation())
+    {
+      proc.confirm();
+    }
+  }
+}
+
+static void test_config()
+{
+  OneWire bus(0);
+  DallasTemperature sensors(&bus);
+  NewRemoteTransmitter rf(0, 0, 0, 0);
+  BrewProcess proc(&sensors, &rf);
+  int8_t idx = proc.findConfig("hysteresis");
+  CHECK(idx >= 0 && proc.findConfig("nonsense") < 0);
+  CHECK(proc.setConfig(idx, 0.3F) && proc.getConfig(idx) == 0.3F);
+  CHECK(!proc.setConfig(idx, NAN) && !proc.setConfig(idx, INFINITY) && !proc.setConfig(idx, -0.1F));
+  CHECK(!proc.setConfig(idx, proc.configMax(idx) + 1) && proc.getConfig(idx) == 0.3F);
+
+  // the boiling point is stored, it has to be in the range that is taken from the EEPROM
+  idx = proc.findConfig("boil_point");
+  CHECK(!proc.setConfig(idx, 50.0F) && !proc.setConfig(idx, NAN) && proc.getConfig(idx) == 0);
+  CHECK(proc.setConfig(idx, 98.5F) && proc.setConfig(idx, 0));
+
+  // the settings screen covers every range in a few fast turns, at the top speed of the encoder (x10)
+  for (byte i = 0; i < proc.numConfig(); i++)
+  {
+    float units = proc.configMax(i) * powf(10, proc.configDecimals(i));
+    CHECK(proc.configStep(i) > 0 && units / proc.configStep(i) / 10 <= 150);
+  }
+}
+
+static void test_resume_cooling()
+{
+#ifdef MOCK_TEMP_SENSOR
+  printf("MOCK_TEMP_SENSOR is defined in ../brauwerkstatt.h, the process is not tested\n");
+  return;
+#endif
+  static const char* const RECEIPE[] = { "name=test", "einmaisch_t=45", "rasten=0", "nachguss_t=78", "koch_d=1",
+    "hopfengaben=0", "anstell_t=20" };
+  OneWire bus(0);
+  NewRemoteTransmitter rf(0, 0, 0, 0);
+
+  // boil for a minute, then cool down: the checkpoint is taken at the start of the cooling
+  {
+    DallasTemperature sensors(&bus);
+    sensors.temp = 99.5F;
+    BrewProcess proc(&sensors, &rf);
+    proc.init();
+    CHECK(!proc.hasError() && proc.begin_receipe());
+    for (size_t i = 0; i < sizeof(RECEIPE) / sizeof(RECEIPE[0]); i++)
+    {
+      char line[32];
+      strcpy(line, RECEIPE[i]);
+      CHECK(proc.add_receipe_line(line));
+    }
+    proc.end_receipe();
+    run_process(proc, 10, false);
+    CHECK(proc.start_boil_process());
+    run_process(proc, 120, true);
+    CHECK(proc.getPhase() == BrewProcess::Cool && proc.getStep() == BrewProcess::Cooling);
+  }
+
+  // a reset: the wort is still hot, but there is no reading yet when the checkpoint is restored
+  // and until the first conversion, the cooling goes on
+  DallasTemperature sensors(&bus);
+  sensors.temp = 80.0F;
+  BrewProcess proc(&sensors, &rf);
+  clock_ms = 0;
+  proc.init();
+  CHECK(!proc.hasError() && proc.isMashRunning());
+  CHECK(proc.getPhase() == BrewProcess::Cool && proc.getStep() == BrewProcess::Cooling && !proc.needConfirmation());
+  run_process(proc, 15, false);
+  CHECK(proc.getCurrentTemp() == 80.0F);
+  CHECK(proc.getStep() == BrewProcess::Cooling && !proc.needConfirmation() && !proc.heaterOn());
+  sensors.temp = 19.5F;
+  run_process(proc, 15, false);
+  CHECK(proc.getStep() == BrewProcess::UserPrompt && proc.getPrompt() == StrPitch);
+  proc.stop_process();
+}
+
+/*
+ * with heat_rate set to 0 and nothing measured, a ramp has no feed-forward duty, without the
+ * ramp_gain the heater stays off
+ */
+static void test_ramp_without_rate()
+{
+#ifdef MOCK_TEMP_SENSOR
+  return;
+#endif
+  static const char* const RECEIPE[] = { "name=ramp", "einmaisch_t=45", "rasten=0", "rampe=60/10", "nachguss_t=78",
+    "koch_d=60", "hopfengaben=0" };
+  OneWire bus(0);
+  DallasTemperature sensors(&bus);
+  sensors.temp = 50.0F;
+  NewRemoteTransmitter rf(0, 0, 0, 0);
+  BrewProcess proc(&sensors, &rf);
+  proc.init();
+  CHECK(proc.setConfig(proc.findConfig("heat_rate"), 0) && proc.setConfig(proc.findConfig("ramp_gain"), 0));
+  CHECK(!proc.isRunning() && proc.begin_receipe());
+  for (size_t i = 0; i < sizeof(RECEIPE) / sizeof(RECEIPE[0]); i++)
+  {
+    char line[32];
+    strcpy(line, RECEIPE[i]);
+    CHECK(proc.add_receipe_line(line));
+  }
+  proc.end_receipe();
+  CHECK(proc.start_mash_process());
+  run_process(proc, 30, true);
+  CHECK(proc.getStep() == BrewProcess::Ramp);
+  bool heater = false;
+  for (int i = 0; i < 60; i++)
+  {
+    run_process(proc, 1, false);
+    heater = heater || proc.heaterOn();
+  }
+  CHECK(proc.getStep() == BrewProcess::Ramp && proc.getTargetTemp() > 50.0F && !heater);
+  proc.stop_process();
+}
+
+int main()
+{
+  test_varint();
+  test_archive_round_trip();
+  test_program_decoder();
+  test_config();
+  test_resume_cooling();
+  test_ramp_without_rate();
+  printf("%d checks, %d failed\n", checks, failed);
+  return failed > 0 ? 1 : 0;
+}
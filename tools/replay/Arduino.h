@@ -0,0 +1,71 @@
+/*
+ * Host stand-in for the Arduino core, only what the firmware sources use
+ * millis() and micros() are the replay clock (bwreplay.cpp), Serial output is discarded
+ */
+#ifndef BW_REPLAY_ARDUINO_H_
+#define BW_REPLAY_ARDUINO_H_
+
+#include <ctype.h>
+#include <math.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "avr/interrupt.h"
+#include "avr/io.h"
+#include "avr/pgmspace.h"
+
+typedef uint8_t byte;
+typedef bool boolean;
+
+#define HIGH 1
+#define LOW 0
+#define INPUT 0
+#define OUTPUT 1
+#define INPUT_PULLUP 2
+#define A0 14
+
+#define digitalPinToBitMask(p) ((uint8_t)(1 << ((p) % 8)))
+
+unsigned long millis();
+unsigned long micros();
+inline void delay(unsigned long) {}
+inline void delayMicroseconds(unsigned int) {}
+inline void pinMode(uint8_t, uint8_t) {}
+inline void digitalWrite(uint8_t, uint8_t) {}
+inline int digitalRead(uint8_t) { return LOW; }
+
+class __FlashStringHelper;
+#define F(s) ((const __FlashStringHelper*)(s))
+
+struct Print {
+  size_t write(uint8_t) { return 1; }
+  size_t write(const uint8_t*, size_t n) { return n; }
+  template<class T> size_t print(T) { return 0; }
+  template<class T> size_t print(T, int) { return 0; }
+  size_t println() { return 0; }
+  template<class T> size_t println(T) { return 0; }
+  template<class T> size_t println(T, int) { return 0; }
+};
+
+// nothing to read, the recorded input comes in through the recorder taps
+// the TX room is that of the ATmega328P core, one byte of its buffer is always left free
+#define SERIAL_TX_BUFFER_SIZE 64
+struct HardwareSerial : Print {
+  void begin(unsigned long) {}
+  int available() { return 0; }
+  int read() { return -1; }
+  int peek() { return -1; }
+  int availableForWrite() { return SERIAL_TX_BUFFER_SIZE - 1; }
+  void flush() {}
+  operator bool() { return true; }
+};
+extern HardwareSerial Serial;
+
+template<class T> T min(T a, T b) { return a < b ? a : b; }
+template<class T> T max(T a, T b) { return a > b ? a : b; }
+#define constrain(a, l, h) ((a) < (l) ? (l) : ((a) > (h) ? (h) : (a)))
+
+#endif /* BW_REPLAY_ARDUINO_H_ */
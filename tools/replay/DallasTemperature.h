@@ -0,0 +1,26 @@
+#ifndef BW_REPLAY_DALLASTEMPERATURE_H_
+#define BW_REPLAY_DALLASTEMPERATURE_H_
+
+#include <math.h>
+
+#include "OneWire.h"
+
+typedef uint8_t DeviceAddress[8];
+
+// no sensors, the readings come from the recording
+// the host tests (bwtest.cpp) set temp, all sensors on the bus read it, NaN: none found
+class DallasTemperature
+{
+public:
+  float temp = NAN;
+
+  DallasTemperature(OneWire*) {}
+  void begin() {}
+  void setWaitForConversion(bool) {}
+  bool getAddress(uint8_t*, uint8_t) { return !isnan(temp); }
+  void setResolution(uint8_t*, uint8_t) {}
+  void requestTemperatures() {}
+  float getTempC(const uint8_t*) { return isnan(temp) ? -127.0F : temp; }
+};
+
+#endif /* BW_REPLAY_DALLASTEMPERATURE_H_ */
@@ -0,0 +1,19 @@
+#ifndef BW_REPLAY_EEPROM_H_
+#define BW_REPLAY_EEPROM_H_
+
+#include <stdint.h>
+
+// the last EEPROM address of the ATmega328P, from avr/io.h on the target
+#define E2END 1023
+
+// starts erased, what the firmware read at startup comes from the recording
+struct EEPROMClass {
+  uint8_t cells[E2END + 1];
+  EEPROMClass() { for (int i = 0; i <= E2END; i++) cells[i] = 0xFF; }
+  uint8_t read(int a) { return cells[a]; }
+  void write(int a, uint8_t v) { cells[a] = v; }
+  void update(int a, uint8_t v) { cells[a] = v; }
+};
+extern EEPROMClass EEPROM;
+
+#endif /* BW_REPLAY_EEPROM_H_ */
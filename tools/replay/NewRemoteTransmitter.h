@@ -0,0 +1,14 @@
+#ifndef BW_REPLAY_NEWREMOTETRANSMITTER_H_
+#define BW_REPLAY_NEWREMOTETRANSMITTER_H_
+
+#include <stdint.h>
+
+// the heater commands are compared where they are recorded, nothing to send
+class NewRemoteTransmitter
+{
+public:
+  NewRemoteTransmitter(unsigned long, uint8_t, unsigned int, uint8_t) {}
+  void sendUnit(uint8_t, bool) {}
+};
+
+#endif /* BW_REPLAY_NEWREMOTETRANSMITTER_H_ */
@@ -0,0 +1,12 @@
+#ifndef BW_REPLAY_ONEWIRE_H_
+#define BW_REPLAY_ONEWIRE_H_
+
+#include <stdint.h>
+
+class OneWire
+{
+public:
+  OneWire(uint8_t) {}
+};
+
+#endif /* BW_REPLAY_ONEWIRE_H_ */
@@ -0,0 +1,13 @@
+#ifndef BW_REPLAY_PETITFS_H_
+#define BW_REPLAY_PETITFS_H_
+
+// no card, results come from the recording, the receipe file is read from the host (bwreplay.cpp)
+// the host tests (bwtest.cpp) have their own card
+typedef struct { int unused; } FATFS;
+typedef enum { FR_OK = 0, FR_DISK_ERR, FR_NOT_READY, FR_NO_FILE, FR_NOT_OPENED, FR_NOT_ENABLED, FR_NO_FILESYSTEM } FRESULT;
+
+FRESULT pf_mount(FATFS* fs);
+FRESULT pf_open(const char* path);
+FRESULT pf_read(void* buf, unsigned int btr, unsigned int* br);
+
+#endif /* BW_REPLAY_PETITFS_H_ */
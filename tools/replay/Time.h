@@ -0,0 +1,15 @@
+#ifndef BW_REPLAY_TIME_H_
+#define BW_REPLAY_TIME_H_
+
+// the clock of the Time library as recorded, see rec_now() (bwreplay.cpp)
+unsigned long now();
+// only called without RECORDER, by the host tests (bwtest.cpp)
+void setTime(unsigned long t);
+
+#define SECS_PER_MIN 60UL
+#define SECS_PER_HOUR 3600UL
+#define numberOfSeconds(_time_) ((_time_) % SECS_PER_MIN)
+#define numberOfMinutes(_time_) (((_time_) / SECS_PER_MIN) % SECS_PER_MIN)
+#define numberOfHours(_time_) (((_time_) % 86400UL) / SECS_PER_HOUR)
+
+#endif /* BW_REPLAY_TIME_H_ */
@@ -0,0 +1,8 @@
+#ifndef BW_REPLAY_AVR_INTERRUPT_H_
+#define BW_REPLAY_AVR_INTERRUPT_H_
+
+#define ISR(v) extern "C" void v(void); extern "C" void v(void)
+#define cli()
+#define sei()
+
+#endif /* BW_REPLAY_AVR_INTERRUPT_H_ */
@@ -0,0 +1,12 @@
+#ifndef BW_REPLAY_AVR_IO_H_
+#define BW_REPLAY_AVR_IO_H_
+
+#include <stdint.h>
+
+// the pin change registers of the encoder, never changed by the replay
+extern volatile uint8_t PIND, PCICR, PCMSK2, PCIFR;
+#define PCIE2 2
+#define PCIF2 2
+#define _BV(b) (1 << (b))
+
+#endif /* BW_REPLAY_AVR_IO_H_ */
@@ -0,0 +1,25 @@
+#ifndef BW_REPLAY_AVR_PGMSPACE_H_
+#define BW_REPLAY_AVR_PGMSPACE_H_
+
+#include <stdio.h>
+#include <string.h>
+
+// one address space on the host
+#define PROGMEM
+#define PGM_P const char*
+#define PSTR(s) (s)
+#define strcpy_P strcpy
+#define strncpy_P strncpy
+#define strcmp_P strcmp
+#define strncmp_P strncmp
+#define strcat_P strcat
+#define strlen_P strlen
+#define memcpy_P memcpy
+#define sprintf_P sprintf
+#define pgm_read_byte(p) (*(const unsigned char*)(p))
+#define pgm_read_word(p) (*(p))
+#define pgm_read_dword(p) (*(const unsigned long*)(p))
+#define pgm_read_float(p) (*(const float*)(p))
+#define pgm_read_ptr(p) (*(void* const*)(p))
+
+#endif /* BW_REPLAY_AVR_PGMSPACE_H_ */
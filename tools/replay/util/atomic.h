@@ -0,0 +1,8 @@
+#ifndef BW_REPLAY_UTIL_ATOMIC_H_
+#define BW_REPLAY_UTIL_ATOMIC_H_
+
+// no interrupts in the replay
+#define ATOMIC_RESTORESTATE 0
+#define ATOMIC_BLOCK(x) for (int atomic_once_ = 1; atomic_once_; atomic_once_ = 0)
+
+#endif /* BW_REPLAY_UTIL_ATOMIC_H_ */
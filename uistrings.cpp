@@ -0,0 +1,77 @@
+#include <EEPROM.h>
+
+#include "recorder.h"
+#include "uistrings.h"
+
+/*
+ * With UI_LANGUAGE_EEPROM all packs are in flash and the language is selected at runtime,
+ * otherwise only the UI_LANGUAGE pack is compiled in.
+ */
+#ifdef UI_LANGUAGE_EEPROM
+
+#define STR_DEFINE(id, de, en) static const char id##_de[] PROGMEM = de; static const char id##_en[] PROGMEM = en;
+#define STR_PTR_DE(id, de, en) id##_de,
+#define STR_PTR_EN(id, de, en) id##_en,
+UI_STRINGS(STR_DEFINE)
+
+static const char* const STRINGS[LangCount][StrCount] PROGMEM = {
+  { UI_STRINGS(STR_PTR_DE) },
+  { UI_STRINGS(STR_PTR_EN) }
+};
+
+#else
+
+#if UI_LANGUAGE == 1
+#define STR_DEFINE(id, de, en) static const char id##_text[] PROGMEM = en;
+#else
+#define STR_DEFINE(id, de, en) static const char id##_text[] PROGMEM = de;
+#endif
+#define STR_PTR(id, de, en) id##_text,
+UI_STRINGS(STR_DEFINE)
+
+static const char* const STRINGS[1][StrCount] PROGMEM = {
+  { UI_STRINGS(STR_PTR) }
+};
+
+#endif /* UI_LANGUAGE_EEPROM */
+
+static byte str_language = 0;
+
+void strings_init()
+{
+#ifdef UI_LANGUAGE_EEPROM
+  byte lang = EEPROM.read(EEPROM_LANGUAGE_OFFSET);
+  rec_eeprom(EEPROM_LANGUAGE_OFFSET, &lang, 1);
+  // erased EEPROM reads 0xFF
+  str_language = lang < LangCount ? lang : UI_LANGUAGE;
+#endif
+}
+
+byte ui_language()
+{
+#ifdef UI_LANGUAGE_EEPROM
+  return str_language;
+#else
+  return UI_LANGUAGE;
+#endif
+}
+
+bool set_ui_language(byte lang)
+{
+#ifdef UI_LANGUAGE_EEPROM
+  if (lang >= LangCount)
+  {
+    return false;
+  }
+  str_language = lang;
+  EEPROM.update(EEPROM_LANGUAGE_OFFSET, lang);
+  return true;
+#else
+  return false;
+#endif
+}
+
+const char* str_P(byte id)
+{
+  return (const char*)pgm_read_word(&STRINGS[str_language][id]);
+}
@@ -0,0 +1,78 @@
+#ifndef BW_UISTRINGS_H_
+#define BW_UISTRINGS_H_
+
+#include "Arduino.h"
+#include "brauwerkstatt.h"
+#include "fmt.h"
+
+/*
+ * UI string table
+ *
+ * All texts shown on the LCD live in flash and are referenced by a one byte id. They are
+ * copied into the line buffer only while a line is rendered, see fmt_string().
+ * X(id, german text, english text)
+ */
+#define UI_STRINGS(X) \
+  X(StrSplash, " Brauwerkstatt v1.0", " Brauwerkstatt v1.0") \
+  X(StrOk, "Ok?", "Ok?") \
+  X(StrMash, "Maischen", "Mash") \
+  X(StrSparge, "Nachguss", "Sparge") \
+  X(StrBoil, "Kochen", "Boil") \
+  X(StrSettings, "Einstellungen", "Settings") \
+  X(StrBack, "Zurueck", "Back") \
+  X(StrMashIn, "Einmaischen", "Mash in") \
+  X(StrRest, "Rast #", "Rest #") \
+  X(StrMashOut, "Abmaischen", "Mash out") \
+  X(StrStepHeat, "/Heizen", "/Heat") \
+  X(StrStepHold, "/Halten", "/Hold") \
+  X(StrStepRamp, "/Rampe", "/Ramp") \
+  X(StrTarget, "Soll: ", "Target ") \
+  X(StrRemaining, " (Rest ", " (left ") \
+  X(StrAlarm, "Alarm!", "Alarm!") \
+  X(StrHopsAdd, "Hopfengabe", "Add hops") \
+  X(StrHopsFirstWort, "Hopfen VWH", "Hops FWH") \
+  X(StrHopsWhirlpool, "Hopfen WP", "Hops WP") \
+  X(StrCool, "Kuehlen", "Cooling") \
+  X(StrPitch, "Anstellen", "Pitch yeast") \
+  /* messages, in the order of BrewProcess::MessageCode */ \
+  X(StrMsgNone, "", "") \
+  X(StrMsgSdCard, "SD-Karten-Fehler", "SD card error") \
+  X(StrMsgReceipeMissing, "REZEPT.TXT fehlt", "REZEPT.TXT missing") \
+  X(StrMsgReceipeParse, "Parse-Fehler", "Receipe parse error") \
+  X(StrMsgLineTooLong, "Zeile zu lange", "Line too long") \
+  X(StrMsgTempSensor, "Temp Sensor Error", "Temp sensor error") \
+  X(StrMsgNoReceipe, "Kein Rezept", "No receipe")
+
+#define UI_STRING_ID(id, de, en) id,
+enum StringId { UI_STRINGS(UI_STRING_ID) StrCount };
+#undef UI_STRING_ID
+
+enum Language { LangDe, LangEn, LangCount };
+
+/*
+ * load the language from EEPROM, UI_LANGUAGE if none has been stored
+ */
+void strings_init();
+
+byte ui_language();
+
+/*
+ * switch the language and store it in EEPROM
+ * returns false if runtime selection is not compiled in (UI_LANGUAGE_EEPROM)
+ */
+bool set_ui_language(byte lang);
+
+/*
+ * PROGMEM pointer to a string in the current language
+ */
+const char* str_P(byte id);
+
+/*
+ * copy a string into a line buffer, fmt.h style: returns the end, writes no '\0'
+ */
+inline char* fmt_string(char* p, byte id)
+{
+  return fmt_str_P(p, str_P(id));
+}
+
+#endif /* BW_UISTRINGS_H_ */